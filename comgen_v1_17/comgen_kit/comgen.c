@@ -21,6 +21,25 @@
  *	     Added support for raw block devices.
  *	     Added support for O_DIRECT
  *	     Added support for Visual studio builds.
+ *	     Added -T multi-threaded block generation pipeline.
+ *	     Made every block addressable by (salt, pattern, file, block).
+ *	     Added SSE2/AVX2/AVX-512 fill kernels with run time dispatch.
+ *	     Added io_uring and libaio write engines with a queue depth.
+ *	     Added pwritev and clone based repeat writes for the dedupe files.
+ *	     Added the -E entropy targeted pattern.
+ *	     Added --ratio/--codec, -E tuned to a compression ratio.
+ *	     Added -o output sinks: stdout/pipe, Unix and TCP sockets.
+ *	     Moved block generation into libcomgen (comgen_lib.c).
+ *	     Added --verify, a parallel O_DIRECT read back of the data set.
+ *	     Added --stats: fill/write time, write latency and progress.
+ *	     Block buffers come from a hugepage backed, NUMA placed pool.
+ *	     Added several -d directories and --jobs concurrent file creation.
+ *	     Made sizes 64 bit bytes with suffixes, added --offset/--length.
+ *	     Added --mix/--extent, the patterns interleaved in one file.
+ *	     Added --dedupe-ratio/--popularity, dedupe over a unique block pool.
+ *	     Added --analyze/--sample/--threshold, sampled entropy of existing data.
+ *	     Added run counting byte histograms, O_DIRECT and compressibility to --analyze.
+ *	     Added --chunks/--memory/--spill, the dedupe ratio of existing data.
  *
  * -----------------------------------------------------------------------------
  *  Copyright 2009-2016 SNIA. All rights reserved.
@@ -82,6 +101,9 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
 #if !defined(WIN32)
 #include <sys/stat.h>
 #include <unistd.h>
@@ -89,8 +111,21 @@
 #include <fcntl.h>
 #include <time.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <getopt.h>
 #endif
 
+#include "comgen_fill.h"
+#include "comgen_io.h"
+#include "comgen_entropy.h"
+#include "comgen_codec.h"
+#include "comgen_lib.h"
+#include "comgen_stats.h"
+#include "comgen_pool.h"
+#include "comgen_sample.h"
+#include "comgen_analyze.h"
+#include "comgen_chunk.h"
+
 /* 
  * The following is used by the RCS source control system. It will 
  * automatically update the version number.
@@ -102,26 +137,87 @@
 /* Prototypes */
 void usage(void);
 static void   _park_miller_srand();
-static int    _park_miller_rand(void);
+int           _park_miller_rand(void);
 static double _park_miller_ran(void);
-void AlternativeFiles(unsigned int, unsigned int, unsigned int);
+void AlternativeFiles(unsigned int, unsigned long long, unsigned int);
 void fillBlock(unsigned int, void *, unsigned int);
 void fillBlock2(unsigned int, void *, unsigned int);
-int createExtDedupeFiles(unsigned int, unsigned int, unsigned int,unsigned long *);
-int createExtComprAndDedupFiles(unsigned int, unsigned int, unsigned int,unsigned long *);
-int createExtIrreducibleFiles(unsigned int, unsigned int, unsigned int,unsigned long *);
+unsigned long pipelineWrite(int, int, unsigned long, unsigned int, unsigned long long,
+	unsigned long long, unsigned int);
+unsigned long repeatWrite(int, void *, unsigned int, unsigned long long, unsigned long long,
+	unsigned int);
+double ratioSample(struct codec *, double, unsigned int, unsigned long, unsigned long, double *, double *);
+double ratioTune(unsigned int, unsigned long);
+void entropySetup(unsigned int, unsigned long);
+unsigned long verifyFile(const char *, int, unsigned long, unsigned int, unsigned long long,
+	unsigned long long);
+void verifyDataSet(unsigned int, unsigned long long, unsigned int);
+int createExtDedupeFiles(unsigned int, unsigned long long, unsigned int,unsigned long *);
+int createExtComprAndDedupFiles(unsigned int, unsigned long long, unsigned int,unsigned long *);
+int createExtIrreducibleFiles(unsigned int, unsigned long long, unsigned int,unsigned long *);
+int createExtEntropyFiles(unsigned int, unsigned long long, unsigned int,unsigned long *);
+unsigned int pipelineDepth(void);
+unsigned int verifyThreads(void);
+void dirSetup(const char *, int);
+void dataFileName(char *, unsigned int, int, unsigned long);
+int openDataFile(const char *, int, int);
+void createFilesJobs(unsigned int, unsigned long long, unsigned int, unsigned int);
+unsigned long long parseSize(const char *, const char *, unsigned long long);
+unsigned long fileBlocks(unsigned long long, unsigned int);
+int fileRegion(unsigned long long, unsigned int, unsigned long long *, unsigned long long *);
+void mixParse(const char *);
+void mixSchedule(void);
+void popularityParse(const char *);
+void sampleParse(const char *);
+void chunksParse(const char *);
+int blockPattern(int, unsigned long);
 /* Prototypes */
 
-/* Define minimum number of bytes that may trigger dedupe */
-#define GRANULE_SIZE 256
+/* The patterns, in the order AlternativeFiles() generates them. */
+#define PAT_COMPRESS	COMGEN_COMPRESS
+#define PAT_DEDUPE	COMGEN_DEDUPE
+#define PAT_BOTH	COMGEN_BOTH
+#define PAT_IRREDUCIBLE	COMGEN_IRREDUCIBLE
+#define PAT_ENTROPY	COMGEN_ENTROPY
+#define PAT_MIX		COMGEN_PATTERNS	/* --mix: extents of the others.	*/
+
+/* File names and data descriptions of the patterns. */
+static const char *pattern_files[COMGEN_PATTERNS + 1] = {
+	"Compress_no_dedupe_%d.dat", "Dedupe_no_compress_%d.dat",
+	"Compress_and_dedupe_%d.dat", "Irreducible_%d.dat", "Entropy_%d.dat",
+	"Mixed_%d.dat"
+};
+static const char *pattern_data[COMGEN_PATTERNS + 1] = {
+	"compressible", "Dedupe", "compress and dedupe", "irreducible", "entropy targeted",
+	"mixed"
+};
+
+/* --mix names of the patterns. */
+static const char *mix_names[COMGEN_PATTERNS] = {
+	"compress", "dedupe", "both", "irreducible", "entropy"
+};
+
+/*
+ * --ratio blocks shuffle chunks of one size. The random 3 to 8 byte
+ * chunks of -E alone make the ratio of single blocks vary by about 20%.
+ */
+#define RATIO_CHUNK	6
+
+/* --verify lists this many mismatching blocks per file. */
+#define VERIFY_REPORT	10
 
-/* Define the density of compression within the granule size */
-#define USE_DENSITY
+/* -d may be given this many times. */
+#define MAX_DIRS	64
 
-#define DENSITY 5
+#if defined(WIN32)
+/* No --stats on Windows. */
+#define statsFileStart(job, name)
+#define statsFileEnd(job)
+#endif
 
 #if defined(WIN32)
 #define _MKDIR(path,mask)	_mkdir(path)
+#define strtoull		_strtoui64
 #else
 #define _MKDIR mkdir	
 #endif
@@ -143,9 +239,53 @@ typedef unsigned char uchar;
 
 /* variables */
 static int park_miller_seedi = 2231;
-int do_irreducible, do_compress, do_dedupe, do_both;
+int do_irreducible, do_compress, do_dedupe, do_both, do_entropy;
+double entropy_target;   /* Bits per byte for the -E pattern.	*/
+double ratio_target;     /* --ratio: tune -E to this compression ratio.	*/
+char *codec_spec = "zstd"; /* --codec used to tune --ratio.		*/
 unsigned int rannum;
 int use_dev,use_dir,use_o_direct;
+int num_threads;         /* Fill threads for the -T pipeline, 0 = inline. */
+int io_engine = IO_ENGINE_SYNC; /* Write engine, see comgen_io.h.	*/
+unsigned int queue_depth = 32;  /* Writes in flight for async engines.	*/
+int repeat_mode = REPEAT_WRITE; /* How dedupe blocks are repeated.	*/
+int data_salt;           /* -s value the data set is generated from.	*/
+struct comgen_ctx *gen_ctx; /* Block generator of the data set.		*/
+int use_sink, sink_fd;   /* -o: all files go, in order, to this stream.	*/
+int do_verify;           /* --verify: read the data set back and compare. */
+unsigned long verify_bad;/* Blocks --verify found to differ.		*/
+int use_stats;           /* --stats: instrument the writes to stats_spec. */
+char *dirs[MAX_DIRS];    /* -d directories, file i goes to dirs[i % ndirs]. */
+unsigned int ndirs;
+unsigned int num_jobs;   /* --jobs: files written at a time, 0 = not given. */
+int use_region;          /* --offset/--length given: rewrite a region.	*/
+unsigned long long region_off;  /* --offset: first byte of each file to write. */
+unsigned long long region_len;  /* --length: bytes to write, 0 = to the end. */
+int use_mix;             /* --mix: one file of interleaved pattern extents. */
+unsigned int mix_weight[COMGEN_PATTERNS]; /* --mix share of each pattern.	*/
+unsigned int mix_total;  /* Sum of mix_weight[].			*/
+unsigned long long mix_extent = 1024 * 1024; /* --extent in bytes.	*/
+unsigned long mix_blocks;/* Blocks per extent.				*/
+unsigned char *mix_schedule; /* Pattern of each extent of one period.	*/
+unsigned long mix_period;/* Extents per period of the schedule.		*/
+double dedupe_ratio;     /* --dedupe-ratio: blocks per unique block, 0 = off. */
+int dedupe_dist = COMGEN_UNIFORM; /* --popularity of the unique blocks.	*/
+double zipf_s = 1.0;     /* Zipf exponent of --popularity zipf.		*/
+char *analyze_paths[MAX_DIRS]; /* --analyze: files and devices to analyze. */
+unsigned int nanalyze;
+double sample_ratio = 1; /* --sample: share of each block sampled.	*/
+int sample_estimator = SAMPLE_MM; /* --sample bias correction.		*/
+double entropy_threshold = 7.0; /* --threshold: compress blocks below it. */
+unsigned long chunk_sizes[CHUNK_SIZES]; /* --chunks: --analyze dedupe instead. */
+unsigned int nchunk_sizes;
+unsigned long long chunk_memory; /* --memory of the dedupe index, 0 = half the RAM. */
+char *spill_dir;         /* --spill: directory of the index partitions.	*/
+#if !defined(WIN32)
+struct bufpool *block_pool; /* Block buffers of the run, see comgen_pool.c. */
+#endif
+char *stats_spec;
+double stats_interval = 5; /* --progress: seconds between reports.	*/
+char *sink_spec;
 long page_size = 4096;
 char fileName[256];      /* holds the file names. 	*/
 char myname[256];        /* holds the myname. 	*/
@@ -153,6 +293,40 @@ char myname[256];        /* holds the myname. 	*/
 /* Used for getopt */
 int cret;
 
+#if !defined(WIN32)
+/* Long spellings of the options, where getopt_long() is available. */
+static struct option long_options[] = {
+	{"engine",	required_argument,	NULL,	'e'},
+	{"queue-depth",	required_argument,	NULL,	'q'},
+	{"threads",	required_argument,	NULL,	'T'},
+	{"repeat",	required_argument,	NULL,	'R'},
+	{"entropy",	required_argument,	NULL,	'E'},
+	{"ratio",	required_argument,	NULL,	'x'},
+	{"codec",	required_argument,	NULL,	'c'},
+	{"output",	required_argument,	NULL,	'o'},
+	{"verify",	no_argument,		NULL,	'V'},
+	{"stats",	required_argument,	NULL,	'S'},
+	{"progress",	required_argument,	NULL,	'P'},
+	{"jobs",	required_argument,	NULL,	'j'},
+	{"offset",	required_argument,	NULL,	'A'},
+	{"length",	required_argument,	NULL,	'L'},
+	{"mix",		required_argument,	NULL,	'M'},
+	{"extent",	required_argument,	NULL,	'X'},
+	{"dedupe-ratio",	required_argument,	NULL,	'U'},
+	{"popularity",	required_argument,	NULL,	'Z'},
+	{"analyze",	required_argument,	NULL,	'a'},
+	{"sample",	required_argument,	NULL,	'y'},
+	{"threshold",	required_argument,	NULL,	't'},
+	{"chunks",	required_argument,	NULL,	'k'},
+	{"memory",	required_argument,	NULL,	'K'},
+	{"spill",	required_argument,	NULL,	'W'},
+	{NULL,		0,			NULL,	0}
+};
+#define GETOPT(c, v, o)	getopt_long((c), (v), (o), long_options, NULL)
+#else
+#define GETOPT(c, v, o)	getopt((c), (v), (o))
+#endif
+
 #if defined(_LARGEFILE_)
 #define I_OPEN(x,y,z)   open64(x,(int)(y),(int)(z))
 #else
@@ -167,8 +341,9 @@ int main(int argc, char* argv[])
 	int	salt = 0;
 	int	r;
 	time_t	t1, t2;
-	unsigned int blocksize=0, filesize=0, numberfiles=0;
-	char dirname[256];
+	unsigned int blocksize=0, numberfiles=0;
+	unsigned long long filesize=0, size;
+	FILE *report;
 
 	strcpy(myname,argv[0]);
 	if (argc < 2) 
@@ -183,11 +358,17 @@ int main(int argc, char* argv[])
 	/*
 	 * Various command line options 
 	 */
-	while((cret = getopt(argc,argv,"OCDBImvd:s:b:f:n:r:")) != EOF)
+	while((cret = GETOPT(argc,argv,"OCDBImvVd:s:b:f:n:r:T:e:q:R:E:x:c:o:S:P:j:A:L:M:X:U:Z:a:y:t:k:K:W:")) != EOF)
 	{
 		switch(cret){
-		case 'b':	/* Use this blocksize */
-			blocksize=(unsigned int) strtol(optarg,NULL,10);
+		case 'b':	/* Use this blocksize, KiB without a suffix */
+			size = parseSize(optarg, "-b", 1024);
+			if (size % 1024 != 0 || size / 1024 > UINT_MAX)
+			{
+				fprintf(stderr,"The block size must be a whole number of KiB.\n");
+				exit(1);
+			}
+			blocksize = (unsigned int)(size / 1024);
 			break;
 		case 'v':	/* Print Version number				*/
 			printf("Version %s \t RCS %s\n",VERSION,BUILD);
@@ -208,8 +389,17 @@ int main(int argc, char* argv[])
 		case 'I':	/* Enable Irreducible only 			*/
 			do_irreducible=1;
 			break;
-		case 'f':	/* Filesize in GiB 				*/
-			filesize = (unsigned int) strtol(optarg,NULL,10);
+		case 'E':	/* Enable entropy targeted pattern 		*/
+			do_entropy=1;
+			entropy_target = strtod(optarg,NULL);
+			if (entropy_target < 0 || entropy_target > ENTROPY_MAX)
+			{
+				fprintf(stderr,"Entropy must be in the range [0, %g] bits per byte.\n",ENTROPY_MAX);
+				exit(1);
+			}
+			break;
+		case 'f':	/* Filesize, GiB without a suffix 		*/
+			filesize = parseSize(optarg, "-f", 1024ULL * 1024 * 1024);
 			break;
 		case 'n':	/* Number of files 				*/
 			numberfiles = (unsigned int)strtol(optarg,NULL,10);
@@ -217,44 +407,183 @@ int main(int argc, char* argv[])
 		case 's':	/* Salt value 					*/
 			salt = (unsigned int)strtol(optarg,NULL,10);
 			break;
-		case 'd':	/* Chdir to this directory 			*/
-			/*
-			 * Change to <dir>, creating it if necessary
-			 */
-			use_dir=1;
-			strcpy(dirname,optarg);
-			r = chdir(dirname);
-
-			if (r != 0) 
+		case 'd':	/* Write into this directory, may be repeated	*/
+			if (ndirs == MAX_DIRS)
 			{
-				if (errno == ENOENT) 
-				{
-					fprintf(stderr, "Creating directory '%s'...\n", dirname);
-					r = _MKDIR(dirname, 0777);
-					if (r != 0) 
-					{
-						fprintf(stderr, "Failed to create '%s', error %d\n",
-							dirname, errno);
-						exit(-5);
-					}
-					r = chdir(dirname);
-					if (r != 0) 
-					{
-						fprintf(stderr, "Failed to change directory to '%s' after creating\n", dirname);
-						exit(-5);
-					}
-				}
-				else 
-				{
-					fprintf(stderr, "Failed to change directory to '%s', error %d\n", dirname, errno);
-					exit(-5);
-				}
+				fprintf(stderr,"At most %d directories may be given with -d.\n",MAX_DIRS);
+				exit(1);
 			}
+			use_dir=1;
+			dirs[ndirs++] = optarg;
 			break;
 		case 'r':
 			strcpy(fileName,optarg);
 			use_dev=1;
 			break;
+		case 'T':	/* Number of fill threads 			*/
+			num_threads = (int)strtol(optarg,NULL,10);
+#if defined(WIN32)
+			if(num_threads > 1)
+				fprintf(stderr,"Fill threads are not supported on Windows, using 1.\n");
+			num_threads = 0;
+#endif
+			break;
+		case 'e':	/* Write engine 				*/
+#if !defined(WIN32)
+			io_engine = ioEngineByName(optarg);
+			if (io_engine < 0)
+			{
+				fprintf(stderr,"Unknown engine '%s', use sync, libaio or io_uring.\n",optarg);
+				exit(1);
+			}
+#endif
+			break;
+		case 'q':	/* Queue depth for async engines 		*/
+			queue_depth = (unsigned int)strtol(optarg,NULL,10);
+			if (queue_depth == 0)
+				queue_depth = 1;
+			break;
+		case 'R':	/* Repeat mode for the dedupe patterns 		*/
+#if !defined(WIN32)
+			repeat_mode = ioRepeatByName(optarg);
+			if (repeat_mode < 0)
+			{
+				fprintf(stderr,"Unknown repeat mode '%s', use write, pwritev or clone.\n",optarg);
+				exit(1);
+			}
+#endif
+			break;
+		case 'x':	/* Compression ratio for the entropy pattern 	*/
+#if defined(WIN32)
+			fprintf(stderr,"--ratio is not supported on Windows, use -E.\n");
+			exit(1);
+#endif
+			do_entropy=1;
+			ratio_target = strtod(optarg,NULL);
+			if (ratio_target < 1)
+			{
+				fprintf(stderr,"The compression ratio must be at least 1.\n");
+				exit(1);
+			}
+			break;
+		case 'c':	/* Codec that --ratio is tuned against 		*/
+			codec_spec = optarg;
+			break;
+		case 'o':	/* Stream to stdout or a socket 		*/
+#if defined(WIN32)
+			fprintf(stderr,"Output sinks are not supported on Windows.\n");
+			exit(1);
+#endif
+			sink_spec = optarg;
+			use_sink=1;
+			break;
+		case 'V':	/* Read back and check the data set 		*/
+#if defined(WIN32)
+			fprintf(stderr,"--verify is not supported on Windows.\n");
+			exit(1);
+#endif
+			do_verify=1;
+			break;
+		case 'S':	/* Instrumentation output 			*/
+#if defined(WIN32)
+			fprintf(stderr,"--stats is not supported on Windows.\n");
+			exit(1);
+#endif
+			stats_spec = optarg;
+			use_stats=1;
+			break;
+		case 'P':	/* Seconds between progress reports 		*/
+			stats_interval = strtod(optarg,NULL);
+			if (stats_interval < 0)
+				stats_interval = 0;
+			break;
+		case 'A':	/* Write only from this byte of each file 	*/
+		case 'L':	/* Write only this many bytes of each file 	*/
+#if defined(WIN32)
+			fprintf(stderr,"--offset and --length are not supported on Windows.\n");
+			exit(1);
+#endif
+			if (cret == 'A')
+				region_off = parseSize(optarg, "--offset", 1);
+			else if ((region_len = parseSize(optarg, "--length", 1)) == 0)
+			{
+				fprintf(stderr,"--length must be more than 0.\n");
+				exit(1);
+			}
+			use_region=1;
+			break;
+		case 'M':	/* Interleave the patterns in one file 	*/
+#if defined(WIN32)
+			fprintf(stderr,"--mix is not supported on Windows.\n");
+			exit(1);
+#endif
+			mixParse(optarg);
+			use_mix=1;
+			break;
+		case 'X':	/* Extent size of --mix 			*/
+			mix_extent = parseSize(optarg, "--extent", 1);
+			if (mix_extent == 0)
+			{
+				fprintf(stderr,"--extent must be more than 0.\n");
+				exit(1);
+			}
+			break;
+		case 'U':	/* Blocks per unique block of the dedupe patterns */
+#if defined(WIN32)
+			fprintf(stderr,"--dedupe-ratio is not supported on Windows.\n");
+			exit(1);
+#endif
+			dedupe_ratio = strtod(optarg,NULL);
+			if (dedupe_ratio < 1)
+			{
+				fprintf(stderr,"The dedupe ratio must be at least 1.\n");
+				exit(1);
+			}
+			break;
+		case 'Z':	/* Popularity of the unique blocks 		*/
+			popularityParse(optarg);
+			break;
+		case 'a':	/* Analyze this file or device, may be repeated	*/
+#if defined(WIN32)
+			fprintf(stderr,"--analyze is not supported on Windows.\n");
+			exit(1);
+#endif
+			if (nanalyze == MAX_DIRS)
+			{
+				fprintf(stderr,"At most %d paths may be given with --analyze.\n",MAX_DIRS);
+				exit(1);
+			}
+			analyze_paths[nanalyze++] = optarg;
+			break;
+		case 'y':	/* Share of each block --analyze samples 	*/
+			sampleParse(optarg);
+			break;
+		case 't':	/* Entropy below which blocks are compressed 	*/
+			entropy_threshold = strtod(optarg,NULL);
+			if (entropy_threshold < 0 || entropy_threshold > ENTROPY_MAX)
+			{
+				fprintf(stderr,"The threshold must be 0 to 8 bits per byte.\n");
+				exit(1);
+			}
+			break;
+		case 'k':	/* Chunk sizes --analyze measures dedupe at 	*/
+			chunksParse(optarg);
+			break;
+		case 'K':	/* Memory of the --chunks index 		*/
+			chunk_memory = parseSize(optarg, "--memory", 1024 * 1024);
+			break;
+		case 'W':	/* Spill the --chunks index here 		*/
+			spill_dir = optarg;
+			break;
+		case 'j':	/* Files written at a time 			*/
+#if defined(WIN32)
+			fprintf(stderr,"--jobs is not supported on Windows.\n");
+			exit(1);
+#endif
+			num_jobs = (unsigned int)strtol(optarg,NULL,10);
+			if (num_jobs == 0)
+				num_jobs = 1;
+			break;
 		default:
 			usage();
 			exit(1);
@@ -262,7 +591,58 @@ int main(int argc, char* argv[])
 		}
 	}
 	
-	if(use_dev && !((do_compress || do_dedupe || do_both || do_irreducible) && ((do_compress + do_dedupe + do_both + do_irreducible) == 1))  )
+#if !defined(WIN32)
+	/*
+	 * --analyze reads existing data and writes none: -b is the block
+	 * size, -T the threads, -O reads with O_DIRECT instead of mmap,
+	 * --verify checks the samples against all the bytes and -o takes
+	 * the per block rows. With --chunks it measures dedupe instead.
+	 */
+	if(nanalyze)
+	{
+		struct analyze_opts ao;
+		struct chunk_opts co;
+		long ncpu;
+
+		if(use_dir || use_dev)
+		{
+			fprintf(stderr,"You can not use --analyze with -d or -r.\n");
+			exit(-4);
+		}
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		if(nchunk_sizes)
+		{
+			memset(&co, 0, sizeof(co));
+			memcpy(co.size, chunk_sizes, sizeof(chunk_sizes));
+			co.nsizes = nchunk_sizes;
+			co.memory = chunk_memory;
+			if(co.memory == 0)
+				co.memory = (unsigned long long)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / 2;
+			co.spill = spill_dir;
+			co.threads = num_threads > 0 ? num_threads : ncpu > 0 ? (unsigned int)ncpu : 1;
+			co.direct = use_o_direct;
+			return chunkRun(analyze_paths, nanalyze, &co);
+		}
+		memset(&ao, 0, sizeof(ao));
+		ao.block = (blocksize ? blocksize : 32) * 1024UL;
+		if(ao.block < 4 * 1024 || ao.block > 1024 * 1024 || (use_o_direct && ao.block % 4096 != 0))
+		{
+			fprintf(stderr,"--analyze blocks must be 4KiB to 1MiB%s.\n",
+				use_o_direct ? ", a multiple of 4KiB with -O" : "");
+			exit(1);
+		}
+		ao.sample = sample_ratio;
+		ao.estimator = sample_estimator;
+		ao.threshold = entropy_threshold;
+		ao.threads = num_threads > 0 ? num_threads : ncpu > 0 ? (unsigned int)ncpu : 1;
+		ao.exact = do_verify;
+		ao.out = sink_spec;
+		ao.direct = use_o_direct;
+		ao.kernel = getenv("COMGEN_HIST");
+		return analyzeRun(analyze_paths, nanalyze, &ao);
+	}
+#endif
+	if(use_dev && !((do_compress || do_dedupe || do_both || do_irreducible || do_entropy) && ((do_compress + do_dedupe + do_both + do_irreducible + do_entropy) == 1))  )
 	{
 		fprintf(stderr,"When using a raw device one must select one pattern type.\n");
 		if(do_compress)
@@ -273,6 +653,8 @@ int main(int argc, char* argv[])
 			fprintf(stderr,"Found both Compression and Dedupe selection.\n");
 		if(do_irreducible)
 			fprintf(stderr,"Found Irreducible selection.\n");
+		if(do_entropy)
+			fprintf(stderr,"Found Entropy selection.\n");
 		fprintf(stderr,"Device name:  %s.\n",fileName);
 		exit(-5);
 	}
@@ -281,8 +663,65 @@ int main(int argc, char* argv[])
 		fprintf(stderr,"You can not use -r and -d at the same time. Please make up your mind :-)\n");
 		exit(-4);
 	}
+	if(use_sink && use_dev)
+	{
+		fprintf(stderr,"You can not use -r and -o at the same time.\n");
+		exit(-4);
+	}
+	if(use_sink && do_verify)
+	{
+		fprintf(stderr,"You can not use -o and --verify at the same time.\n");
+		exit(-4);
+	}
+	if(use_mix && (do_compress || do_dedupe || do_both || do_irreducible))
+	{
+		fprintf(stderr,"You can not use --mix with -C, -D, -B or -I, the mix selects the patterns.\n");
+		exit(-4);
+	}
+	if(use_mix && mix_weight[PAT_ENTROPY] > 0 && !do_entropy)
+	{
+		fprintf(stderr,"An entropy share in --mix needs -E or --ratio for its target.\n");
+		exit(1);
+	}
+	if(use_sink && (num_jobs > 1 || ndirs > 1))
+	{
+		fprintf(stderr,"You can not use -o with --jobs or several -d at the same time.\n");
+		exit(-4);
+	}
+#if defined(WIN32)
+	if(ndirs > 1)
+	{
+		fprintf(stderr,"Several -d directories are not supported on Windows.\n");
+		exit(1);
+	}
+#endif
+	/*
+	 * With one directory, change to it. Several are only created, the
+	 * files are then opened by path, and by default one job writes to
+	 * each directory.
+	 */
+	for (r = 0; r < (int)ndirs; r++)
+		dirSetup(dirs[r], ndirs == 1);
+	if(num_jobs == 0)
+		num_jobs = ndirs > 1 ? ndirs : 1;
+	/* A device is a single file. */
+	if(use_dev)
+		num_jobs = 1;
+#if !defined(WIN32)
+	if(use_sink)
+		sink_fd = sinkOpen(sink_spec);
+#endif
 	if (salt == 0)
 		salt = 79;
+	data_salt = salt;
+#if !defined(WIN32)
+	page_size = sysconf(_SC_PAGESIZE);
+	if (page_size <= 0)
+		page_size = 4096;
+#endif
+
+	/* Pick the fill kernel, COMGEN_SIMD=scalar|sse2|avx2|avx512 overrides. */
+	fillSelectKernel(getenv("COMGEN_SIMD"));
 
 	fprintf(stderr, "\nEmerald COM data generator \tVersion %s  RCS  %s\n",VERSION,BUILD);
 	/* 
@@ -300,111 +739,1269 @@ int main(int argc, char* argv[])
 	 */
 	t2 = time(NULL);
 	t2 -= t1;
-	fprintf(stdout, "Elapsed time: ");
+	/* stdout may be carrying the data. */
+	report = (use_sink && sink_fd == 1) ? stderr : stdout;
+	fprintf(report, "Elapsed time: ");
 	if (t2 / 3600 > 0) {
-		fprintf(stdout, "%d hours, ", (int)(t2 / 3600));
+		fprintf(report, "%d hours, ", (int)(t2 / 3600));
 		t2 %= 3600;
 	}
-	if (t2 / 60 > 0) {
-		fprintf(stdout, "%d minutes, ", (int)(t2 / 60));
-		t2 %= 60;
+	if (t2 / 60 > 0) {
+		fprintf(report, "%d minutes, ", (int)(t2 / 60));
+		t2 %= 60;
+	}
+	fprintf(report, "%d seconds. \n", (int)t2);
+	/* Like cmp, 1 when the data read back differs. */
+	return verify_bad ? 1 : 0;
+}
+
+/*
+ * Parse the size in arg for option opt: a number with an optional K, M,
+ * G, T or P suffix, in powers of 1024 and spelt K, KB or KiB alike, or B
+ * for bytes. A bare number is in units of unit bytes. Exits on anything
+ * that is not a size or does not fit in 64 bits.
+ */
+unsigned long long parseSize(const char *arg, const char *opt, unsigned long long unit)
+{
+	static const char suffixes[] = "BKMGTP";
+	unsigned long long n, mult = unit;
+	const char *p;
+	char *end;
+	int shift;
+
+	errno = 0;
+	n = strtoull(arg, &end, 10);
+	if (end == arg || *arg == '-' || errno != 0)
+		goto bad;
+	if (*end != 0)
+	{
+		p = strchr(suffixes, toupper((unsigned char)*end));
+		if (p == NULL)
+			goto bad;
+		shift = 10 * (int)(p - suffixes);
+		mult = 1ULL << shift;
+		end++;
+		if (shift > 0 && (*end == 'i' || *end == 'I'))
+			end++;
+		if (shift > 0 && (*end == 'b' || *end == 'B'))
+			end++;
+		if (*end != 0)
+			goto bad;
+	}
+	if (mult != 0 && n > ~0ULL / mult)
+		goto bad;
+	return n * mult;
+bad:
+	fprintf(stderr, "Bad size '%s' for %s, use a number with an optional B, K, M, G, T or P.\n",
+		arg, opt);
+	exit(1);
+	return 0;
+}
+
+/*
+ * Blocks of blcksz KiB in a file of flsz bytes, a partial last one
+ * included. The data of a partial block is the start of the whole one.
+ */
+unsigned long fileBlocks(unsigned long long flsz, unsigned int blcksz)
+{
+	unsigned long long bls = blcksz * 1024ULL;
+
+	return (unsigned long)((flsz + bls - 1) / bls);
+}
+
+/*
+ * The bytes [*start, *end) of a file of flsz bytes to write: the whole
+ * file, or its --offset/--length region. Returns 1 when that is not a
+ * whole number of blocks from the start of the file, which the inline
+ * write loops cannot do.
+ */
+int fileRegion(unsigned long long flsz, unsigned int blcksz,
+	unsigned long long *start, unsigned long long *end)
+{
+	*start = region_off < flsz ? region_off : flsz;
+	*end = flsz;
+	if (region_len > 0 && region_len < *end - *start)
+		*end = *start + region_len;
+	return *start != 0 || *end % (blcksz * 1024ULL) != 0;
+}
+
+/*
+ * Parse the --mix list "name=weight,...", names being compress, dedupe,
+ * both, irreducible and entropy. The weights are relative shares, they
+ * need not add up to 100.
+ */
+void mixParse(const char *spec)
+{
+	const char *s = spec;
+	unsigned long w;
+	size_t n;
+	char *end;
+	int p;
+
+	memset(mix_weight, 0, sizeof(mix_weight));
+	mix_total = 0;
+	while (*s)
+	{
+		for (p = 0; p < COMGEN_PATTERNS; p++)
+		{
+			n = strlen(mix_names[p]);
+			if (strncmp(s, mix_names[p], n) == 0 && s[n] == '=')
+				break;
+		}
+		if (p == COMGEN_PATTERNS)
+			goto bad;
+		s += strlen(mix_names[p]) + 1;
+		w = strtoul(s, &end, 10);
+		if (end == s || (*end != ',' && *end != 0) || w > 1000000)
+			goto bad;
+		mix_weight[p] = (unsigned int)w;
+		mix_total += (unsigned int)w;
+		s = *end ? end + 1 : end;
+	}
+	if (mix_total > 0)
+		return;
+bad:
+	fprintf(stderr, "Bad --mix '%s', use e.g. compress=40,dedupe=30,both=20,irreducible=10.\n",
+		spec);
+	exit(1);
+}
+
+/*
+ * Parse --popularity: uniform, or zipf with an optional exponent, as in
+ * zipf:1.2. The exponent defaults to 1.
+ */
+void popularityParse(const char *spec)
+{
+	char *end;
+
+	if (strcmp(spec, "uniform") == 0)
+	{
+		dedupe_dist = COMGEN_UNIFORM;
+		return;
+	}
+	if (strncmp(spec, "zipf", 4) == 0 && (spec[4] == 0 || spec[4] == ':'))
+	{
+		dedupe_dist = COMGEN_ZIPF;
+		if (spec[4] == 0)
+			return;
+		zipf_s = strtod(spec + 5, &end);
+		if (end != spec + 5 && *end == 0 && zipf_s > 0 && zipf_s <= 10)
+			return;
+	}
+	fprintf(stderr, "Bad --popularity '%s', use uniform or zipf[:exponent].\n", spec);
+	exit(1);
+}
+
+/*
+ * Parse --sample: the share of each block --analyze samples, 0 to 1,
+ * optionally followed by :mm or :nsb for the bias correction.
+ */
+void sampleParse(const char *spec)
+{
+	char *end;
+
+	sample_ratio = strtod(spec, &end);
+	if (end != spec && sample_ratio > 0 && sample_ratio <= 1)
+	{
+		if (*end == 0 || strcmp(end, ":mm") == 0)
+		{
+			sample_estimator = SAMPLE_MM;
+			return;
+		}
+		if (strcmp(end, ":nsb") == 0)
+		{
+			sample_estimator = SAMPLE_NSB;
+			return;
+		}
+	}
+	fprintf(stderr, "Bad --sample '%s', use a share of 0 to 1 with an optional :mm or :nsb.\n", spec);
+	exit(1);
+}
+
+/*
+ * Parse --chunks: a list of chunk sizes, e.g. 256,4K,32K, that are all
+ * multiples of the smallest.
+ */
+void chunksParse(const char *spec)
+{
+	char *list, *tok;
+	unsigned long long size;
+	unsigned int i;
+
+	list = strdup(spec);
+	for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ","))
+	{
+		size = parseSize(tok, "--chunks", 1);
+		if (size < 32 || size > 64 * 1024 * 1024)
+		{
+			fprintf(stderr, "--chunks sizes must be 32 bytes to 64MiB.\n");
+			exit(1);
+		}
+		if (nchunk_sizes == CHUNK_SIZES)
+		{
+			fprintf(stderr, "At most %d --chunks sizes may be given.\n", CHUNK_SIZES);
+			exit(1);
+		}
+		chunk_sizes[nchunk_sizes++] = (unsigned long)size;
+	}
+	free(list);
+	for (i = 0; i < nchunk_sizes; i++)
+		if (chunk_sizes[i] % chunk_sizes[0] != 0 || (i > 0 && chunk_sizes[i] <= chunk_sizes[i - 1]))
+		{
+			fprintf(stderr, "--chunks sizes must grow, each a multiple of the first.\n");
+			exit(1);
+		}
+}
+
+/*
+ * Lay out one period of the --mix extents by smooth weighted round-robin:
+ * each extent goes to the pattern furthest behind its share, so the first
+ * n extents of every file hold n times each share to within one extent.
+ * The period is the sum of the weights over their greatest common divisor.
+ */
+void mixSchedule(void)
+{
+	long long cur[COMGEN_PATTERNS];
+	unsigned int g = 0, a, b;
+	unsigned long k;
+	int p, best;
+
+	for (p = 0; p < COMGEN_PATTERNS; p++)
+	{
+		cur[p] = 0;
+		for (a = mix_weight[p]; a != 0; a = b)
+		{
+			b = g % a;
+			g = a;
+		}
+	}
+	mix_period = mix_total / g;
+	mix_schedule = malloc(mix_period);
+	if (mix_schedule == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (k = 0; k < mix_period; k++)
+	{
+		best = -1;
+		for (p = 0; p < COMGEN_PATTERNS; p++)
+		{
+			if (mix_weight[p] == 0)
+				continue;
+			cur[p] += mix_weight[p] / g;
+			if (best < 0 || cur[p] > cur[best])
+				best = p;
+		}
+		cur[best] -= mix_period;
+		mix_schedule[k] = (unsigned char)best;
+	}
+}
+
+/*
+ * The pattern block j of a file is taken from. Under --mix extent n of
+ * every file is entry n of the mixSchedule() period, so any extent can be
+ * placed without the ones before it and the placement is the same on
+ * every run and in every file. The block is then the one at the same
+ * offset of that pattern's file with the same number.
+ */
+int blockPattern(int pattern, unsigned long j)
+{
+	if (pattern != PAT_MIX)
+		return pattern;
+	return mix_schedule[(j / mix_blocks) % mix_period];
+}
+
+/*
+ * Create directory dir if it does not exist, and change to it if enter.
+ */
+void dirSetup(const char *dir, int enter)
+{
+	int r;
+
+#if defined(WIN32)
+	r = chdir(dir);
+#else
+	r = enter ? chdir(dir) : access(dir, F_OK);
+#endif
+	if (r == 0)
+		return;
+	if (errno != ENOENT)
+	{
+		fprintf(stderr, "Failed to change directory to '%s', error %d\n", dir, errno);
+		exit(-5);
+	}
+	fprintf(stderr, "Creating directory '%s'...\n", dir);
+	r = _MKDIR(dir, 0777);
+	if (r != 0)
+	{
+		fprintf(stderr, "Failed to create '%s', error %d\n", dir, errno);
+		exit(-5);
+	}
+	if (enter && chdir(dir) != 0)
+	{
+		fprintf(stderr, "Failed to change directory to '%s' after creating\n", dir);
+		exit(-5);
+	}
+}
+
+/* 
+ * Used to create buffers that are compressible, but not dedupable.
+ * The input parameters to this function:
+ *
+ *  bls  	..	Block size in kbyte units.
+ *  memarea 	..	Location where to put the data 
+ *  gransz	..	size in bytes of the minimum granule to enable dedupe
+ */
+void fillBlock(unsigned int bls, void *memarea, unsigned int gransz)
+{
+	fillBlock_r(bls, memarea, gransz, &park_miller_seedi);
+	rannum = (unsigned int) park_miller_seedi;
+}
+
+/* 
+ * Used to create buffer that is non-compressible, but may be used for dedupe.
+ * The input parameters to this function:
+ *
+ * bls  	..	Block size in kbyte units.
+ * memarea 	..	Location where to put the data 
+ * gransz	..	size in bytes of the minimum granule to enable dedupe
+ */
+void fillBlock2(unsigned int bls, void *memarea, unsigned int gransz)
+{
+	fillBlock2_r(bls, memarea, gransz, &park_miller_seedi);
+	rannum = (unsigned int) park_miller_seedi;
+}
+
+#if !defined(WIN32)
+/*
+ * Shared state of the block pipeline. Fill threads claim block numbers
+ * in order, compute the generator state for that block with a skip-ahead
+ * and fill one of the ring slots. The writer submits the ring strictly in
+ * block order, so the stream on disk is identical to the single threaded
+ * one. A slot goes back to the fillers when its write completes.
+ */
+#define SLOT_FREE	-1L      /* Slot may be filled.				*/
+#define SLOT_BUSY	-2L      /* Slot is being written.			*/
+
+struct pipeline {
+	pthread_mutex_t lock;
+	pthread_cond_t filled;   /* Signalled when a slot has been filled.	*/
+	pthread_cond_t drained;  /* Signalled when a slot may be refilled.	*/
+	int pattern;             /* PAT_* being generated, or PAT_MIX.		*/
+	unsigned long file;      /* File number within the pattern.		*/
+	char **slot;             /* Ring of block buffers.			*/
+	long *slot_block;        /* Block number held in each slot, or SLOT_*.	*/
+	unsigned int depth;      /* Number of slots in the ring.		*/
+	unsigned int blcksz;     /* Block size in KiB.				*/
+	unsigned long long start, end; /* Bytes of the file to write.		*/
+	unsigned long last;      /* Block after the last one to produce.	*/
+	unsigned long next;      /* Next block number to hand to a filler.	*/
+	unsigned long submitted; /* Blocks the writer has queued.		*/
+	unsigned int next_thread;/* --stats number of the next filler.	*/
+	unsigned int job;        /* --jobs slot, selects the pool buffers.	*/
+};
+
+/*
+ * Fill slot s with block j, accounting the time to fill thread t. When
+ * the region starts inside the block, its part of the block is moved to
+ * the start of the slot, where the write takes it from.
+ */
+static void pipelineFill(struct pipeline *p, unsigned long j, unsigned int s, unsigned int t)
+{
+	unsigned long long t0 = 0, off = (unsigned long long)j * p->blcksz * 1024;
+
+	if (use_stats)
+		t0 = statsNow();
+	if (comgen_fill(gen_ctx, blockPattern(p->pattern, j), p->file, j, p->slot[s],
+		p->blcksz * 1024) != 0)
+	{
+		fprintf(stderr, "Error: could not generate block %lu of file %lu\n", j, p->file);
+		exit(-1);
+	}
+	if (off < p->start)
+		memmove(p->slot[s], p->slot[s] + (p->start - off), p->blcksz * 1024 - (p->start - off));
+	if (use_stats)
+		statsFill(p->job, t, statsNow() - t0);
+}
+
+/*
+ * ioqWrite() and ioqWait() that account the time the writer of job
+ * spends in them, the writes in flight and every completed write to
+ * --stats.
+ */
+static void statWrite(struct ioq *q, unsigned int job, unsigned int s, unsigned long len,
+	unsigned long long off)
+{
+	unsigned long long t0;
+
+	if (!use_stats)
+	{
+		ioqWrite(q, s, len, off);
+		return;
+	}
+	t0 = statsNow();
+	ioqWrite(q, s, len, off);
+	statsWriteTime(job, statsNow() - t0, ioqInflight(q));
+}
+
+static int statWait(struct ioq *q, unsigned int job)
+{
+	unsigned long long t0;
+	int s;
+
+	if (!use_stats)
+		return ioqWait(q);
+	t0 = statsNow();
+	s = ioqWait(q);
+	if (s >= 0)
+	{
+		statsWriteTime(job, statsNow() - t0, ioqInflight(q));
+		statsWrite(job, ioqResult(q), ioqLatency(q));
+	}
+	return s;
+}
+
+static void *pipelineFiller(void *arg)
+{
+	struct pipeline *p = arg;
+	unsigned long j;
+	unsigned int s, t;
+
+	pthread_mutex_lock(&p->lock);
+	t = p->next_thread++;
+	pthread_mutex_unlock(&p->lock);
+	for (;;)
+	{
+		pthread_mutex_lock(&p->lock);
+		if (p->next >= p->last)
+		{
+			pthread_mutex_unlock(&p->lock);
+			break;
+		}
+		j = p->next++;
+		s = j % p->depth;
+		/* Wait until block j - depth has been written out of this slot. */
+		while (j >= p->submitted + p->depth || p->slot_block[s] != SLOT_FREE)
+			pthread_cond_wait(&p->drained, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+
+		pipelineFill(p, j, s, t);
+
+		pthread_mutex_lock(&p->lock);
+		p->slot_block[s] = (long)j;
+		pthread_cond_broadcast(&p->filled);
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
+
+/*
+ * Return a slot whose write has completed to the fillers.
+ */
+static void pipelineRelease(struct pipeline *p, int s)
+{
+	pthread_mutex_lock(&p->lock);
+	p->slot_block[s] = SLOT_FREE;
+	pthread_cond_broadcast(&p->drained);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/*
+ * Ring slots of the pipeline: two per fill thread, and at least the
+ * queue depth for the asynchronous engines.
+ */
+unsigned int pipelineDepth(void)
+{
+	unsigned int depth;
+	int engine;
+
+	depth = (num_threads > 1) ? 2 * num_threads : 1;
+	engine = use_sink ? IO_ENGINE_STREAM : io_engine;
+	if (engine != IO_ENGINE_SYNC && depth < queue_depth)
+		depth = queue_depth;
+	return depth;
+}
+
+/*
+ * Fill and write bytes [start, end) of the given pattern and file to fd,
+ * at the same offsets. With -T the blocks are filled by num_threads fill
+ * threads, otherwise by the calling thread. Writes go through the selected engine with up to one
+ * write in flight per ring slot. The ring is the pool buffers of job.
+ * Without --jobs the global generator state is advanced exactly as if
+ * the blocks had been filled inline. Returns the number of blocks
+ * written to.
+ */
+unsigned long pipelineWrite(int fd, int pattern, unsigned long file, unsigned int blcksz,
+	unsigned long long start, unsigned long long end, unsigned int job)
+{
+	struct pipeline p;
+	struct ioq *q;
+	pthread_t *tids;
+	unsigned long long lo, hi;
+	unsigned long j, first;
+	unsigned int s;
+	int t, engine;
+
+	memset(&p, 0, sizeof(p));
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_cond_init(&p.filled, NULL);
+	pthread_cond_init(&p.drained, NULL);
+	p.pattern = pattern;
+	p.file = file;
+	p.depth = pipelineDepth();
+	engine = use_sink ? IO_ENGINE_STREAM : io_engine;
+	p.blcksz = blcksz;
+	p.start = start;
+	p.end = end;
+	first = (unsigned long)(start / (blcksz * 1024));
+	p.next = p.submitted = first;
+	p.last = fileBlocks(end, blcksz);
+	p.job = job;
+
+	p.slot = CALLOC(char *, p.depth);
+	p.slot_block = CALLOC(long, p.depth);
+	tids = CALLOC(pthread_t, num_threads > 1 ? num_threads : 1);
+	if (p.slot == NULL || p.slot_block == NULL || tids == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (s = 0; s < p.depth; s++)
+	{
+		/* Buffer 0 of a job is the block of the dedupe patterns. */
+		p.slot[s] = poolBuf(block_pool, job * (1 + p.depth) + 1 + s);
+		p.slot_block[s] = SLOT_FREE;
+	}
+	q = ioqOpen(engine, fd, p.slot, p.depth, blcksz * 1024, p.depth);
+
+	for (t = 0; num_threads > 1 && t < num_threads; t++)
+	{
+		if (pthread_create(&tids[t], NULL, pipelineFiller, &p) != 0)
+		{
+			fprintf(stderr, "Error creating fill thread: %s\n", strerror(errno));
+			exit(-1);
+		}
+	}
+
+	for (j = first; j < p.last; j++)
+	{
+		s = j % p.depth;
+		if (num_threads > 1)
+		{
+			/* Reap completions while the fillers work on block j. */
+			pthread_mutex_lock(&p.lock);
+			while (p.slot_block[s] != (long)j)
+			{
+				if (ioqInflight(q) > 0)
+				{
+					pthread_mutex_unlock(&p.lock);
+					t = statWait(q, job);
+					pthread_mutex_lock(&p.lock);
+					if (t >= 0)
+					{
+						p.slot_block[t] = SLOT_FREE;
+						pthread_cond_broadcast(&p.drained);
+					}
+				}
+				else
+					pthread_cond_wait(&p.filled, &p.lock);
+			}
+			pthread_mutex_unlock(&p.lock);
+		}
+		else
+		{
+			while (p.slot_block[s] != SLOT_FREE)
+			{
+				if ((t = statWait(q, job)) < 0)
+				{
+					fprintf(stderr, "Error: slot %u of job %u never completed\n", s, job);
+					exit(-3);
+				}
+				pipelineRelease(&p, t);
+			}
+			pipelineFill(&p, j, s, 0);
+		}
+
+		pthread_mutex_lock(&p.lock);
+		p.slot_block[s] = SLOT_BUSY;
+		p.submitted = j + 1;
+		pthread_cond_broadcast(&p.drained);
+		pthread_mutex_unlock(&p.lock);
+		/* Blocks at the edges of the region are written in part. */
+		lo = (unsigned long long)j * blcksz * 1024;
+		hi = lo + blcksz * 1024;
+		lo = lo < start ? start : lo;
+		hi = hi > end ? end : hi;
+		statWrite(q, job, s, (unsigned long)(hi - lo), lo);
+	}
+
+	/* The fillers may still be waiting for slots. */
+	while ((t = statWait(q, job)) >= 0)
+		pipelineRelease(&p, t);
+	for (t = 0; num_threads > 1 && t < num_threads; t++)
+		pthread_join(tids[t], NULL);
+	ioqClose(q);
+
+	/* Leave the generator where the inline loop would have left it. */
+	if (num_jobs <= 1 && pattern != PAT_MIX && dedupe_ratio == 0)
+		park_miller_seedi = comgen_seed(gen_ctx, pattern, file + 1, 0);
+
+	free(p.slot);
+	free(p.slot_block);
+	free(tids);
+	pthread_cond_destroy(&p.filled);
+	pthread_cond_destroy(&p.drained);
+	pthread_mutex_destroy(&p.lock);
+	return j - first;
+}
+
+/*
+ * Write bytes [start, end) of a file that repeats the same block, used by
+ * the dedupe patterns. With -R pwritev or clone whole files are repeated
+ * by ioRepeat(), otherwise the block goes through the selected engine
+ * with up to queue_depth writes of it in flight. Writes are accounted to
+ * job.
+ */
+unsigned long repeatWrite(int fd, void *block, unsigned int blcksz, unsigned long long start,
+	unsigned long long end, unsigned int job)
+{
+	struct ioq *q;
+	char *buf[2];
+	unsigned long long t0, lo, hi;
+	unsigned long j, first, len = blcksz * 1024, skip = (unsigned long)(start % len);
+
+	/* Sinks take the blocks in order, through the stream engine. */
+	if (repeat_mode != REPEAT_WRITE && !use_sink && start == 0 && end % len == 0)
+	{
+		t0 = use_stats ? statsNow() : 0;
+		j = ioRepeat(fd, repeat_mode, block, len, (unsigned long)(end / len));
+		/* No latencies here, only the bytes and the time. */
+		if (use_stats)
+		{
+			statsWriteTime(job, statsNow() - t0, 0);
+			statsWrite(job, j * blcksz * 1024, 0);
+		}
+		return j;
+	}
+
+	/* A region starting inside a block takes its head from the next buffer of the job. */
+	buf[0] = buf[1] = block;
+	if (skip > 0)
+	{
+		buf[1] = poolBuf(block_pool, job * (1 + pipelineDepth()) + 1);
+		memcpy(buf[1], buf[0] + skip, len - skip);
+	}
+	q = ioqOpen(use_sink ? IO_ENGINE_STREAM : io_engine, fd, buf, skip > 0 ? 2 : 1, len, queue_depth);
+	first = (unsigned long)(start / len);
+	for (j = first; j < fileBlocks(end, blcksz); j++)
+	{
+		lo = (unsigned long long)j * len;
+		hi = lo + len > end ? end : lo + len;
+		lo = lo < start ? start : lo;
+		if (ioqInflight(q) >= queue_depth)
+			statWait(q, job);
+		statWrite(q, job, j == first && skip > 0, (unsigned long)(hi - lo), lo);
+	}
+	while (statWait(q, job) >= 0)
+		;
+	ioqClose(q);
+	return j - first;
+}
+#endif
+
+#if !defined(WIN32)
+/*
+ * Compression ratio of --ratio blocks with entropy e, measured with codec
+ * c over nsamples blocks spread over the first file. The smallest and
+ * largest ratio of a single block go to minp and maxp.
+ */
+double ratioSample(struct codec *c, double e, unsigned int blcksz,
+	unsigned long nblocks, unsigned long nsamples, double *minp, double *maxp)
+{
+	char *in, *out;
+	unsigned long len = blcksz * 1024, cap = codecBound(c, len), k;
+	double total = 0, r;
+	long clen;
+
+	in = malloc(len);
+	out = malloc(cap);
+	if (in == NULL || out == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	if (nsamples > nblocks)
+		nsamples = nblocks;
+
+	comgen_set_entropy(gen_ctx, e, RATIO_CHUNK);
+	*minp = *maxp = 0;
+	for (k = 0; k < nsamples; k++)
+	{
+		if (comgen_fill(gen_ctx, PAT_ENTROPY, 0, k * nblocks / nsamples, in, len) != 0)
+		{
+			fprintf(stderr, "Error: could not generate block %lu of file 0\n", k * nblocks / nsamples);
+			exit(-1);
+		}
+		clen = codecCompress(c, in, len, out, cap);
+		if (clen <= 0)
+		{
+			fprintf(stderr, "Codec %s failed to compress a block\n", codecName(c));
+			exit(-3);
+		}
+		total += clen;
+		r = (double)len / clen;
+		if (k == 0 || r < *minp)
+			*minp = r;
+		if (k == 0 || r > *maxp)
+			*maxp = r;
+	}
+	free(in);
+	free(out);
+	return (double)nsamples * len / total;
+}
+
+/*
+ * Find the -E entropy that gives the --ratio compression ratio with the
+ * --codec for this block size. The ratio falls as the entropy rises, so
+ * this is a bisection on a few sampled blocks, stopped within 1% of the
+ * ratio. The result is then checked on at least 1 MiB of blocks.
+ */
+double ratioTune(unsigned int blcksz, unsigned long nblocks)
+{
+	struct codec *c;
+	double lo = 0, hi = ENTROPY_MAX, e, r, rmin, rmax;
+	double best_e = 0, best_r = 0;
+	unsigned long nsamples;
+	int i;
+
+	c = codecOpen(codec_spec);
+	if (c == NULL)
+		exit(1);
+	for (i = 0; i < 30; i++)
+	{
+		e = (lo + hi) / 2;
+		r = ratioSample(c, e, blcksz, nblocks, 8, &rmin, &rmax);
+		if (i == 0 || fabs(r - ratio_target) < fabs(best_r - ratio_target))
+		{
+			best_e = e;
+			best_r = r;
+		}
+		if (fabs(r - ratio_target) <= 0.01 * ratio_target)
+			break;
+		if (r > ratio_target)
+			lo = e;
+		else
+			hi = e;
+	}
+
+	nsamples = (1024 + blcksz - 1) / blcksz;
+	if (nsamples < 16)
+		nsamples = 16;
+	r = ratioSample(c, best_e, blcksz, nblocks, nsamples, &rmin, &rmax);
+	if (fabs(r - ratio_target) > 0.01 * ratio_target)
+		fprintf(stderr, "Warning: ratio %.2f is out of reach of %s with %dKiB blocks\n",
+			ratio_target, codecName(c), (int)blcksz);
+	fprintf(stderr, "Ratio %.2f with %s: entropy %.4f, sampled %.3f (blocks %.3f to %.3f)\n",
+		ratio_target, codecName(c), best_e, r, rmin, rmax);
+	codecClose(c);
+	return best_e;
+}
+#endif
+
+/*
+ * Set the -E pattern of the generator up for blcksz KiB blocks, tuning
+ * the entropy to --ratio first when it is given.
+ */
+void entropySetup(unsigned int blcksz, unsigned long nblocks)
+{
+#if !defined(WIN32)
+	if (ratio_target > 0)
+		entropy_target = ratioTune(blcksz, nblocks);
+#endif
+
+	/* The byte histogram is the same for every block. */
+	if (comgen_set_entropy(gen_ctx, entropy_target, ratio_target > 0 ? RATIO_CHUNK : 0) != 0)
+		fprintf(stderr, "Warning: %dKiB blocks can only get to entropy %.4f\n",
+			(int)blcksz, comgen_entropy(gen_ctx));
+	fprintf(stderr, "Entropy target %.4f, every block has entropy %.4f\n",
+		entropy_target, comgen_entropy(gen_ctx));
+}
+
+#if !defined(WIN32)
+/*
+ * --verify. Every block of the data set is a function of (salt, pattern,
+ * file, block), so instead of comparing against a golden copy each block
+ * read back is compared with the one comgen_fill() regenerates for it.
+ * The target is read with O_DIRECT, so that the page cache cannot answer
+ * for the device, by one thread per CPU (or -T threads). Thread t reads
+ * blocks t, t + threads, ... of the region with up to queue_depth reads
+ * in flight through the selected engine, and regenerates and compares
+ * each block as it arrives. Only the bytes inside the region are compared.
+ */
+struct verify {
+	pthread_mutex_t lock;
+	int fd;
+	int pattern;             /* PAT_* being checked.				*/
+	unsigned long file;      /* File number within the pattern.		*/
+	unsigned int blcksz;     /* Block size in KiB.				*/
+	unsigned long long start, end; /* Bytes of the file to check.		*/
+	unsigned long from, to;  /* Blocks holding them, [from, to).		*/
+	unsigned int nthreads;
+	unsigned int next_thread;/* Stripe the next thread takes.		*/
+	unsigned long bad;       /* Blocks that differ or are missing.		*/
+	unsigned int nfirst;     /* Entries in first[].				*/
+	unsigned long first[VERIFY_REPORT];       /* Lowest bad blocks, in order.	*/
+	unsigned long first_off[VERIFY_REPORT];   /* First bad byte within each.	*/
+	unsigned long first_got[VERIFY_REPORT];   /* Bytes read of each.		*/
+};
+
+/*
+ * Record that block j differs from byte off on, got bytes having been
+ * read. Only the lowest VERIFY_REPORT blocks are kept for the report.
+ */
+static void verifyNote(struct verify *v, unsigned long j, unsigned long off, unsigned long got)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&v->lock);
+	v->bad++;
+	for (i = v->nfirst; i > 0 && v->first[i - 1] > j; i--)
+	{
+		if (i < VERIFY_REPORT)
+		{
+			v->first[i] = v->first[i - 1];
+			v->first_off[i] = v->first_off[i - 1];
+			v->first_got[i] = v->first_got[i - 1];
+		}
+	}
+	if (i < VERIFY_REPORT)
+	{
+		v->first[i] = j;
+		v->first_off[i] = off;
+		v->first_got[i] = got;
+		if (v->nfirst < VERIFY_REPORT)
+			v->nfirst++;
+	}
+	pthread_mutex_unlock(&v->lock);
+}
+
+static void *verifyThread(void *arg)
+{
+	struct verify *v = arg;
+	struct ioq *q;
+	char **bufs, *expect;
+	unsigned long *slot_block, j, next, len = v->blcksz * 1024, off, lo, hi;
+	unsigned int *free_slots, nfree, t, s, depth = queue_depth;
+	int filled = 0;
+	long got;
+
+	pthread_mutex_lock(&v->lock);
+	t = v->next_thread++;
+	pthread_mutex_unlock(&v->lock);
+
+	bufs = CALLOC(char *, depth);
+	slot_block = CALLOC(unsigned long, depth);
+	free_slots = CALLOC(unsigned int, depth);
+	if (bufs == NULL || slot_block == NULL || free_slots == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	/* depth read buffers and the expected block of this thread. */
+	for (s = 0; s < depth; s++)
+	{
+		bufs[s] = poolBuf(block_pool, t * (depth + 1) + s);
+		free_slots[s] = s;
+	}
+	expect = poolBuf(block_pool, t * (depth + 1) + depth);
+	nfree = depth;
+	q = ioqOpen(io_engine, v->fd, bufs, depth, len, depth);
+
+	next = v->from + t;
+	for (;;)
+	{
+		while (nfree > 0 && next < v->to)
+		{
+			s = free_slots[--nfree];
+			slot_block[s] = next;
+			ioqRead(q, s, len, (unsigned long long)next * len);
+			next += v->nthreads;
+		}
+		if ((int)(s = ioqWait(q)) < 0)
+			break;
+		got = ioqResult(q);
+		j = slot_block[s];
+		free_slots[nfree++] = s;
+
+		/* The part of the block inside the region. */
+		lo = (unsigned long long)j * len < v->start ? (unsigned long)(v->start - (unsigned long long)j * len) : 0;
+		hi = (unsigned long long)(j + 1) * len > v->end ? (unsigned long)(v->end - (unsigned long long)j * len) : len;
+		/* The dedupe patterns repeat one block throughout a file. */
+		if (!filled || (v->pattern != PAT_DEDUPE && v->pattern != PAT_BOTH) || dedupe_ratio > 0)
+		{
+			filled = comgen_fill(gen_ctx, blockPattern(v->pattern, j), v->file, j,
+				expect, len) == 0;
+			/* A block that cannot be generated cannot be checked either. */
+			if (!filled)
+			{
+				verifyNote(v, j, lo, (unsigned long)got);
+				continue;
+			}
+		}
+		if (got >= (long)hi && memcmp(bufs[s] + lo, expect + lo, hi - lo) == 0)
+			continue;
+		/* Find the first bad byte only for the blocks that differ. */
+		for (off = lo; off < hi && off < (unsigned long)got && bufs[s][off] == expect[off]; off++)
+			;
+		verifyNote(v, j, off, (unsigned long)got);
+	}
+
+	ioqClose(q);
+	free(bufs);
+	free(slot_block);
+	free(free_slots);
+	return NULL;
+}
+
+/*
+ * Threads --verify uses, one per CPU unless -T is given.
+ */
+unsigned int verifyThreads(void)
+{
+	long n = num_threads > 0 ? num_threads : sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned int)n : 1;
+}
+
+/*
+ * Check bytes [start, end) of the given pattern and file in name, of
+ * blcksz KiB blocks, against the generator. Returns the number of bad
+ * blocks.
+ */
+unsigned long verifyFile(const char *name, int pattern, unsigned long file,
+	unsigned int blcksz, unsigned long long start, unsigned long long end)
+{
+	struct verify v;
+	struct timespec ts0, ts1;
+	pthread_t *tids;
+	unsigned long nblocks;
+	unsigned int i;
+	double secs;
+
+	memset(&v, 0, sizeof(v));
+	pthread_mutex_init(&v.lock, NULL);
+	v.pattern = pattern;
+	v.file = file;
+	v.blcksz = blcksz;
+	v.start = start;
+	v.end = end;
+	v.from = (unsigned long)(start / (blcksz * 1024));
+	v.to = fileBlocks(end, blcksz);
+	nblocks = v.to - v.from;
+	v.nthreads = verifyThreads();
+	if (v.nthreads > nblocks && nblocks > 0)
+		v.nthreads = (unsigned int)nblocks;
+
+	v.fd = I_OPEN(name, O_RDONLY | O_DIRECT, 0);
+	if (v.fd < 0 && errno == EINVAL)
+	{
+		fprintf(stderr, "O_DIRECT not supported for %s, reading through the page cache\n", name);
+		v.fd = I_OPEN(name, O_RDONLY, 0);
+	}
+	if (v.fd < 0)
+	{
+		fprintf(stderr, "Error opening file/device: %s\n", strerror(errno));
+		exit(-2);
+	}
+	tids = CALLOC(pthread_t, v.nthreads);
+	if (tids == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	fprintf(stderr, "Verifying %s with %u threads\n", name, v.nthreads);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < v.nthreads; i++)
+	{
+		if (pthread_create(&tids[i], NULL, verifyThread, &v) != 0)
+		{
+			fprintf(stderr, "Error creating verify thread: %s\n", strerror(errno));
+			exit(-1);
+		}
+	}
+	for (i = 0; i < v.nthreads; i++)
+		pthread_join(tids[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &ts1);
+	close(v.fd);
+
+	secs = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) / 1e9;
+	fprintf(stderr, "Verified %s: %lu Blocks of size %dKiB, %lu bad, %.0f MiB/s\n",
+		name, nblocks, (int)blcksz, v.bad,
+		secs > 0 ? (double)nblocks * blcksz / 1024 / secs : 0);
+	for (i = 0; i < v.nfirst; i++)
+	{
+		if (v.first_got[i] < blcksz * 1024UL && v.first_off[i] == v.first_got[i])
+			fprintf(stderr, "  block %lu at offset %llu: short read of %lu bytes\n",
+				v.first[i], (unsigned long long)v.first[i] * blcksz * 1024, v.first_got[i]);
+		else
+			fprintf(stderr, "  block %lu at offset %llu: differs from byte %llu on\n",
+				v.first[i], (unsigned long long)v.first[i] * blcksz * 1024,
+				(unsigned long long)v.first[i] * blcksz * 1024 + v.first_off[i]);
+	}
+	if (v.bad > v.nfirst)
+		fprintf(stderr, "  and %lu more\n", v.bad - v.nfirst);
+
+	free(tids);
+	pthread_mutex_destroy(&v.lock);
+	return v.bad;
+}
+
+/*
+ * Name of file i of pattern, in its -d directory when there are several.
+ */
+void dataFileName(char *name, unsigned int len, int pattern, unsigned long i)
+{
+	char base[64];
+
+	sprintf(base, pattern_files[pattern], (int)i);
+	if (ndirs > 1)
+		snprintf(name, len, "%s/%s", dirs[i % ndirs], base);
+	else
+		snprintf(name, len, "%s", base);
+}
+
+/*
+ * Verify the files, or the device, that the same options would create.
+ */
+void verifyDataSet(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz)
+{
+	int sel[COMGEN_PATTERNS + 1], p;
+	unsigned long long start, end;
+	unsigned long i;
+
+	sel[PAT_COMPRESS] = do_compress;
+	sel[PAT_DEDUPE] = do_dedupe;
+	sel[PAT_BOTH] = do_both;
+	sel[PAT_IRREDUCIBLE] = do_irreducible;
+	sel[PAT_ENTROPY] = do_entropy;
+	/* If no further selection, then the 4 default types. */
+	if (!do_compress && !do_dedupe && !do_both && !do_irreducible && !do_entropy)
+		sel[PAT_COMPRESS] = sel[PAT_DEDUPE] = sel[PAT_BOTH] = sel[PAT_IRREDUCIBLE] = 1;
+	/* --mix is one file of all of them. */
+	sel[PAT_MIX] = use_mix;
+	if (use_mix)
+		sel[PAT_COMPRESS] = sel[PAT_DEDUPE] = sel[PAT_BOTH] = sel[PAT_IRREDUCIBLE] =
+			sel[PAT_ENTROPY] = 0;
+
+	fileRegion(flsz, blcksz, &start, &end);
+	if (use_dev)
+		numFiles = 1;
+	if (do_entropy)
+		entropySetup(blcksz, fileBlocks(flsz, blcksz));
+	for (p = 0; p <= PAT_MIX; p++)
+	{
+		if (!sel[p])
+			continue;
+		for (i = 0; i < numFiles; i++)
+		{
+			if (!use_dev)
+				dataFileName(fileName, sizeof(fileName), p, i);
+			verify_bad += verifyFile(fileName, p, i, blcksz, start, end);
+		}
+	}
+	if (verify_bad)
+		fprintf(stderr, "Verify failed: %lu bad blocks\n\n", verify_bad);
+	else
+		fprintf(stderr, "Verify passed\n\n");
+}
+
+/*
+ * --jobs: every file of the data set is a task, handed out in the order
+ * the files are written one at a time. File i of every pattern goes to
+ * directory i % ndirs.
+ */
+struct jobs {
+	pthread_mutex_t lock;
+	int pattern[COMGEN_PATTERNS]; /* Selected patterns in order, or PAT_MIX. */
+	unsigned int npatterns;
+	unsigned long nfiles;    /* Files per pattern.				*/
+	unsigned long next;      /* Next task, pattern * nfiles + file.	*/
+	unsigned int blcksz;
+	unsigned long long start, end; /* Bytes of each file to write.	*/
+	unsigned int next_job;
+};
+
+/*
+ * Write file i of pattern with the buffers of job. The data depends on
+ * the salt, pattern and file only, not on the job or the order.
+ */
+static void jobFile(struct jobs *w, unsigned int job, int pattern, unsigned long i)
+{
+	char name[512], *block;
+	unsigned long j;
+	int fd, flags;
+
+	flags = O_CREAT|O_RDWR;
+	if(use_o_direct)
+		flags |= O_DIRECT;
+	if(use_dev)
+		snprintf(name, sizeof(name), "%s", fileName);
+	else
+		dataFileName(name, sizeof(name), pattern, i);
+	if(!use_region && !use_dev && !use_sink)
+		unlink(name);
+	fd = openDataFile(name, flags, 0666);
+	fprintf(stderr, "Filling %s: %s with %s data\n", use_dev ? "device" : "file", name,
+		pattern_data[pattern]);
+	statsFileStart(job, name);
+	if ((pattern == PAT_DEDUPE || pattern == PAT_BOTH) && dedupe_ratio == 0)
+	{
+		/* The one block of the file, in buffer 0 of the job. */
+		block = poolBuf(block_pool, job * (1 + pipelineDepth()));
+		if (comgen_fill(gen_ctx, pattern, i, 0, block, w->blcksz * 1024) != 0)
+		{
+			fprintf(stderr, "Error: could not generate block 0 of file %lu\n", i);
+			exit(-1);
+		}
+		j = repeatWrite(fd, block, w->blcksz, w->start, w->end, job);
+	}
+	else
+		j = pipelineWrite(fd, pattern, i, w->blcksz, w->start, w->end, job);
+	if(!use_sink)
+	{
+		fsync(fd);
+		close(fd);
 	}
-	fprintf(stdout, "%d seconds. \n", (int)t2);
-	return 0;
+	statsFileEnd(job);
+	fprintf(stderr, "Generated file %s with %d Blocks of size %dKiB\n", name, (int)j, (int)w->blcksz);
 }
 
-/* 
- * Used to create buffers that are compressible, but not dedupable.
- * The input parameters to this function:
- *
- *  bls  	..	Block size in kbyte units.
- *  memarea 	..	Location where to put the data 
- *  gransz	..	size in bytes of the minimum granule to enable dedupe
- */
-void fillBlock(unsigned int bls, void *memarea, unsigned int gransz)
+static void *jobThread(void *arg)
 {
-	unsigned int totBytes;   /* Total size of the block in bytes.		*/
-	unsigned limitloop;      /* Total number of loops to fill the block.	*/
-	unsigned int i;          /* traditional loop control			*/
-	unsigned int *placeData; /* pointer to fill data in the reserved mem area. */
-	unsigned int dat_in;     /* used to fill the buffer. 			*/
+	struct jobs *w = arg;
+	unsigned long k;
+	unsigned int job;
 
-	placeData = memarea;
-	/* Get random number and start filling the data. */
-	rannum = (unsigned int) _park_miller_rand();
-	dat_in = (unsigned int)rannum;
-	totBytes = bls * 1024;
-	limitloop = totBytes / sizeof(totBytes); 
-	for (i = 0; i < limitloop; i++)
+	pthread_mutex_lock(&w->lock);
+	job = w->next_job++;
+	while (w->next < w->npatterns * w->nfiles)
 	{
+		k = w->next++;
+		pthread_mutex_unlock(&w->lock);
+		jobFile(w, job, w->pattern[k / w->nfiles], k % w->nfiles);
+		pthread_mutex_lock(&w->lock);
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
 
-#if defined(USE_DENSITY)
-		if((i % DENSITY) == 0)
-			dat_in++;
-#else
-		dat_in++;
-#endif
-
-		/* switch to new random number at granule boundary */
-		if( (( i * sizeof(dat_in)) % gransz) == 0)	
+/*
+ * Create the numFiles files of every pattern in the mask patterns (0 for
+ * the default 4), or the Mixed files with --mix, with num_jobs files
+ * being written at a time, spread over the -d directories. Each job runs
+ * its own block pipeline.
+ */
+void createFilesJobs(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz,
+	unsigned int patterns)
+{
+	struct jobs w;
+	pthread_t *tids;
+	unsigned int njobs, t;
+	int p;
+
+	memset(&w, 0, sizeof(w));
+	pthread_mutex_init(&w.lock, NULL);
+	if (patterns == 0)
+		patterns = COMGEN_DEFAULT;
+	for (p = 0; p < COMGEN_PATTERNS; p++)
+		if (patterns & COMGEN_MASK(p))
+			w.pattern[w.npatterns++] = p;
+	if (use_mix)
+	{
+		w.pattern[0] = PAT_MIX;
+		w.npatterns = 1;
+	}
+	w.nfiles = use_dev ? 1 : numFiles;
+	w.blcksz = blcksz;
+	fileRegion(flsz, blcksz, &w.start, &w.end);
+	if (patterns & COMGEN_MASK(PAT_ENTROPY))
+		entropySetup(blcksz, fileBlocks(flsz, blcksz));
+
+	njobs = num_jobs;
+	if (njobs > w.npatterns * w.nfiles)
+		njobs = (unsigned int)(w.npatterns * w.nfiles);
+	fprintf(stderr, "Writing %lu files with %u jobs to %u directories\n",
+		w.npatterns * w.nfiles, njobs, ndirs > 1 ? ndirs : 1);
+	tids = CALLOC(pthread_t, njobs ? njobs : 1);
+	if (tids == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (t = 0; t < njobs; t++)
+	{
+		if (pthread_create(&tids[t], NULL, jobThread, &w) != 0)
 		{
-		  dat_in = (unsigned int) _park_miller_rand();
+			fprintf(stderr, "Error creating job thread: %s\n", strerror(errno));
+			exit(-1);
 		}
-		/*placeData[i] = dat_in;*/
-
-		/*
-		 * We need to convert to Network neutral format, or there will be 
- 	 	 * different compression for Big and Little Endians.
-		 */
-		placeData[i]=htonl(dat_in); /* Convert to one neutral format */
 	}
-	return; /* exit after filling the block. */
+	for (t = 0; t < njobs; t++)
+		pthread_join(tids[t], NULL);
+	fprintf(stderr, "Created %d files for this data set\n\n", (int)(w.npatterns * w.nfiles));
+	free(tids);
+	pthread_mutex_destroy(&w.lock);
 }
+#endif
 
-/* 
- * Used to create buffer that is non-compressible, but may be used for dedupe.
- * The input parameters to this function:
- *
- * bls  	..	Block size in kbyte units.
- * memarea 	..	Location where to put the data 
- * gransz	..	size in bytes of the minimum granule to enable dedupe
+/*
+ * Open a data file or device for writing, or take the -o sink. With -O
+ * the page cache is bypassed in whatever way the platform has.
  */
-void fillBlock2(unsigned int bls, void *memarea, unsigned int gransz)
+int openDataFile(const char *name, int flags, int pmode)
 {
-	unsigned int totBytes;   /* Total size of the block in bytes.	*/
-	unsigned limitloop;      /* Total number of loops to fill the block.*/
-	unsigned int dat_in;     /* used to fill the buffer. 		*/
-	unsigned int i;          /* traditional loop control.		*/
-	unsigned int *placeData; /* pointer to fill data 		*/
+	int fd;
 
-	placeData = memarea;
-	/* Get the random number and start filling the data. */
-	rannum = (unsigned int) _park_miller_rand();
-	dat_in = (unsigned int)rannum;
-	totBytes = bls * 1024;
-	limitloop = totBytes / sizeof(totBytes);
-	for (i = 0; i < limitloop; i++)
+	if(use_sink)
+		return sink_fd;
+	fd = I_OPEN(name, flags, pmode);
+	if(fd < 0)
 	{
-		dat_in = (unsigned int) _park_miller_rand();
-		placeData[i] = dat_in;
+		fprintf(stderr, "Error opening file/device: %s\n", strerror(errno));
+		exit(-2);
 	}
-	return; /* Exit after filling the buffer. */
+#if defined(_Solaris_)
+	if(use_o_direct)
+		directio(fd,DIRECTIO_ON);
+#endif
+#if defined(_macos_)
+	if(use_o_direct)
+		fcntl(fd,F_NOCACHE,1);
+#endif
+#if defined(_hpux_)
+	if(use_o_direct)
+		ioctl(fd,VX_SETCACHE,VX_DIRECT);
+#endif
+	return fd;
 }
 
 /*
  * Create file that is compressible but not dedupable.
  */
-int createExtComprFiles(unsigned int numFiles, unsigned int flsz, unsigned int blcksz,unsigned long block[])
+int createExtComprFiles(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz,unsigned long block[])
 {
 	/* 
 	 * numfiles is the number of files to create.
-	 * flsz is the file size, for the moment this is a fixed size.
+	 * flsz is the file size in bytes.
 	 * blcksz is the block size to fill the file.
 	 * block[] points to the memory area that contains the data to save.
 	 */
 	unsigned long i, j;   /* i is the file counter,j is the Block counter */
-	double fls, bls;      /* file and block size in bytes held */
+	unsigned long long start, end; /* Bytes of the file to write.	*/
 	unsigned long blcksTWrt; /* Number of blocks to write */
+	int partial;             /* Not whole blocks from the start of the file.	*/
 	int ret,fd;
 	int flags=0;
 	int pmode;
@@ -425,9 +2022,8 @@ int createExtComprFiles(unsigned int numFiles, unsigned int flsz, unsigned int b
 	   flags |= O_DIRECT;
 #endif
 	/* Calculate the number of blocks to write. 						*/
-	fls = (double)flsz*1024*1024*1024; /* file Size in GiBs; we need the number of bytes. . */
-	bls = blcksz * 1024;               /* block size in KiB; we need the number of bytes.   */
-	blcksTWrt = fls/bls;               /* here is the total of blocks to write. 		*/
+	partial = fileRegion(flsz, blcksz, &start, &end); /* Or the --offset/--length region.	*/
+	blcksTWrt = (unsigned long)(end / (blcksz * 1024)); /* Whole blocks for the inline loop.	*/
 				
 	/*
  	 * This loop generates the files of the data set.
@@ -439,33 +2035,24 @@ int createExtComprFiles(unsigned int numFiles, unsigned int flsz, unsigned int b
 		if(!use_dev)
 		{
 			sprintf(fileName, "Compress_no_dedupe_%d.dat", (int)i);
-			remove(fileName);
-		}
-		fd=I_OPEN(fileName,flags,pmode);
-         	if(fd <0)
-         	{
-			fprintf(stderr,"Error opening file/device: %s\n",strerror(errno));
-			exit(-2);
+			if(!use_sink && !use_region)
+				remove(fileName);
 		}
-#if defined(_Solaris_)
-		if(use_o_direct)
-			directio(fd,DIRECTIO_ON);
-#endif
-
-#if defined(_macos_)
-		if(use_o_direct)
-			fcntl(fd,F_NOCACHE,1);
-#endif
-#if defined(_hpux_)
-		if(use_o_direct)
-			ioctl(fd,VX_SETCACHE,VX_DIRECT);
-#endif
+		/* Start of this file in the random number stream. */
+		park_miller_seedi = comgen_seed(gen_ctx, PAT_COMPRESS, i, 0);
+		fd = openDataFile(fileName, flags, pmode);
 		if(use_dev)
 			fprintf(stderr, "Filling device: %s with compressible data\n", fileName); 
 		else
 			fprintf(stderr, "Filling file: %s with compressible data\n", fileName); 
+		statsFileStart(0, fileName);
 
 		/* Dump the blocks into the file. */
+#if !defined(WIN32)
+		if (num_threads > 1 || io_engine != IO_ENGINE_SYNC || use_sink || use_stats || partial)
+			j = pipelineWrite(fd, PAT_COMPRESS, i, blcksz, start, end, 0);
+		else
+#endif
 		for (j = 0; j < blcksTWrt; j++)
 		{
 			/* RE-DO THE PATTERN FOR EVERY BLOCK */
@@ -481,10 +2068,14 @@ int createExtComprFiles(unsigned int numFiles, unsigned int flsz, unsigned int b
 				exit(-3);
 			}
 		};
+		if(!use_sink)
+		{
 #if !defined(WIN32)
-		fsync(fd);
+			fsync(fd);
 #endif
-		close(fd);
+			close(fd);
+		}
+		statsFileEnd(0);
 		if(use_dev)
 			fprintf(stderr, "Filled device %s with %d Blocks of size %dKiB\n", fileName, (int)j, (int)blcksz);
 		else
@@ -499,16 +2090,17 @@ int createExtComprFiles(unsigned int numFiles, unsigned int flsz, unsigned int b
  * Create files that are Dedupable but not compressible.
  *
  * numfiles is the number of files to create.
- * flsz is the file size, for the moment this is a fixed size.
+ * flsz is the file size in bytes.
  * blcksz is the block size to fill the file.		
  * block[] points to the memory area that contains the data to save.
  */
-int createExtDedupeFiles(unsigned int numFiles, unsigned int flsz, unsigned int blcksz,unsigned long block[])
+int createExtDedupeFiles(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz,unsigned long block[])
 {
 
 	unsigned long i, j;      /* i is the file counter, j is the Block counter 		*/
-	double fls, bls;         /* file and block size in bytes held here respectively. 	*/
+	unsigned long long start, end; /* Bytes of the file to write.	*/
 	unsigned long blcksTWrt; /* Number of blocks to write 					*/
+	int partial;             /* Not whole blocks from the start of the file.	*/
 	int ret,fd;
 	int flags = 0;
 	int pmode;
@@ -528,9 +2120,8 @@ int createExtDedupeFiles(unsigned int numFiles, unsigned int flsz, unsigned int
 	   flags |= O_DIRECT;
 #endif
 	/* Calculate the number of blocks to write. 						*/
-	fls = (double)flsz*1024*1024*1024; /* file Size in GiBs; we need the number of bytes. 	*/
-	bls = blcksz * 1024;               /* block size in KiB; we need the number of bytes. 	*/
-	blcksTWrt = fls/bls;               /* here is the total of blocks to write. 		*/
+	partial = fileRegion(flsz, blcksz, &start, &end); /* Or the --offset/--length region.	*/
+	blcksTWrt = (unsigned long)(end / (blcksz * 1024)); /* Whole blocks for the inline loop.	*/
 
 	/* 
 	 * This loop generates the files of the data set.
@@ -544,33 +2135,27 @@ int createExtDedupeFiles(unsigned int numFiles, unsigned int flsz, unsigned int
 		if(!use_dev)
 		{
 			sprintf(fileName, "Dedupe_no_compress_%d.dat", (int)i);
-			unlink(fileName);
+			if(!use_sink && !use_region)
+				unlink(fileName);
 		}
-		fd=I_OPEN(fileName,flags,pmode);
-         	if(fd <0)
-         	{
-			fprintf(stderr,"Error opening file/device: %s\n",strerror(errno));
-			exit(-2);
-		}
-#if defined(_Solaris_)
-		if(use_o_direct)
-			directio(fd,DIRECTIO_ON);
-#endif
-#if defined(_macos_)
-		if(use_o_direct)
-			fcntl(fd,F_NOCACHE,1);
-#endif
-#if defined(_hpux_)
-		if(use_o_direct)
-			ioctl(fd,VX_SETCACHE,VX_DIRECT);
-#endif
+		/* Start of this file in the random number stream. */
+		park_miller_seedi = comgen_seed(gen_ctx, PAT_DEDUPE, i, 0);
+		fd = openDataFile(fileName, flags, pmode);
 		if(use_dev)
 			fprintf(stderr, "Filling device: %s with Dedupe data\n", fileName); 
 		else
 			fprintf(stderr, "Filling file: %s with Dedupe data\n", fileName); 
+		statsFileStart(0, fileName);
 
 		fillBlock2(blcksz, block, GRANULE_SIZE);  /* Create non-compressible pattern */
 		/* dump the blocks into the file. */
+		#if !defined(WIN32)
+		if (dedupe_ratio > 0)	/* Blocks of the unique pool, see comgen_dedupe.c. */
+			j = pipelineWrite(fd, PAT_DEDUPE, i, blcksz, start, end, 0);
+		else if (io_engine != IO_ENGINE_SYNC || repeat_mode != REPEAT_WRITE || use_sink || use_stats || partial)
+			j = repeatWrite(fd, block, blcksz, start, end, 0);
+		else
+#endif
 		for (j = 0; j < blcksTWrt; j++)
 		{
 #if defined(WIN32)
@@ -584,10 +2169,14 @@ int createExtDedupeFiles(unsigned int numFiles, unsigned int flsz, unsigned int
 				exit(-3);
 			}
 		};
+		if(!use_sink)
+		{
 #if !defined(WIN32)
-		fsync(fd);
+			fsync(fd);
 #endif
-		close(fd);
+			close(fd);
+		}
+		statsFileEnd(0);
 		if(use_dev)
 			fprintf(stderr, "Filled device %s with %d Blocks of size %dKiB\n", fileName, (int)j, (int)blcksz);
 		else
@@ -602,15 +2191,16 @@ int createExtDedupeFiles(unsigned int numFiles, unsigned int flsz, unsigned int
  * Create files that are both compressible and dedupable.
  * 
  * numfiles is the number of files to create.
- * flsz is the file size, for the moment this is a fixed size.
+ * flsz is the file size in bytes.
  * blcksz is the block size to fill the file.
  * block[] points to the memory area that contains the data to save.
  */
-int createExtComprAndDedupFiles(unsigned int numFiles, unsigned int flsz, unsigned int blcksz,unsigned long block[])
+int createExtComprAndDedupFiles(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz,unsigned long block[])
 {
 	unsigned long i, j;      /* i is the file counter, j is the Block counter 			*/
-	double fls, bls;         /* file and block size in bytes held here respectively. 		*/
+	unsigned long long start, end; /* Bytes of the file to write.	*/
 	unsigned long blcksTWrt; /* Number of blocks to write 						*/
+	int partial;             /* Not whole blocks from the start of the file.	*/
 	int ret,fd;
 	int flags = 0;
 	int pmode;
@@ -630,9 +2220,8 @@ int createExtComprAndDedupFiles(unsigned int numFiles, unsigned int flsz, unsign
 #endif
 
 	/* Calculate the number of blocks to write. */
-	fls = (double)flsz*1024*1024*1024; /* file Size in GiBs; we need the number of bytes. 		*/
-	bls = blcksz * 1024;               /* block size in KiB; we need the number of bytes. 		*/
-	blcksTWrt = fls/bls;               /* here is the total of blocks to write. 			*/
+	partial = fileRegion(flsz, blcksz, &start, &end); /* Or the --offset/--length region.	*/
+	blcksTWrt = (unsigned long)(end / (blcksz * 1024)); /* Whole blocks for the inline loop.	*/
 
 	/*
 	 * This loop generates the files of the data set.
@@ -644,33 +2233,27 @@ int createExtComprAndDedupFiles(unsigned int numFiles, unsigned int flsz, unsign
 		if(!use_dev)
 		{
 			sprintf(fileName, "Compress_and_dedupe_%d.dat", (int)i);
-			unlink(fileName);
-		}
-		fd=I_OPEN(fileName,flags,pmode);
-         	if(fd <0)
-         	{
-			fprintf(stderr,"Error opening file/device: %s\n",strerror(errno));
-			exit(-2);
+			if(!use_sink && !use_region)
+				unlink(fileName);
 		}
-#if defined(_Solaris_)
-		if(use_o_direct)
-			directio(fd,DIRECTIO_ON);
-#endif
-#if defined(_macos_)
-		if(use_o_direct)
-			fcntl(fd,F_NOCACHE,1);
-#endif
-#if defined(_hpux_)
-		if(use_o_direct)
-			ioctl(fd,VX_SETCACHE,VX_DIRECT);
-#endif
+		/* Start of this file in the random number stream. */
+		park_miller_seedi = comgen_seed(gen_ctx, PAT_BOTH, i, 0);
+		fd = openDataFile(fileName, flags, pmode);
 		if(use_dev)
 			fprintf(stderr, "Filling device: %s with compress and dedupe data\n", fileName); 
 		else
 			fprintf(stderr, "Filling file: %s with compress and dedupe data\n", fileName); 
+		statsFileStart(0, fileName);
 
 		fillBlock(blcksz, block, GRANULE_SIZE); /* RE-DO THE PATTERN FOR EVERY BLOCK */
 		/* Dump the blocks into the file. */
+		#if !defined(WIN32)
+		if (dedupe_ratio > 0)	/* Blocks of the unique pool, see comgen_dedupe.c. */
+			j = pipelineWrite(fd, PAT_BOTH, i, blcksz, start, end, 0);
+		else if (io_engine != IO_ENGINE_SYNC || repeat_mode != REPEAT_WRITE || use_sink || use_stats || partial)
+			j = repeatWrite(fd, block, blcksz, start, end, 0);
+		else
+#endif
 		for (j = 0; j < blcksTWrt; j++)
 		{
 #if defined(WIN32)
@@ -684,10 +2267,14 @@ int createExtComprAndDedupFiles(unsigned int numFiles, unsigned int flsz, unsign
 				exit(-3);
 			}
 		};
+		if(!use_sink)
+		{
 #if !defined(WIN32)
-		fsync(fd);
+			fsync(fd);
 #endif
-		close(fd);
+			close(fd);
+		}
+		statsFileEnd(0);
 		if(use_dev)
 			fprintf(stderr, "Filled device %s with %d Blocks of size %dKiB\n", fileName, (int)j, (int)blcksz);
 		else
@@ -701,7 +2288,7 @@ int createExtComprAndDedupFiles(unsigned int numFiles, unsigned int flsz, unsign
 /*
  * Create all of the 4 types of files needed for the Emerald COM tests.
  */
-void AlternativeFiles(unsigned int blocksize, unsigned int filesize, unsigned int numberfiles)
+void AlternativeFiles(unsigned int blocksize, unsigned long long filesize, unsigned int numberfiles)
 {
 	/* 
 	 * This function can generate huge files and even bigger data sets.
@@ -711,25 +2298,192 @@ void AlternativeFiles(unsigned int blocksize, unsigned int filesize, unsigned in
 	 *   Number of Files: ... 4
 	 */
 	void *block;
+	unsigned int patterns = 0;
+	unsigned long long start, end;
+#if defined(WIN32)
+	void *block_mem;
+#else
+	unsigned int npat, nbufs, i;
+	struct stat sb;
+	char popularity[32];
+	int p, n, node = -1;
+#endif
 
 	if(!blocksize)
 		blocksize = 32;
 	if(!filesize)
-		filesize = 1;
+		filesize = 1024ULL * 1024 * 1024;
 	if(!numberfiles)
 		numberfiles = 4;
+
+	if(use_region && region_off >= filesize)
+	{
+		fprintf(stderr, "--offset %llu is not inside the file size of %llu bytes.\n",
+			region_off, filesize);
+		exit(1);
+	}
+	fileRegion(filesize, blocksize, &start, &end);
+	/* O_DIRECT needs sector aligned offsets and lengths. */
+	if(use_o_direct && !use_sink && ((start | end) & 4095) != 0)
+	{
+		if(start & 4095)
+			fprintf(stderr, "With -O --offset must be a multiple of 4KiB, not %llu.\n", start);
+		else if(region_len > 0 && end - start == region_len)
+			fprintf(stderr, "With -O --length must be a multiple of 4KiB, not %llu.\n", region_len);
+		else
+			fprintf(stderr, "With -O the file size must be a multiple of 4KiB, not %llu.\n", filesize);
+		exit(-4);
+	}
+#if defined(WIN32)
+	if(end % (blocksize * 1024ULL) != 0)
+	{
+		fprintf(stderr, "On Windows the file size must be a whole number of blocks.\n");
+		exit(1);
+	}
+#endif
+
+	/* The generator for the selected patterns, 0 being the default 4. */
+	if(do_compress)
+		patterns |= COMGEN_MASK(PAT_COMPRESS);
+	if(do_dedupe)
+		patterns |= COMGEN_MASK(PAT_DEDUPE);
+	if(do_both)
+		patterns |= COMGEN_MASK(PAT_BOTH);
+	if(do_irreducible)
+		patterns |= COMGEN_MASK(PAT_IRREDUCIBLE);
+	if(do_entropy)
+		patterns |= COMGEN_MASK(PAT_ENTROPY);
+#if !defined(WIN32)
+	if(use_mix)
+	{
+		/* The patterns with a share, each of them blocks of its own files. */
+		patterns = 0;
+		for (p = 0; p < COMGEN_PATTERNS; p++)
+			if (mix_weight[p] > 0)
+				patterns |= COMGEN_MASK(p);
+		if (mix_extent % (blocksize * 1024ULL) != 0)
+		{
+			fprintf(stderr, "--extent must be a whole number of %uKiB blocks.\n", blocksize);
+			exit(1);
+		}
+		mix_blocks = (unsigned long)(mix_extent / (blocksize * 1024ULL));
+		mixSchedule();
+		fprintf(stderr, "Mix of %lluKiB extents:", mix_extent / 1024);
+		for (p = 0; p < COMGEN_PATTERNS; p++)
+			if (mix_weight[p] > 0)
+				fprintf(stderr, " %s %.1f%%", mix_names[p], 100.0 * mix_weight[p] / mix_total);
+		fprintf(stderr, "\n");
+	}
+#endif
+	gen_ctx = comgen_create(data_salt, blocksize, fileBlocks(filesize, blocksize),
+		use_dev ? 1 : numberfiles, patterns);
+	if (gen_ctx == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+#if !defined(WIN32)
+	if(dedupe_ratio > 0)
+	{
+		/* The dedupe patterns of the set draw their blocks from pools. */
+		n = patterns ? patterns : COMGEN_DEFAULT;
+		if (!(n & (COMGEN_MASK(PAT_DEDUPE) | COMGEN_MASK(PAT_BOTH))))
+		{
+			fprintf(stderr, "--dedupe-ratio needs the dedupe or compress and dedupe pattern.\n");
+			exit(-4);
+		}
+		comgen_set_dedupe(gen_ctx, dedupe_ratio, dedupe_dist, zipf_s);
+		if (dedupe_dist == COMGEN_ZIPF)
+			sprintf(popularity, "zipf %.2f", zipf_s);
+		else
+			strcpy(popularity, "uniform");
+		for (p = PAT_DEDUPE; p <= PAT_BOTH; p++)
+			if (n & COMGEN_MASK(p))
+				fprintf(stderr, "Dedupe ratio %.2f: %s blocks from %llu unique %uKiB blocks (%llu MiB), %s\n",
+					dedupe_ratio, pattern_data[p], comgen_unique_blocks(gen_ctx, p), blocksize,
+					comgen_unique_blocks(gen_ctx, p) * blocksize / 1024, popularity);
+	}
+	/*
+	 * On a NUMA host, fill and write on the node of the device, with the
+	 * block buffers in its memory.
+	 */
+	if(!use_sink && ndirs > 1)
+	{
+		/* A node only when all of the directories are on it. */
+		for (node = -2, i = 0; i < ndirs && node != -1; i++)
+		{
+			n = stat(dirs[i], &sb) == 0 ? poolNodeOfDevice((unsigned long)sb.st_dev) : -1;
+			node = (node == -2 || node == n) ? n : -1;
+		}
+	}
+	else if(!use_sink && stat(use_dev ? fileName : ".", &sb) == 0)
+		node = poolNodeOfDevice(use_dev ? (unsigned long)sb.st_rdev : (unsigned long)sb.st_dev);
+	if (node >= 0 && poolPinNode(node) != 0)
+		fprintf(stderr, "Could not pin threads to node %d\n", node);
+
+	/* Every buffer of the run, allocated once. */
+	if(do_verify)
+		nbufs = verifyThreads() * (queue_depth + 1);
+	else
+		nbufs = num_jobs * (1 + pipelineDepth());
+	block_pool = poolCreate(blocksize * 1024, nbufs, node);
+	if (block_pool == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	if (poolBacking(block_pool) != POOL_PAGES || node >= 0)
+	{
+		fprintf(stderr, "Block buffers: %u of %uKiB on %s", nbufs, blocksize,
+			poolBackingName(poolBacking(block_pool)));
+		if (node >= 0)
+			fprintf(stderr, ", NUMA node %d", node);
+		fprintf(stderr, "\n");
+	}
+
+	if(do_verify)
+	{
+		verifyDataSet(numberfiles, filesize, blocksize);
+		poolDestroy(block_pool);
+		return;
+	}
+	if(use_stats)
+	{
+		npat = 0;
+		for (p = 0; p < COMGEN_PATTERNS; p++)
+			if (patterns & COMGEN_MASK(p))
+				npat++;
+		if (npat == 0)
+			npat = 4;
+		if (use_mix)
+			npat = 1;
+		statsOpen(stats_spec, stats_interval, num_threads > 1 ? num_threads : 1, num_jobs,
+			(unsigned long long)npat * (use_dev ? 1 : numberfiles) * (end - start));
+	}
+#endif
 	
 	/* Reserve the memory space for one single block of data. */
-	block = calloc(1, ((blocksize * 1024) + page_size));
-	if (block == NULL)
+#if defined(WIN32)
+	block_mem = calloc(1, ((blocksize * 1024) + page_size));
+	if (block_mem == NULL)
 	{
 		fprintf(stderr, "Error: out of memory\n");
 		exit(-1);
 	}
-	block =(char *)(((long)block+(long)page_size) & (long)~(page_size-1));
+	block =(char *)(((long)block_mem+(long)page_size) & (long)~(page_size-1));
+#else
+	block = poolBuf(block_pool, 0);
+	if(use_mix || (!use_dev && (num_jobs > 1 || ndirs > 1)))
+	{
+		createFilesJobs(numberfiles, filesize, blocksize, patterns);
+		statsClose();
+		poolDestroy(block_pool);
+		return;
+	}
+#endif
 
 	/* If no further selection, then do all 4 types */
-	if(!do_compress && !do_dedupe && !do_both && !do_irreducible)
+	if(!do_compress && !do_dedupe && !do_both && !do_irreducible && !do_entropy)
 	{
 		createExtComprFiles(numberfiles, filesize, blocksize, block);
 		createExtDedupeFiles(numberfiles, filesize, blocksize, block);
@@ -746,6 +2500,14 @@ void AlternativeFiles(unsigned int blocksize, unsigned int filesize, unsigned in
 		createExtComprAndDedupFiles(numberfiles, filesize, blocksize, block);
 	if(do_irreducible)
 		createExtIrreducibleFiles(numberfiles, filesize, blocksize, block);
+	if(do_entropy)
+		createExtEntropyFiles(numberfiles, filesize, blocksize, block);
+#if defined(WIN32)
+	free(block_mem);
+#else
+	statsClose();
+	poolDestroy(block_pool);
+#endif
 	return;
 }
 
@@ -753,15 +2515,16 @@ void AlternativeFiles(unsigned int blocksize, unsigned int filesize, unsigned in
  * Create files that are irreducible.
  *
  * numfiles is the number of files to create.
- * flsz is the file size, for the moment this is a fixed size.
+ * flsz is the file size in bytes.
  * blcksz is the block size to fill the file.
  * block[] points to the memory area that contains the data to save.
  */
-int createExtIrreducibleFiles(unsigned int numFiles, unsigned int flsz, unsigned int blcksz,unsigned long block[])
+int createExtIrreducibleFiles(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz,unsigned long block[])
 {
 	unsigned long i, j;      /* i is the file counter, j is the Block counter		*/
-	double fls, bls;         /* file and block size in bytes held here respectively.	*/
+	unsigned long long start, end; /* Bytes of the file to write.	*/
 	unsigned long blcksTWrt; /* Number of blocks to write 					*/
+	int partial;             /* Not whole blocks from the start of the file.	*/
 	int fd,ret;
 	int flags = 0;
 	int pmode;
@@ -782,9 +2545,8 @@ int createExtIrreducibleFiles(unsigned int numFiles, unsigned int flsz, unsigned
 #endif
 
 	/* Calculate the number of blocks to write. */
-	fls = (double)flsz*1024*1024*1024; /* file Size in GiBs; we need the number of bytes. 	*/
-	bls = blcksz * 1024;               /* block size in KiB; we need the number of bytes. 	*/
-	blcksTWrt = fls/bls;               /* here is the total of blocks to write. 		*/
+	partial = fileRegion(flsz, blcksz, &start, &end); /* Or the --offset/--length region.	*/
+	blcksTWrt = (unsigned long)(end / (blcksz * 1024)); /* Whole blocks for the inline loop.	*/
 
 	/*
 	 * This loop generates the files of the data set.
@@ -796,31 +2558,23 @@ int createExtIrreducibleFiles(unsigned int numFiles, unsigned int flsz, unsigned
 		if(!use_dev)
 		{
 			sprintf(fileName, "Irreducible_%d.dat", (int)i);
-			unlink(fileName);
-		}
-		fd=I_OPEN(fileName,flags,pmode);
-         	if(fd <0)
-         	{
-			fprintf(stderr,"Error opening file/device: %s\n",strerror(errno));
-			exit(-2);
+			if(!use_sink && !use_region)
+				unlink(fileName);
 		}
-#if defined(_Solaris_)
-		if(use_o_direct)
-			directio(fd,DIRECTIO_ON);
-#endif
-#if defined(_macos_)
-		if(use_o_direct)
-			fcntl(fd,F_NOCACHE,1);
-#endif
-#if defined(_hpux_)
-		if(use_o_direct)
-			ioctl(fd,VX_SETCACHE,VX_DIRECT);
-#endif
+		/* Start of this file in the random number stream. */
+		park_miller_seedi = comgen_seed(gen_ctx, PAT_IRREDUCIBLE, i, 0);
+		fd = openDataFile(fileName, flags, pmode);
 		if(use_dev)
 			fprintf(stderr, "Filling device: %s with irreducible data\n", fileName); 
 		else
 			fprintf(stderr, "Filling file: %s with irreducible data\n", fileName); 
+		statsFileStart(0, fileName);
 		/* Dump the blocks into the file. */
+#if !defined(WIN32)
+		if (num_threads > 1 || io_engine != IO_ENGINE_SYNC || use_sink || use_stats || partial)
+			j = pipelineWrite(fd, PAT_IRREDUCIBLE, i, blcksz, start, end, 0);
+		else
+#endif
 		for (j = 0; j < blcksTWrt; j++)
 		{
 			fillBlock2(blcksz, block, GRANULE_SIZE); /* RE DO THE PATTERN FOR EVERY BLOCK */
@@ -835,10 +2589,116 @@ int createExtIrreducibleFiles(unsigned int numFiles, unsigned int flsz, unsigned
 				exit(-3);
 			}
 		};
+		if(!use_sink)
+		{
 #if !defined(WIN32)
-		fsync(fd);
+			fsync(fd);
 #endif
-		close(fd);
+			close(fd);
+		}
+		statsFileEnd(0);
+		if(use_dev)
+			fprintf(stderr, "Filled device %s with %d Blocks of size %dKiB\n", fileName,(int)j, (int)blcksz);
+		else
+			fprintf(stderr, "Generated file %s with %d Blocks of size %dKiB\n", fileName, (int)j, (int)blcksz);
+	};
+	if(!use_dev)
+		fprintf(stderr, "Created %d files for this data set\n\n", (int)i);
+	return 0;
+}
+
+
+/*
+ * Create files whose blocks each have the -E entropy, in bits per byte.
+ *
+ * numfiles is the number of files to create.
+ * flsz is the file size in bytes.
+ * blcksz is the block size to fill the file.
+ * block[] points to the memory area that contains the data to save.
+ */
+int createExtEntropyFiles(unsigned int numFiles, unsigned long long flsz, unsigned int blcksz,unsigned long block[])
+{
+	unsigned long i, j;      /* i is the file counter, j is the Block counter		*/
+	unsigned long long start, end; /* Bytes of the file to write.	*/
+	int fd;
+	int flags = 0;
+#if defined(WIN32)
+	unsigned long blcksTWrt; /* Number of blocks to write 					*/
+	int ret;
+#endif
+	int pmode;
+
+#ifdef WIN32
+	if(use_dev)
+	   	flags = _O_WRONLY|_O_BINARY;
+	else
+		flags = _O_CREAT|_O_WRONLY|_O_BINARY;
+	pmode = _S_IWRITE;
+	if(use_o_direct) /* Don't have this in Windows */
+	   flags |= 0;
+#else
+	pmode = 0666;
+	flags = O_CREAT|O_RDWR;
+	if(use_o_direct)
+	   flags |= O_DIRECT;
+#endif
+
+	/* Calculate the number of blocks to write. */
+	fileRegion(flsz, blcksz, &start, &end); /* Or the --offset/--length region.	*/
+#if defined(WIN32)
+	blcksTWrt = (unsigned long)(end / (blcksz * 1024)); /* Whole blocks for the inline loop.	*/
+#endif
+
+	entropySetup(blcksz, fileBlocks(flsz, blcksz));
+
+	/*
+	 * This loop generates the files of the data set.
+	 */
+	if(use_dev)
+		numFiles=1;
+	for (i = 0; i < numFiles; i++)
+	{
+		if(!use_dev)
+		{
+			sprintf(fileName, "Entropy_%d.dat", (int)i);
+			if(!use_sink && !use_region)
+				unlink(fileName);
+		}
+		/* Start of this file in the random number stream. */
+		park_miller_seedi = comgen_seed(gen_ctx, PAT_ENTROPY, i, 0);
+		fd = openDataFile(fileName, flags, pmode);
+		if(use_dev)
+			fprintf(stderr, "Filling device: %s with entropy targeted data\n", fileName); 
+		else
+			fprintf(stderr, "Filling file: %s with entropy targeted data\n", fileName); 
+		statsFileStart(0, fileName);
+		/* Dump the blocks into the file. */
+#if !defined(WIN32)
+		j = pipelineWrite(fd, PAT_ENTROPY, i, blcksz, start, end, 0);
+#else
+		for (j = 0; j < blcksTWrt; j++)
+		{
+			if (comgen_fill(gen_ctx, PAT_ENTROPY, i, j, block, blcksz * 1024) != 0)
+			{
+				fprintf(stderr, "Error: could not generate block %lu of file %lu\n", j, i);
+				exit(-1);
+			}
+			ret=_write(fd, block, (blcksz * 1024));
+			if(ret < 0)
+			{
+				printf("%s\n",strerror(errno));
+				exit(-3);
+			}
+		};
+#endif
+		if(!use_sink)
+		{
+#if !defined(WIN32)
+			fsync(fd);
+#endif
+			close(fd);
+		}
+		statsFileEnd(0);
 		if(use_dev)
 			fprintf(stderr, "Filled device %s with %d Blocks of size %dKiB\n", fileName,(int)j, (int)blcksz);
 		else
@@ -866,7 +2726,7 @@ _park_miller_srand(int seed)
 /*
  * Returns a random number.
  */
-static int
+int
 _park_miller_rand(void)
 {
     (void) _park_miller_ran();
@@ -885,31 +2745,8 @@ _park_miller_rand(void)
  */
 static double
 _park_miller_ran(void)
-
-#if defined(WIN32)
-#define int32_t int
-#endif
-
-#define _PARK_A_MULTIPLIER  16807L
-#define _PARK_M_MODULUS     2147483647L /* (2**31)-1 */
-#define _PARK_Q_QUOTIENT    127773L     /* 2147483647 / 16807 */
-#define _PARK_R_REMAINDER   2836L       /* 2147483647 % 16807 */
 {
-    	int32_t	lo;
-    	int32_t	hi;
-    	int32_t	test;
-
-    	hi = park_miller_seedi / _PARK_Q_QUOTIENT;
-    	lo = park_miller_seedi % _PARK_Q_QUOTIENT;
-    	test = _PARK_A_MULTIPLIER * lo - _PARK_R_REMAINDER * hi;
-    	if (test > 0) 
-	{
-		park_miller_seedi = test;
-    	} 
-	else 
-	{
-		park_miller_seedi = test + _PARK_M_MODULUS;
-    	}
+    	park_miller_seedi = _park_miller_next(park_miller_seedi);
     	return((float) park_miller_seedi / _PARK_M_MODULUS);
 }
 
@@ -917,17 +2754,41 @@ void
 usage(void)
 {
 	fprintf(stderr, "Usage: %s\n",myname);
-	fprintf(stderr,"\t-d <dir> \n");
+	fprintf(stderr,"\t-d <dir> May be repeated, the files are then spread over the directories.\n");
 	fprintf(stderr,"\t[-s] <salt>] \n");
 	fprintf(stderr,"\t[-n  number of files]  Defaults to 4.\n");
-	fprintf(stderr,"\t[-b  blocksize] (in KiB) Enables pattern generation.\n");
+	fprintf(stderr,"\t[-b  blocksize] (in KiB, or with a suffix as -f) Enables pattern generation.\n");
 	fprintf(stderr,"\t[-C] Selective pattern generation for Compression no dedupe files.\n");
 	fprintf(stderr,"\t[-D] Selective pattern generation for Dedupe no compression files.\n");
 	fprintf(stderr,"\t[-B] Selective pattern generation for Dedupe and compression files.\n");
 	fprintf(stderr,"\t[-I] Selective pattern generation for irreducible files.\n");
-	fprintf(stderr,"\t[-f  filesize] (in GiB)  Enables pattern generation.\n");
+	fprintf(stderr,"\t[-E  entropy] Pattern generation with this entropy (0-8 bits/byte).\n");
+	fprintf(stderr,"\t[-x  ratio] -E tuned to this compression ratio. (--ratio)\n");
+	fprintf(stderr,"\t[-c  codec] zstd, lz4 or deflate[:level] for -x. Defaults to zstd. (--codec)\n");
+	fprintf(stderr,"\t[-o  sink] Stream all files to -, unix:<path> or tcp:[<host>:]<port>. (--output)\n");
+	fprintf(stderr,"\t[-V] Read the data set back with O_DIRECT and check every block. (--verify)\n");
+	fprintf(stderr,"\t[-S  out] Fill/write times, write latencies and progress as JSON lines\n\t     to a file or - (stderr), or to a Prometheus textfile prom:<file>. (--stats)\n");
+	fprintf(stderr,"\t[-P  seconds] Progress interval for -S, 0 for none. Defaults to 5. (--progress)\n");
+	fprintf(stderr,"\t[-f  filesize] (in GiB, or with a B, K, M, G, T or P suffix)  Enables pattern generation.\n");
+	fprintf(stderr,"\t[-A  offset] Write only from this byte of each file, with a suffix as -f. (--offset)\n");
+	fprintf(stderr,"\t[-L  length] Write only this many bytes of each file. (--length)\n");
 	fprintf(stderr,"\t[-r  devicename] Use this raw block device.\n");
 	fprintf(stderr,"\t[-O] Use O_DIRECT. ( If it works on your box )\n");
+	fprintf(stderr,"\t[-T  threads] Fill blocks with this many threads.\n");
+	fprintf(stderr,"\t[-j  jobs] Write this many files at a time. Defaults to one per -d. (--jobs)\n");
+	fprintf(stderr,"\t[-M  mix] Interleave pattern extents in Mixed_N.dat, e.g.\n\t     compress=40,dedupe=30,both=20,irreducible=10[,entropy=N]. (--mix)\n");
+	fprintf(stderr,"\t[-X  extent] Extent size of --mix. Defaults to 1M. (--extent)\n");
+	fprintf(stderr,"\t[-e  engine] Write engine: sync, libaio or io_uring. (--engine)\n");
+	fprintf(stderr,"\t[-q  depth] Writes in flight for libaio and io_uring. Defaults to 32.\n");
+	fprintf(stderr,"\t[-R  mode] Dedupe block repeat: write, pwritev or clone. (--repeat)\n");
+	fprintf(stderr,"\t[-U  ratio] Dedupe files of blocks from a pool ratio times smaller. (--dedupe-ratio)\n");
+	fprintf(stderr,"\t[-Z  dist] Popularity of the -U pool: uniform or zipf[:exponent]. (--popularity)\n");
+	fprintf(stderr,"\t[-a  path] Estimate the entropy of the -b blocks (4KiB to 1MiB) of a file or device,\n\t     may be repeated, read with O_DIRECT with -O. No data is written. (--analyze)\n");
+	fprintf(stderr,"\t[-y  share] Sample this share of each block for -a, e.g. 0.05[:nsb]. Defaults to 1. (--sample)\n");
+	fprintf(stderr,"\t[-t  bits] Entropy below which -a counts a block as compressed. Defaults to 7. (--threshold)\n");
+	fprintf(stderr,"\t[-k  sizes] Measure the dedupe ratio of the -a paths at these chunk sizes, e.g.\n\t     256,4K,32K, instead of the entropy. (--chunks)\n");
+	fprintf(stderr,"\t[-K  size] Memory of the -k index, MiB without a suffix. Defaults to half the RAM. (--memory)\n");
+	fprintf(stderr,"\t[-W  dir] Spill an index larger than -K to this directory, else read the data\n\t     once per part of it. (--spill)\n");
 	fprintf(stderr,"\t[-v] Print version number. \n\n");
 	fprintf(stderr, "\tWarning: %s writes a minimum of 4GB of files to the directory \n\tspecified in <dir>\n", myname);
 }
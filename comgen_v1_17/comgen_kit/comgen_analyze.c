@@ -0,0 +1,491 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_analyze.c
+ *
+ *  --analyze for comgen: sampled entropy of the blocks of files and
+ *  devices that already exist.
+ *
+ *  A file or device is mapped read only and cut into blocks; threads
+ *  take runs of blocks in turn. Only the sampled bytes of a block are
+ *  read, so with a sample stride of a page or more the pages between
+ *  samples are never faulted in and the mapping is advised random,
+ *  otherwise sequential. With -O the path is opened O_DIRECT instead
+ *  and every thread preads its runs, DIRECT_RUN bytes at a time, into
+ *  its own aligned buffer, which keeps a device scan out of the page
+ *  cache. Whole blocks are counted with byteHist() of comgen_hist.c.
+ *
+ *  Each block gets an entropy estimate and interval from comgen_sample.c
+ *  and the decision an inline compressor with this threshold would take:
+ *  compress when the estimate is below it, sure when the whole interval
+ *  is on the same side. A block whose sample is all zero is checked in
+ *  full, so zero blocks are counted exactly at any sample ratio.
+ *
+ *  The report gives the percentiles of the estimates, their distribution
+ *  in 1 bit steps, the zero blocks, the decisions and the scan rate in
+ *  blocks and bytes per second. Compressibility is estimated twice, as
+ *  bytes in over bytes out: order 0, every block entropy coded at its
+ *  estimate, and inline, the blocks skipped stored as they are. With
+ *  --verify every byte of the block is counted as well, and the
+ *  estimates are checked against the exact entropy: bias, RMS error, how
+ *  often the interval holds it and how many decisions the sample got
+ *  wrong. With -o every block is a CSV row,
+ *
+ *      path,block,offset,len,sampled,support,plugin,estimate,lo,hi,decision[,exact]
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+/* For O_DIRECT on Linux. */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "comgen_entropy.h"
+#include "comgen_sample.h"
+#include "comgen_hist.h"
+#include "comgen_analyze.h"
+
+#if !defined(O_DIRECT)
+#define O_DIRECT 0
+#endif
+
+#define RUN_BLOCKS	64       /* Blocks a thread takes at a time,	*/
+#define DIRECT_RUN	(4UL << 20) /* or bytes, at most, with -O.	*/
+#define DIRECT_ALIGN	4096
+#define ENT_BINS	(8 * 64 + 1) /* Estimates in 1/64 bit steps.	*/
+#define CSV_BUF		65536
+
+/* Totals of a thread, then of a path. */
+struct tally {
+	unsigned long long blocks, bytes, sampled;
+	unsigned long long compress, compress_sure, skip_sure, zero;
+	unsigned long long bins[ENT_BINS];
+	double sum, sum_width;
+	double order0, inline_out; /* Estimated bytes out.		*/
+	/* --verify */
+	double sum_exact, sum_err, sum_err2;
+	unsigned long long covered, false_compress, false_skip;
+};
+
+/* A path being analyzed. */
+struct scan {
+	const char *path;
+	const unsigned char *base; /* The mapping, or NULL with -O.	*/
+	int fd;                   /* With -O.				*/
+	unsigned long long size;
+	unsigned long long nblocks;
+	unsigned long run;        /* Blocks taken at a time.		*/
+	unsigned long long next;  /* First block not yet taken.		*/
+	const struct analyze_opts *o;
+	struct sample_plan plan;  /* Of a whole block.			*/
+	pthread_mutex_t lock;
+	struct tally total;
+	FILE *csv;
+};
+
+struct worker {
+	pthread_t tid;
+	struct scan *s;
+	struct tally t;
+	char *csv;
+	unsigned long ncsv;
+	unsigned char *buf;       /* A run read with -O.			*/
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void csvFlush(struct worker *w)
+{
+	if (w->ncsv == 0)
+		return;
+	pthread_mutex_lock(&w->s->lock);
+	if (fwrite(w->csv, 1, w->ncsv, w->s->csv) != w->ncsv)
+	{
+		fprintf(stderr, "Error writing the --analyze rows: %s\n", strerror(errno));
+		exit(-3);
+	}
+	pthread_mutex_unlock(&w->s->lock);
+	w->ncsv = 0;
+}
+
+/* Non-zero when all len bytes of p are zero. */
+static int allZero(const unsigned char *p, unsigned long len)
+{
+	return len == 0 || (p[0] == 0 && memcmp(p, p + 1, len - 1) == 0);
+}
+
+/* Analyze block b, whose bytes are at p. */
+static void block(struct worker *w, unsigned long long b, const unsigned char *p)
+{
+	const struct analyze_opts *o = w->s->o;
+	struct sample_plan tail;
+	const struct sample_plan *plan = &w->s->plan;
+	struct sample_estimate e;
+	unsigned long count[256], len;
+	unsigned long long off = b * o->block;
+	double exact = 0, out;
+	int compress, bin, zero;
+
+	len = w->s->size - off < o->block ? (unsigned long)(w->s->size - off) : o->block;
+	if (len != plan->len)
+	{
+		samplePlan(&tail, len, o->sample);
+		plan = &tail;
+	}
+	sampleCounts(plan, p, off, count);
+	sampleEstimate(count, plan->n, len, o->estimator, &e);
+	compress = e.value < o->threshold;
+	zero = count[0] == plan->n && (plan->n == len || allZero(p, len));
+
+	w->t.blocks++;
+	w->t.zero += zero;
+	out = zero ? 0 : e.value / 8 * len;
+	w->t.order0 += out;
+	w->t.inline_out += compress ? out : len;
+	w->t.bytes += len;
+	w->t.sampled += plan->n;
+	w->t.sum += e.value;
+	w->t.sum_width += e.hi - e.lo;
+	bin = (int)(e.value * 64 + 0.5);
+	w->t.bins[bin < 0 ? 0 : bin >= ENT_BINS ? ENT_BINS - 1 : bin]++;
+	if (compress)
+		w->t.compress++;
+	if (e.hi < o->threshold)
+		w->t.compress_sure++;
+	if (e.lo >= o->threshold)
+		w->t.skip_sure++;
+
+	if (o->exact)
+	{
+		byteHist(p, len, count);
+		exact = entropyOfCounts(count, len);
+		w->t.sum_exact += exact;
+		w->t.sum_err += e.value - exact;
+		w->t.sum_err2 += (e.value - exact) * (e.value - exact);
+		w->t.covered += exact >= e.lo - 1e-9 && exact <= e.hi + 1e-9;
+		if (compress && exact >= o->threshold)
+			w->t.false_compress++;
+		if (!compress && exact < o->threshold)
+			w->t.false_skip++;
+	}
+
+	if (w->s->csv)
+	{
+		if (w->ncsv > CSV_BUF - 512)
+			csvFlush(w);
+		w->ncsv += sprintf(w->csv + w->ncsv, "%s,%llu,%llu,%lu,%lu,%u,%.4f,%.4f,%.4f,%.4f,%s",
+			w->s->path, b, off, len, plan->n, e.support, e.plugin, e.value, e.lo, e.hi,
+			compress ? "compress" : "skip");
+		if (o->exact)
+			w->ncsv += sprintf(w->csv + w->ncsv, ",%.4f", exact);
+		w->csv[w->ncsv++] = '\n';
+	}
+}
+
+/* Read blocks b to end of the -O path into the worker's buffer. */
+static void readRun(struct worker *w, unsigned long long b, unsigned long long end)
+{
+	struct scan *s = w->s;
+	unsigned long long off = b * s->o->block, len;
+	ssize_t r;
+
+	len = end * s->o->block < s->size ? end * s->o->block - off : s->size - off;
+	end = off + len;
+	/* The tail of the last block is read up to the alignment. */
+	len = (len + DIRECT_ALIGN - 1) & ~(unsigned long long)(DIRECT_ALIGN - 1);
+	while (off < end)
+	{
+		r = pread(s->fd, w->buf + (off - b * s->o->block), len, off);
+		if (r <= 0)
+		{
+			fprintf(stderr, "Error reading %s at %llu: %s\n", s->path, off,
+				r < 0 ? strerror(errno) : "end of file");
+			exit(-3);
+		}
+		off += r;
+		len -= r;
+	}
+}
+
+static void *workerThread(void *arg)
+{
+	struct worker *w = arg;
+	struct scan *s = w->s;
+	unsigned long long b, first, end;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&s->lock);
+		b = s->next;
+		s->next += s->run;
+		pthread_mutex_unlock(&s->lock);
+		if (b >= s->nblocks)
+			break;
+		end = b + s->run < s->nblocks ? b + s->run : s->nblocks;
+		if (s->base == NULL)
+			readRun(w, b, end);
+		for (first = b; b < end; b++)
+			block(w, b, s->base ? s->base + b * s->o->block : w->buf + (b - first) * s->o->block);
+	}
+	if (w->s->csv)
+		csvFlush(w);
+	return NULL;
+}
+
+static void tallyAdd(struct tally *a, const struct tally *b)
+{
+	int i;
+
+	a->blocks += b->blocks;
+	a->bytes += b->bytes;
+	a->sampled += b->sampled;
+	a->compress += b->compress;
+	a->compress_sure += b->compress_sure;
+	a->skip_sure += b->skip_sure;
+	a->zero += b->zero;
+	a->order0 += b->order0;
+	a->inline_out += b->inline_out;
+	for (i = 0; i < ENT_BINS; i++)
+		a->bins[i] += b->bins[i];
+	a->sum += b->sum;
+	a->sum_width += b->sum_width;
+	a->sum_exact += b->sum_exact;
+	a->sum_err += b->sum_err;
+	a->sum_err2 += b->sum_err2;
+	a->covered += b->covered;
+	a->false_compress += b->false_compress;
+	a->false_skip += b->false_skip;
+}
+
+/* The estimate below which a share q of the blocks fall. */
+static double percentile(const struct tally *t, double q)
+{
+	unsigned long long seen = 0, want = (unsigned long long)(q * t->blocks);
+	int i;
+
+	for (i = 0; i < ENT_BINS; i++)
+	{
+		seen += t->bins[i];
+		if (seen > want)
+			break;
+	}
+	return (i < ENT_BINS ? i : ENT_BINS - 1) / 64.0;
+}
+
+static double pct(unsigned long long a, unsigned long long b)
+{
+	return b ? 100.0 * a / b : 0;
+}
+
+/* Bytes in over bytes out, 0 when nothing would be written. */
+static double ratio(unsigned long long in, double out)
+{
+	return out >= 1 ? in / out : 0;
+}
+
+static void report(FILE *fp, const char *what, const struct tally *t, const struct analyze_opts *o,
+	double secs)
+{
+	double n = t->blocks ? (double)t->blocks : 1;
+	unsigned long long bits;
+	int i, k;
+
+	fprintf(fp, "%s: %llu blocks, %llu MiB, %.2f%% sampled (%s)\n", what, t->blocks,
+		t->bytes >> 20, pct(t->sampled, t->bytes), o->estimator == SAMPLE_NSB ? "nsb" : "mm");
+	if (t->blocks == 0)
+		return;
+	/* Smaller samples get intervals that hold less often, see comgen_sample.c. */
+	fprintf(fp, "\tEntropy: mean %.3f, p1 %.2f, p10 %.2f, p50 %.2f, p90 %.2f, p99 %.2f bits/byte,"
+		" mean %s interval %.3f wide\n", t->sum / n, percentile(t, 0.01), percentile(t, 0.10),
+		percentile(t, 0.50), percentile(t, 0.90), percentile(t, 0.99),
+		t->sampled >= SAMPLE_MIN * t->blocks ? "95%" : "approximate", t->sum_width / n);
+	fprintf(fp, "\tBits/byte:");
+	for (k = 0; k < 8; k++)
+	{
+		/* 8.0 itself goes with 7 to 8. */
+		for (bits = 0, i = 64 * k; i < 64 * (k + 1) || (k == 7 && i < ENT_BINS); i++)
+			bits += t->bins[i];
+		fprintf(fp, " %d-%d %.1f%%%s", k, k + 1, pct(bits, t->blocks), k < 7 ? "," : "\n");
+	}
+	fprintf(fp, "\tZero blocks %llu (%.1f%%), compressibility %.2f:1 order 0, %.2f:1 inline\n",
+		t->zero, pct(t->zero, t->blocks), ratio(t->bytes, t->order0), ratio(t->bytes, t->inline_out));
+	fprintf(fp, "\tBelow %.2f: compress %llu (%.1f%%, %llu sure), skip %llu (%.1f%%, %llu sure)\n",
+		o->threshold, t->compress, pct(t->compress, t->blocks), t->compress_sure,
+		t->blocks - t->compress, pct(t->blocks - t->compress, t->blocks), t->skip_sure);
+	if (o->exact)
+		fprintf(fp, "\tExact: mean %.3f, bias %+.4f, RMS error %.4f, interval holds %.1f%%,"
+			" wrong decisions %llu compress, %llu skip\n", t->sum_exact / n, t->sum_err / n,
+			sqrt(t->sum_err2 / n), pct(t->covered, t->blocks), t->false_compress, t->false_skip);
+	if (secs > 0)
+		fprintf(fp, "\t%.3f seconds, %.0f blocks/s, %.2f GB/s of blocks, %.1f MB/s sampled\n",
+			secs, t->blocks / secs, t->bytes / secs / 1e9, t->sampled / secs / 1e6);
+}
+
+/* Map path and analyze it into total. Returns -1 when it can not be read. */
+static int analyzePath(const char *path, const struct analyze_opts *o, FILE *csv, FILE *fp,
+	struct tally *total)
+{
+	struct worker *workers;
+	struct stat st;
+	struct scan s;
+	unsigned int i;
+	double t0;
+	off_t end;
+	void *m = NULL;
+	int fd;
+
+	fd = open(path, o->direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		fprintf(stderr, "Can not open %s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	memset(&s, 0, sizeof(s));
+	s.path = path;
+	s.o = o;
+	s.csv = csv;
+	s.size = st.st_size;
+	if (S_ISBLK(st.st_mode) && (end = lseek(fd, 0, SEEK_END)) > 0)
+		s.size = end;
+	if (s.size == 0)
+	{
+		close(fd);
+		report(fp, path, &s.total, o, 0);
+		return 0;
+	}
+	s.nblocks = (s.size + o->block - 1) / o->block;
+	samplePlan(&s.plan, o->block, o->sample);
+	if (o->direct)
+	{
+		s.fd = fd;
+		s.run = DIRECT_RUN / o->block;
+		if (s.run < 1)
+			s.run = 1;
+	}
+	else
+	{
+		m = mmap(NULL, s.size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED)
+		{
+			fprintf(stderr, "Can not map %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+		s.base = m;
+		s.run = RUN_BLOCKS;
+		madvise(m, s.size, s.plan.stride >= (unsigned long)sysconf(_SC_PAGESIZE) && !o->exact ?
+			MADV_RANDOM : MADV_SEQUENTIAL);
+	}
+	pthread_mutex_init(&s.lock, NULL);
+
+	workers = calloc(o->threads, sizeof(*workers));
+	if (workers == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	t0 = now();
+	for (i = 0; i < o->threads; i++)
+	{
+		workers[i].s = &s;
+		if ((csv && (workers[i].csv = malloc(CSV_BUF)) == NULL) || (o->direct &&
+			posix_memalign((void **)&workers[i].buf, DIRECT_ALIGN, s.run * o->block) != 0))
+		{
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+		if (pthread_create(&workers[i].tid, NULL, workerThread, &workers[i]) != 0)
+		{
+			fprintf(stderr, "Error: could not create thread\n");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < o->threads; i++)
+	{
+		pthread_join(workers[i].tid, NULL);
+		tallyAdd(&s.total, &workers[i].t);
+		free(workers[i].csv);
+		free(workers[i].buf);
+	}
+	report(fp, path, &s.total, o, now() - t0);
+	tallyAdd(total, &s.total);
+
+	free(workers);
+	if (m)
+		munmap(m, s.size);
+	else
+		close(fd);
+	pthread_mutex_destroy(&s.lock);
+	return 0;
+}
+
+/*
+ * Analyze the n paths. The report goes to stdout, or to stderr when the
+ * CSV rows go to stdout. Returns the exit status: 0, or 2 when a path
+ * could not be read.
+ */
+int analyzeRun(char **paths, unsigned int n, const struct analyze_opts *o)
+{
+	struct tally total;
+	FILE *csv = NULL, *fp = stdout;
+	unsigned int i;
+	int bad = 0;
+	double t0;
+
+	if (o->out != NULL && strcmp(o->out, "-") == 0)
+	{
+		csv = stdout;
+		fp = stderr;
+	}
+	else if (o->out != NULL && (csv = fopen(o->out, "w")) == NULL)
+	{
+		fprintf(stderr, "Can not open %s: %s\n", o->out, strerror(errno));
+		exit(-2);
+	}
+	if (csv)
+		fprintf(csv, "path,block,offset,len,sampled,support,plugin,estimate,lo,hi,decision%s\n",
+			o->exact ? ",exact" : "");
+
+	memset(&total, 0, sizeof(total));
+	fprintf(fp, "Analyzing %lu KiB blocks with %u threads, %.4g of each block sampled, %s (%s)\n",
+		o->block / 1024, o->threads, o->sample, o->direct ? "O_DIRECT" : "mapped",
+		byteHistSelectKernel(o->kernel));
+	t0 = now();
+	for (i = 0; i < n; i++)
+		if (analyzePath(paths[i], o, csv, fp, &total) != 0)
+			bad = 1;
+	if (n > 1)
+		report(fp, "Total", &total, o, now() - t0);
+
+	if (csv && (csv == stdout ? fflush(csv) : fclose(csv)) != 0)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", o->out, strerror(errno));
+		exit(-3);
+	}
+	return bad ? 2 : 0;
+}
+#endif /* !WIN32 */
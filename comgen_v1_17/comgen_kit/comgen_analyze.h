@@ -0,0 +1,25 @@
+/*
+ * comgen_analyze.h
+ *
+ * --analyze: the entropy of every block of existing files or devices,
+ * estimated from a sample of each block as an inline compressor would,
+ * and the share of blocks such a compressor would compress.
+ */
+#ifndef __COMGEN_ANALYZE_H__
+#define __COMGEN_ANALYZE_H__
+
+struct analyze_opts {
+	unsigned long block;     /* Block size in bytes.			*/
+	double sample;           /* Share of each block sampled, 0 < s <= 1.	*/
+	int estimator;           /* SAMPLE_MM or SAMPLE_NSB.			*/
+	double threshold;        /* Blocks estimated below it are compressed.	*/
+	unsigned int threads;
+	int exact;               /* Also the entropy of all bytes (--verify).	*/
+	const char *out;         /* Per block CSV file, - for stdout, or NULL.	*/
+	int direct;              /* Read with O_DIRECT instead of mmap (-O).	*/
+	const char *kernel;      /* byteHist() kernel, NULL for the default.	*/
+};
+
+int analyzeRun(char **, unsigned int, const struct analyze_opts *);
+
+#endif
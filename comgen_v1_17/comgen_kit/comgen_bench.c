@@ -0,0 +1,647 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_bench.c
+ *
+ *  Microbenchmarks for the comgen hot paths, one group at a time:
+ *
+ *  rng      Park & Miller generator: ns per value (the step behind
+ *           _park_miller_ran()) and ns per skip-ahead.
+ *  fill     fillBlock/fillBlock2 GB/s on one core, for every fill kernel
+ *           the CPU supports and every block size. Each kernel is first
+ *           checked against the scalar reference.
+ *  mt       comgen_fill() GB/s with 1, 2, 4 ... threads up to the number
+ *           of CPUs, for the compressible, irreducible and -E patterns.
+ *  write    The write engines against /dev/null and a file on tmpfs:
+ *           GB/s and the p50/p99 write latency at queue depth 32.
+ *  entropy  The -E kernels: entropyPlan(), entropyFill(), the histogram
+ *           entropy and the incremental tracker.
+ *  hist     byteHist() GB/s on one core, for every histogram kernel the
+ *           CPU supports, over 5.5 bit data and over data half in runs.
+ *           Each kernel is first checked against a plain counting loop.
+ *  chunk    chunkHash() GB/s on one core, over 256 byte and 4 KiB chunks,
+ *           the fingerprints of --analyze --chunks.
+ *
+ *  Results go to stdout as CSV, one row per measurement:
+ *
+ *      group,test,variant,block_kib,threads,value,unit
+ *
+ *  Usage: comgen_bench [-g group,...] [-b KiB,...] [-t seconds per test]
+ *                      [-d tmpfs directory]
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "comgen_fill.h"
+#include "comgen_io.h"
+#include "comgen_entropy.h"
+#include "comgen_hist.h"
+#include "comgen_chunk.h"
+#include "comgen_lib.h"
+#include "comgen_stats.h"
+
+#define MAX_SIZES	16
+#define WRITE_DEPTH	32
+#define WRITE_SPAN	(256UL * 1024 * 1024)	/* Bytes of the tmpfs file.	*/
+
+static double secs = 0.5;        /* Per measurement.				*/
+static unsigned int sizes[MAX_SIZES] = { 4, 16, 64, 256, 1024, 4096 };
+static unsigned int nsizes = 6;  /* Block sizes in KiB.				*/
+static const char *tmpdir = "/dev/shm";
+static volatile int sink;        /* Keeps results alive.			*/
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void row(const char *group, const char *test, const char *variant,
+	unsigned int kib, unsigned int threads, double value, const char *unit)
+{
+	printf("%s,%s,%s,%u,%u,%.4f,%s\n", group, test, variant, kib, threads, value, unit);
+	fflush(stdout);
+}
+
+static void *xmalloc(unsigned long len)
+{
+	void *p;
+
+	if (posix_memalign(&p, 4096, len) != 0)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	memset(p, 0, len);
+	return p;
+}
+
+/* ---- rng */
+
+static void benchRng(void)
+{
+	unsigned long n = 0, i;
+	double t0, t;
+	int seed = 4711;
+
+	t0 = now();
+	do
+	{
+		/* A dependent chain, like the fill loops. */
+		for (i = 0; i < 1000000; i++)
+			seed = _park_miller_next(seed);
+		n += i;
+		t = now() - t0;
+	} while (t < secs);
+	sink = seed;
+	row("rng", "park_miller_next", "scalar", 0, 1, t * 1e9 / n, "ns");
+
+	n = 0;
+	t0 = now();
+	do
+	{
+		for (i = 0; i < 10000; i++)
+			seed = _park_miller_skip(seed, 1000000007ULL + i);
+		n += i;
+		t = now() - t0;
+	} while (t < secs);
+	sink = seed;
+	row("rng", "park_miller_skip", "scalar", 0, 1, t * 1e9 / n, "ns");
+}
+
+/* ---- fill */
+
+/*
+ * Fill blocks for about secs seconds and return GB/s.
+ */
+static double timeFill(void (*fill)(unsigned int, void *, unsigned int, int *),
+	unsigned int bls, void *buf)
+{
+	unsigned long n = 0, i, batch;
+	double t0, t;
+	int seed = 4711;
+
+	/* Batch calls so that the clock is not read for every small block. */
+	batch = 1 + (1024 * 1024) / (bls * 1024);
+	t0 = now();
+	do
+	{
+		for (i = 0; i < batch; i++)
+			fill(bls, buf, GRANULE_SIZE, &seed);
+		n += batch;
+		t = now() - t0;
+	} while (t < secs);
+	return (double)n * bls * 1024 / t / 1e9;
+}
+
+/*
+ * Exit when kernel name does not produce the bytes and final generator
+ * state of the scalar kernel.
+ */
+static void checkKernel(void (*fill)(unsigned int, void *, unsigned int, int *),
+	const char *fname, const char *name, unsigned int bls, void *ref, void *buf)
+{
+	int s1 = 12345, s2 = 12345;
+
+	fillSelectKernel("scalar");
+	fill(bls, ref, GRANULE_SIZE, &s1);
+	fillSelectKernel(name);
+	fill(bls, buf, GRANULE_SIZE, &s2);
+	if (memcmp(ref, buf, bls * 1024) != 0 || s1 != s2)
+	{
+		fprintf(stderr, "%s: %s output differs from scalar\n", name, fname);
+		exit(2);
+	}
+}
+
+static void benchFill(void)
+{
+	unsigned int i;
+	const char *name;
+	void *ref, *buf;
+	int k;
+
+	for (i = 0; i < nsizes; i++)
+	{
+		ref = xmalloc(sizes[i] * 1024UL);
+		buf = xmalloc(sizes[i] * 1024UL);
+		for (k = 0; fill_kernel_names[k] != NULL; k++)
+		{
+			name = fill_kernel_names[k];
+			if (!fillKernelAvailable(name))
+				continue;
+			checkKernel(fillBlock_r, "fillBlock", name, sizes[i], ref, buf);
+			checkKernel(fillBlock2_r, "fillBlock2", name, sizes[i], ref, buf);
+			fillSelectKernel(name);
+			row("fill", "fillBlock", name, sizes[i], 1, timeFill(fillBlock_r, sizes[i], buf), "GB/s");
+			row("fill", "fillBlock2", name, sizes[i], 1, timeFill(fillBlock2_r, sizes[i], buf), "GB/s");
+		}
+		free(ref);
+		free(buf);
+	}
+	fillSelectKernel(NULL);
+}
+
+/* ---- mt */
+
+struct mt_arg {
+	struct comgen_ctx *ctx;
+	int pattern;
+	unsigned int t, nthreads;
+	unsigned long blocks;    /* Filled by this thread.		*/
+	double t_end;
+};
+
+static void *mtThread(void *arg)
+{
+	struct mt_arg *a = arg;
+	unsigned long len = comgen_block_size(a->ctx), j;
+	void *buf = xmalloc(len);
+
+	/* Thread t takes blocks t, t + nthreads, ... as the pipeline would. */
+	for (j = a->t; now() < a->t_end; j += a->nthreads)
+	{
+		comgen_fill(a->ctx, a->pattern, 0, j % 32768, buf, len);
+		a->blocks++;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void benchMt(void)
+{
+	static const struct { int pattern; const char *name; } pats[] = {
+		{ COMGEN_COMPRESS, "compress" },
+		{ COMGEN_IRREDUCIBLE, "irreducible" },
+		{ COMGEN_ENTROPY, "entropy" },
+	};
+	struct comgen_ctx *ctx;
+	struct mt_arg *a;
+	pthread_t *tids;
+	unsigned int ncpu, n, t, p;
+	unsigned long blocks;
+	double t0;
+
+	ncpu = (unsigned int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu == 0 || ncpu == (unsigned int)-1)
+		ncpu = 1;
+	ctx = comgen_create(79, 32, 32768, 1, COMGEN_DEFAULT | COMGEN_MASK(COMGEN_ENTROPY));
+	a = calloc(ncpu, sizeof(*a));
+	tids = calloc(ncpu, sizeof(*tids));
+	if (ctx == NULL || a == NULL || tids == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	comgen_set_entropy(ctx, 5.5, 0);
+
+	for (p = 0; p < sizeof(pats) / sizeof(pats[0]); p++)
+	{
+		for (n = 1; ; n = (n * 2 < ncpu) ? n * 2 : ncpu)
+		{
+			t0 = now();
+			for (t = 0; t < n; t++)
+			{
+				memset(&a[t], 0, sizeof(a[t]));
+				a[t].ctx = ctx;
+				a[t].pattern = pats[p].pattern;
+				a[t].t = t;
+				a[t].nthreads = n;
+				a[t].t_end = t0 + secs;
+				if (pthread_create(&tids[t], NULL, mtThread, &a[t]) != 0)
+				{
+					fprintf(stderr, "Error creating thread: %s\n", strerror(errno));
+					exit(-1);
+				}
+			}
+			blocks = 0;
+			for (t = 0; t < n; t++)
+			{
+				pthread_join(tids[t], NULL);
+				blocks += a[t].blocks;
+			}
+			row("mt", pats[p].name, fillSelectKernel(NULL), 32, n,
+				(double)blocks * 32 * 1024 / (now() - t0) / 1e9, "GB/s");
+			if (n == ncpu)
+				break;
+		}
+	}
+	free(a);
+	free(tids);
+	comgen_destroy(ctx);
+}
+
+/* ---- write */
+
+static void benchWriteTarget(const char *test, int fd, unsigned int bls)
+{
+	static const int engines[] = { IO_ENGINE_SYNC, IO_ENGINE_LIBAIO, IO_ENGINE_IO_URING };
+	unsigned long len = bls * 1024UL, n, span;
+	char *bufs[WRITE_DEPTH];
+	struct lat_hist *h;
+	struct ioq *q;
+	double t0, t;
+	unsigned int e, s;
+	int seed = 4711;
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (s = 0; s < WRITE_DEPTH; s++)
+	{
+		bufs[s] = xmalloc(len);
+		fillBlock2_r(bls, bufs[s], GRANULE_SIZE, &seed);
+	}
+	span = WRITE_SPAN / len;
+	if (span == 0)
+		span = 1;
+
+	for (e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+	{
+		q = ioqOpen(engines[e], fd, bufs, WRITE_DEPTH, len, WRITE_DEPTH);
+		/* Report an engine only once when it falls back to another. */
+		if (ioqEngine(q) != engines[e])
+		{
+			ioqClose(q);
+			continue;
+		}
+		memset(h, 0, sizeof(*h));
+		n = 0;
+		t0 = now();
+		do
+		{
+			for (s = 0; s < WRITE_DEPTH; s++)
+			{
+				if (ioqInflight(q) >= WRITE_DEPTH)
+				{
+					ioqWait(q);
+					histAdd(h, ioqLatency(q));
+				}
+				ioqWrite(q, s, len, (unsigned long long)(n++ % span) * len);
+			}
+			t = now() - t0;
+		} while (t < secs);
+		while (ioqWait(q) >= 0)
+			histAdd(h, ioqLatency(q));
+		t = now() - t0;
+		ioqClose(q);
+		row("write", test, ioEngineName(engines[e]), bls, 1, (double)n * len / t / 1e9, "GB/s");
+		row("write", test, ioEngineName(engines[e]), bls, 1, histPercentile(h, 0.5) / 1e3, "us_p50");
+		row("write", test, ioEngineName(engines[e]), bls, 1, histPercentile(h, 0.99) / 1e3, "us_p99");
+	}
+	for (s = 0; s < WRITE_DEPTH; s++)
+		free(bufs[s]);
+	free(h);
+}
+
+static void benchWrite(void)
+{
+	char path[512];
+	unsigned int i;
+	int fd;
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Error opening /dev/null: %s\n", strerror(errno));
+		exit(-2);
+	}
+	for (i = 0; i < nsizes; i++)
+		benchWriteTarget("devnull", fd, sizes[i]);
+	close(fd);
+
+	snprintf(path, sizeof(path), "%s/comgen_bench.%d", tmpdir, (int)getpid());
+	fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0600);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Skipping tmpfs writes, %s: %s\n", path, strerror(errno));
+		return;
+	}
+	unlink(path);
+	for (i = 0; i < nsizes; i++)
+		benchWriteTarget("tmpfs", fd, sizes[i]);
+	close(fd);
+}
+
+/* ---- entropy */
+
+static void benchEntropy(void)
+{
+	struct entropy_plan *plan;
+	struct entropy_tracker *tr;
+	unsigned long n, i, len;
+	unsigned int k;
+	double t0, t, e = 0;
+	void *buf;
+	int seed = 4711;
+
+	plan = malloc(sizeof(*plan));
+	tr = malloc(sizeof(*tr));
+	if (plan == NULL || tr == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (k = 0; k < nsizes; k++)
+	{
+		len = sizes[k] * 1024UL;
+		n = 0;
+		t0 = now();
+		do
+		{
+			entropyPlan(plan, len, 5.5);
+			n++;
+			t = now() - t0;
+		} while (t < secs);
+		row("entropy", "entropyPlan", "scalar", sizes[k], 1, t * 1e6 / n, "us");
+
+		buf = xmalloc(len);
+		n = 0;
+		t0 = now();
+		do
+		{
+			for (i = 0; i < 1 + (1024 * 1024) / len; i++)
+			{
+				entropyFill(plan, buf, seed);
+				seed = _park_miller_next(seed);
+			}
+			n += i;
+			t = now() - t0;
+		} while (t < secs);
+		row("entropy", "entropyFill", "scalar", sizes[k], 1, (double)n * len / t / 1e9, "GB/s");
+		free(buf);
+	}
+
+	n = 0;
+	t0 = now();
+	do
+	{
+		for (i = 0; i < 10000; i++)
+			e += entropyOfCounts(plan->count, plan->n);
+		n += i;
+		t = now() - t0;
+	} while (t < secs);
+	sink = (int)e;
+	row("entropy", "entropyOfCounts", "scalar", 0, 1, t * 1e9 / n, "ns");
+
+	/* One update moves a byte from one value to another. */
+	entropyTrackerInit(tr, plan->count);
+	n = 0;
+	t0 = now();
+	do
+	{
+		for (i = 0; i < 1000000; i++)
+		{
+			entropyTrackerRemove(tr, (unsigned int)(i % 255) + 1, 1);
+			entropyTrackerAdd(tr, (unsigned int)(i % 253) + 1, 1);
+		}
+		n += i;
+		e += entropyTrackerValue(tr);
+		t = now() - t0;
+	} while (t < secs);
+	sink = (int)e;
+	row("entropy", "tracker_update", "scalar", 0, 1, t * 1e9 / n, "ns");
+	free(plan);
+	free(tr);
+}
+
+/* ---- hist */
+
+static void benchHist(void)
+{
+	struct entropy_plan *plan;
+	unsigned long count[256], ref[256], n, i, len;
+	unsigned int k;
+	const char *name;
+	double t0, t;
+	unsigned char *buf;
+	int seed = 4711, runs, h;
+
+	plan = malloc(sizeof(*plan));
+	if (plan == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (k = 0; k < nsizes; k++)
+	{
+		len = sizes[k] * 1024UL;
+		buf = xmalloc(len);
+		entropyPlan(plan, len, 5.5);
+		for (runs = 0; runs < 2; runs++)
+		{
+			entropyFill(plan, buf, seed);
+			/* Every other 256 bytes one value, as padding or zero pages. */
+			for (i = 0; runs && i < len; i += 512)
+				memset(buf + i, (int)(i >> 9) & 3, len - i < 256 ? len - i : 256);
+			memset(ref, 0, sizeof(ref));
+			for (i = 0; i < len; i++)
+				ref[buf[i]]++;
+			for (h = 0; byte_hist_kernel_names[h] != NULL; h++)
+			{
+				name = byte_hist_kernel_names[h];
+				if (!byteHistKernelAvailable(name))
+					continue;
+				byteHistSelectKernel(name);
+				byteHist(buf, len, count);
+				if (memcmp(count, ref, sizeof(ref)) != 0)
+				{
+					fprintf(stderr, "%s: byteHist counts differ\n", name);
+					exit(2);
+				}
+				n = 0;
+				t0 = now();
+				do
+				{
+					for (i = 0; i < 1 + (1024 * 1024) / len; i++)
+						byteHist(buf, len, count);
+					n += i;
+					t = now() - t0;
+				} while (t < secs);
+				sink = (int)count[0];
+				row("hist", runs ? "byteHist_runs" : "byteHist", name, sizes[k], 1,
+					(double)n * len / t / 1e9, "GB/s");
+			}
+		}
+		free(buf);
+	}
+	byteHistSelectKernel(NULL);
+	free(plan);
+}
+
+/* ---- chunk */
+
+static void benchChunk(void)
+{
+	static const unsigned long chunk[] = { 256, 4096 };
+	unsigned long long h = 0;
+	unsigned long n, i, len = 4UL << 20;
+	char test[32];
+	double t0, t;
+	void *buf;
+	int k, seed = 4711;
+
+	buf = xmalloc(len);
+	for (i = 0; i < len / 1024; i++)
+		fillBlock2_r(1, (char *)buf + i * 1024, GRANULE_SIZE, &seed);
+	for (k = 0; k < 2; k++)
+	{
+		n = 0;
+		t0 = now();
+		do
+		{
+			for (i = 0; i < len; i += chunk[k])
+				h += chunkHash((char *)buf + i, chunk[k], 0);
+			n += len;
+			t = now() - t0;
+		} while (t < secs);
+		sink = (int)h;
+		sprintf(test, "chunkHash_%lu", chunk[k]);
+		row("chunk", test, "scalar", 0, 1, (double)n / t / 1e9, "GB/s");
+	}
+	free(buf);
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} groups[] = {
+	{ "rng", benchRng },
+	{ "fill", benchFill },
+	{ "mt", benchMt },
+	{ "write", benchWrite },
+	{ "entropy", benchEntropy },
+	{ "hist", benchHist },
+	{ "chunk", benchChunk },
+};
+#define NGROUPS	(sizeof(groups) / sizeof(groups[0]))
+
+static void usage(const char *me)
+{
+	fprintf(stderr, "Usage: %s [-g rng,fill,mt,write,entropy,hist,chunk] [-b KiB,...] [-t seconds] [-d tmpfs dir]\n", me);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *sel = NULL;
+	char *list, *tok;
+	unsigned int g;
+	int c;
+
+	while ((c = getopt(argc, argv, "g:b:t:d:")) != EOF)
+	{
+		switch (c)
+		{
+		case 'g':	/* Groups to run */
+			sel = optarg;
+			break;
+		case 'b':	/* Block sizes in KiB */
+			nsizes = 0;
+			list = strdup(optarg);
+			for (tok = strtok(list, ","); tok != NULL && nsizes < MAX_SIZES; tok = strtok(NULL, ","))
+				if ((sizes[nsizes] = (unsigned int)strtol(tok, NULL, 10)) > 0)
+					nsizes++;
+			free(list);
+			if (nsizes == 0)
+				usage(argv[0]);
+			break;
+		case 't':	/* Seconds per test */
+			secs = strtod(optarg, NULL);
+			break;
+		case 'd':	/* Directory on tmpfs */
+			tmpdir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (sel != NULL)
+	{
+		for (tok = strtok(list = strdup(sel), ","); tok != NULL; tok = strtok(NULL, ","))
+		{
+			for (g = 0; g < NGROUPS && strcmp(tok, groups[g].name) != 0; g++)
+				;
+			if (g == NGROUPS)
+				usage(argv[0]);
+		}
+		free(list);
+	}
+
+	printf("group,test,variant,block_kib,threads,value,unit\n");
+	for (g = 0; g < NGROUPS; g++)
+	{
+		if (sel != NULL)
+		{
+			list = strdup(sel);
+			for (tok = strtok(list, ","); tok != NULL && strcmp(tok, groups[g].name) != 0; tok = strtok(NULL, ","))
+				;
+			free(list);
+			if (tok == NULL)
+				continue;
+		}
+		groups[g].run();
+	}
+	return 0;
+}
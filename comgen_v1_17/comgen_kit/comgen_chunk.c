@@ -0,0 +1,689 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_chunk.c
+ *
+ *  --analyze --chunks for comgen: the dedupe ratio of files and devices
+ *  that already exist, at several fixed chunk sizes at once.
+ *
+ *  The paths are cut into chunks from their start, the last chunk of a
+ *  path being short, and every chunk is fingerprinted with chunkHash(),
+ *  a 64 bit multiply-fold hash of the xxh3 kind: four lanes of 16 bytes,
+ *  each folding the 128 bit product of its two words mixed with a key,
+ *  and an xxh3 avalanche at the end. Only the smallest chunks are hashed
+ *  from the data; a chunk of m smallest chunks is the hash of their m
+ *  fingerprints, so the data is read and hashed once for all the sizes,
+ *  which must be multiples of the smallest.
+ *
+ *  The fingerprints of all the sizes go into one open addressing index
+ *  of 64 bit slots, the size in the low TAG_BITS bits of a fingerprint.
+ *  Threads take runs of a path in turn and insert without locks, with a
+ *  compare and swap into the empty slot at the end of the linear probe.
+ *  A fingerprint inserted counts as unique, so the dedupe ratio of a
+ *  size is its chunks over its unique chunks; with 64 bit fingerprints
+ *  a false match is about one in 2^64 / (chunks of the size), so even
+ *  at billions of chunks the ratio is off by a few chunks at most.
+ *
+ *  The index is sized for every chunk being unique. When that is more
+ *  than --memory, the fingerprints are cut into 2^k partitions by their
+ *  top bits, each small enough for the budget, and either
+ *
+ *    - the paths are read once per partition, each pass indexing only
+ *      its partition, or
+ *    - with --spill, read once, the fingerprints appended to one file
+ *      per partition in the spill directory, and the partitions then
+ *      indexed by the threads side by side, one each at a time. A
+ *      thread spills a fingerprint only when it differs from the last
+ *      one it spilled to the partition, which keeps runs of one chunk
+ *      (zeros mostly) out of the files. The index of a partition is the
+ *      budgeted size whatever its file holds, since only its unique
+ *      fingerprints take slots.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+/* For O_DIRECT on Linux. */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "comgen_chunk.h"
+
+#if !defined(O_DIRECT)
+#define O_DIRECT 0
+#endif
+
+#define CHUNK_RUN	(4UL << 20) /* Bytes a thread takes at a time, at least. */
+#define CHUNK_ALIGN	4096
+#define TAG_BITS	3        /* Chunk size index + 1 in a fingerprint.	*/
+#define LOAD		0.7      /* Most of the index slots filled.		*/
+#define MAX_PARTS	1024     /* Partitions of the fingerprints, at most.	*/
+#define SPILL_BUF	65536    /* Bytes per thread and partition, at most.	*/
+#define SPILL_READ	(1UL << 20)
+
+#define TAG(h, t)	(((h) & ~((1ULL << TAG_BITS) - 1)) | ((t) + 1))
+
+/* A path being analyzed. */
+struct source {
+	const char *path;
+	const unsigned char *base; /* The mapping, or NULL with -O.	*/
+	int fd;
+	unsigned long long size;
+};
+
+struct counts {
+	unsigned long long total[CHUNK_SIZES];
+	unsigned long long unique[CHUNK_SIZES];
+	unsigned long long zero[CHUNK_SIZES];
+};
+
+/* A pass over all the paths. */
+struct pass {
+	const struct chunk_opts *o;
+	struct source *src;
+	unsigned int nsrc;
+	unsigned long run;        /* Bytes taken at a time.		*/
+	unsigned long small;      /* The smallest chunk size.		*/
+	unsigned long long zero_fp[CHUNK_SIZES]; /* Of a chunk of zeros.	*/
+	unsigned int pbits;       /* Partition = top pbits of a hash.	*/
+	unsigned int part;        /* The partition indexed in this pass.	*/
+	int count;                /* Count the chunks in this pass.	*/
+	unsigned long long *index; /* NULL when spilling.		*/
+	unsigned long long mask;  /* Slots - 1.				*/
+	int *spill_fd;            /* Per partition, when spilling.	*/
+	unsigned long spill_buf;  /* Per partition and thread.		*/
+	pthread_mutex_t lock;
+	unsigned int cur;         /* Path, or spill partition, being taken. */
+	unsigned long long next;  /* Offset of the next run in it.	*/
+};
+
+struct worker {
+	pthread_t tid;
+	struct pass *ps;
+	struct counts c;
+	unsigned char *buf;       /* A run read with -O.			*/
+	unsigned long long *fp;   /* Of the smallest chunks of a run.	*/
+	unsigned char *sbuf;      /* Spill buffers, spill_buf bytes each.	*/
+	unsigned long *nsbuf;
+	unsigned long long *last; /* Spilled last, per partition.		*/
+};
+
+/* Keys of the lanes, and of the final mix. */
+static const unsigned long long hash_key[8] = {
+	0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x85EBCA77C2B2AE63ULL,
+	0x27D4EB2F165667C5ULL, 0xFF51AFD7ED558CCDULL, 0xC4CEB9FE1A85EC53ULL, 0xD6E8FEB86659FD93ULL
+};
+
+/* The two halves of the 128 bit product of a and b, xored. */
+static unsigned long long mulFold(unsigned long long a, unsigned long long b)
+{
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+
+	return (unsigned long long)r ^ (unsigned long long)(r >> 64);
+#else
+	unsigned long long ll, lh, hl, hh, mid;
+
+	ll = (a & 0xffffffff) * (b & 0xffffffff);
+	lh = (a & 0xffffffff) * (b >> 32);
+	hl = (a >> 32) * (b & 0xffffffff);
+	hh = (a >> 32) * (b >> 32);
+	mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+	return ((ll & 0xffffffff) | (mid << 32)) ^ (hh + (lh >> 32) + (hl >> 32) + (mid >> 32));
+#endif
+}
+
+static unsigned long long read64(const unsigned char *p)
+{
+	unsigned long long v;
+
+	memcpy(&v, p, 8);
+	return v;
+}
+
+/* Lane l takes the 16 bytes at p; it keeps its state should they cancel the key. */
+#define LANE(a, p, l)	((a) + mulFold((a) ^ read64(p) ^ hash_key[2 * (l)], read64((p) + 8) ^ hash_key[2 * (l) + 1]))
+
+/*
+ * 64 bit hash of len bytes of buf.
+ */
+unsigned long long chunkHash(const void *buf, unsigned long len, unsigned long long seed)
+{
+	const unsigned char *p = buf;
+	unsigned char last[16];
+	unsigned long long a[4], h;
+	unsigned long n = len;
+	int l;
+
+	for (l = 0; l < 4; l++)
+		a[l] = seed + hash_key[7 - l];
+	for (; n >= 64; p += 64, n -= 64)
+	{
+		a[0] = LANE(a[0], p, 0);
+		a[1] = LANE(a[1], p + 16, 1);
+		a[2] = LANE(a[2], p + 32, 2);
+		a[3] = LANE(a[3], p + 48, 3);
+	}
+	for (l = 0; n >= 16; p += 16, n -= 16, l++)
+		a[l] = LANE(a[l], p, l);
+	if (n > 0)
+	{
+		memset(last, 0, sizeof(last));
+		memcpy(last, p, n);
+		a[l] = LANE(a[l], last, l);
+	}
+	h = len * hash_key[0] + mulFold(a[0] ^ hash_key[1], a[1] ^ hash_key[2]) +
+		mulFold(a[2] ^ hash_key[3], a[3] ^ hash_key[4]);
+	h ^= h >> 37;
+	h *= 0x165667919E3779F9ULL;
+	return h ^ (h >> 32);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xcalloc(unsigned long long n, unsigned long size)
+{
+	void *p = calloc(n, size);
+
+	if (p == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/* Index slots for n fingerprints, a power of two. */
+static unsigned long long indexSlots(unsigned long long n)
+{
+	unsigned long long slots = 1024;
+
+	while (slots * LOAD < n)
+		slots *= 2;
+	return slots;
+}
+
+/* Insert fingerprint v; returns 1 when it was not in the index yet. */
+static int indexInsert(unsigned long long *index, unsigned long long mask, unsigned long long v)
+{
+	unsigned long long i = (v >> TAG_BITS) & mask, cur, n;
+
+	for (n = 0; n <= mask; n++, i = (i + 1) & mask)
+	{
+		cur = __atomic_load_n(&index[i], __ATOMIC_RELAXED);
+		if (cur == 0 && __atomic_compare_exchange_n(&index[i], &cur, v, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return 1;
+		/* cur is now what the slot holds. */
+		if (cur == v)
+			return 0;
+	}
+	fprintf(stderr, "Error: the dedupe index is full\n");
+	exit(-1);
+}
+
+static void spillFlush(struct worker *w, unsigned int part)
+{
+	const unsigned char *b = w->sbuf + (unsigned long)part * w->ps->spill_buf;
+	unsigned long n = w->nsbuf[part];
+	ssize_t r;
+
+	/* The spill files are O_APPEND, so the threads' writes do not mix. */
+	while (n > 0)
+	{
+		r = write(w->ps->spill_fd[part], b, n);
+		if (r < 0)
+		{
+			fprintf(stderr, "Error writing the spill files: %s\n", strerror(errno));
+			exit(-3);
+		}
+		b += r;
+		n -= r;
+	}
+	w->nsbuf[part] = 0;
+}
+
+/* Account fingerprint h of a chunk of size index t. */
+static void chunkAdd(struct worker *w, unsigned long long h, unsigned int t)
+{
+	struct pass *ps = w->ps;
+	unsigned int part = ps->pbits ? (unsigned int)(h >> (64 - ps->pbits)) : 0;
+	unsigned long long v = TAG(h, t);
+
+	if (ps->count)
+	{
+		w->c.total[t]++;
+		w->c.zero[t] += h == ps->zero_fp[t];
+	}
+	if (ps->index == NULL)
+	{
+		if (v == w->last[part])
+			return;
+		w->last[part] = v;
+		if (w->nsbuf[part] + sizeof(v) > ps->spill_buf)
+			spillFlush(w, part);
+		memcpy(w->sbuf + (unsigned long)part * ps->spill_buf + w->nsbuf[part], &v, sizeof(v));
+		w->nsbuf[part] += sizeof(v);
+	}
+	else if (part == ps->part)
+		w->c.unique[t] += indexInsert(ps->index, ps->mask, v);
+}
+
+/* Fingerprint the len bytes at p, the chunks of every size. */
+static void hashRun(struct worker *w, const unsigned char *p, unsigned long len)
+{
+	const struct chunk_opts *o = w->ps->o;
+	unsigned long s = w->ps->small, ns = (len + s - 1) / s, m, i;
+	unsigned int k;
+
+	for (i = 0; i < ns; i++)
+		w->fp[i] = chunkHash(p + i * s, len - i * s < s ? len - i * s : s, 0);
+	for (k = 0; k < o->nsizes; k++)
+	{
+		m = o->size[k] / s;
+		for (i = 0; i < ns; i += m)
+			chunkAdd(w, m == 1 ? w->fp[i] :
+				chunkHash(w->fp + i, (ns - i < m ? ns - i : m) * sizeof(*w->fp), o->size[k]), k);
+	}
+}
+
+/* Read len bytes at off of the -O path into buf. */
+static void readRun(const struct source *src, unsigned char *buf, unsigned long long off,
+	unsigned long len)
+{
+	unsigned long long end = off + len, base = off;
+	ssize_t r;
+
+	/* The tail of the path is read up to the alignment. */
+	len = (len + CHUNK_ALIGN - 1) & ~(unsigned long)(CHUNK_ALIGN - 1);
+	while (off < end)
+	{
+		r = pread(src->fd, buf + (off - base), len, off);
+		if (r <= 0)
+		{
+			fprintf(stderr, "Error reading %s at %llu: %s\n", src->path, off,
+				r < 0 ? strerror(errno) : "end of file");
+			exit(-3);
+		}
+		off += r;
+		len -= r;
+	}
+}
+
+static void *workerThread(void *arg)
+{
+	struct worker *w = arg;
+	struct pass *ps = w->ps;
+	struct source *src;
+	unsigned long long off;
+	unsigned long len;
+	unsigned int part;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&ps->lock);
+		if (ps->cur >= ps->nsrc)
+		{
+			pthread_mutex_unlock(&ps->lock);
+			break;
+		}
+		src = &ps->src[ps->cur];
+		off = ps->next;
+		ps->next += ps->run;
+		if (ps->next >= src->size)
+		{
+			ps->cur++;
+			ps->next = 0;
+		}
+		pthread_mutex_unlock(&ps->lock);
+
+		len = src->size - off < ps->run ? (unsigned long)(src->size - off) : ps->run;
+		if (len == 0)
+			continue;
+		if (src->base)
+			hashRun(w, src->base + off, len);
+		else
+		{
+			readRun(src, w->buf, off, len);
+			hashRun(w, w->buf, len);
+		}
+	}
+	if (ps->index == NULL)
+		for (part = 0; part < (1U << ps->pbits); part++)
+			spillFlush(w, part);
+	return NULL;
+}
+
+/* Index the spill partitions, one per thread at a time. */
+static void *mergeThread(void *arg)
+{
+	struct worker *w = arg;
+	struct pass *ps = w->ps;
+	unsigned long long *index, *v, off;
+	unsigned int part;
+	struct stat st;
+	ssize_t r, i;
+
+	v = (unsigned long long *)w->buf;
+	for (;;)
+	{
+		pthread_mutex_lock(&ps->lock);
+		part = ps->cur++;
+		pthread_mutex_unlock(&ps->lock);
+		if (part >= (1U << ps->pbits))
+			break;
+		if (fstat(ps->spill_fd[part], &st) != 0)
+		{
+			fprintf(stderr, "Error reading the spill files: %s\n", strerror(errno));
+			exit(-3);
+		}
+		index = xcalloc(ps->mask + 1, sizeof(*index));
+		for (off = 0; off < (unsigned long long)st.st_size; off += r)
+		{
+			r = pread(ps->spill_fd[part], v, SPILL_READ, off);
+			r -= r % sizeof(*v);
+			if (r <= 0)
+			{
+				fprintf(stderr, "Error reading the spill files: %s\n",
+					r < 0 ? strerror(errno) : "end of file");
+				exit(-3);
+			}
+			for (i = 0; i < r / (ssize_t)sizeof(*v); i++)
+				w->c.unique[(v[i] & ((1 << TAG_BITS) - 1)) - 1] += indexInsert(index, ps->mask, v[i]);
+		}
+		free(index);
+		/* The file was unlinked when created; this frees its blocks. */
+		close(ps->spill_fd[part]);
+	}
+	return NULL;
+}
+
+/* Run o->threads of fn over ps, adding up their counts into c. */
+static void runThreads(struct pass *ps, void *(*fn)(void *), struct counts *c)
+{
+	const struct chunk_opts *o = ps->o;
+	struct worker *workers;
+	unsigned int i, k;
+
+	workers = xcalloc(o->threads, sizeof(*workers));
+	ps->cur = 0;
+	ps->next = 0;
+	for (i = 0; i < o->threads; i++)
+	{
+		workers[i].ps = ps;
+		if (fn == mergeThread || o->direct)
+		{
+			if (posix_memalign((void **)&workers[i].buf, CHUNK_ALIGN,
+				fn == mergeThread ? SPILL_READ : ps->run) != 0)
+			{
+				fprintf(stderr, "Error: out of memory\n");
+				exit(-1);
+			}
+		}
+		if (fn == workerThread)
+			workers[i].fp = xcalloc(ps->run / ps->small, sizeof(*workers[i].fp));
+		if (fn == workerThread && ps->index == NULL)
+		{
+			workers[i].sbuf = xcalloc(1ULL << ps->pbits, ps->spill_buf);
+			workers[i].nsbuf = xcalloc(1ULL << ps->pbits, sizeof(*workers[i].nsbuf));
+			workers[i].last = xcalloc(1ULL << ps->pbits, sizeof(*workers[i].last));
+		}
+		if (pthread_create(&workers[i].tid, NULL, fn, &workers[i]) != 0)
+		{
+			fprintf(stderr, "Error: could not create thread\n");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < o->threads; i++)
+	{
+		pthread_join(workers[i].tid, NULL);
+		for (k = 0; k < o->nsizes; k++)
+		{
+			c->total[k] += workers[i].c.total[k];
+			c->unique[k] += workers[i].c.unique[k];
+			c->zero[k] += workers[i].c.zero[k];
+		}
+		free(workers[i].buf);
+		free(workers[i].fp);
+		free(workers[i].sbuf);
+		free(workers[i].nsbuf);
+		free(workers[i].last);
+	}
+	free(workers);
+}
+
+/* Open, and without -O map, path into src. Returns -1 when it can not be read. */
+static int sourceOpen(struct source *src, const char *path, int direct)
+{
+	struct stat st;
+	off_t end;
+	void *m;
+
+	memset(src, 0, sizeof(*src));
+	src->path = path;
+	src->fd = open(path, direct ? O_RDONLY | O_DIRECT : O_RDONLY);
+	if (src->fd < 0 || fstat(src->fd, &st) != 0)
+	{
+		fprintf(stderr, "Can not open %s: %s\n", path, strerror(errno));
+		if (src->fd >= 0)
+			close(src->fd);
+		return -1;
+	}
+	src->size = st.st_size;
+	if (S_ISBLK(st.st_mode) && (end = lseek(src->fd, 0, SEEK_END)) > 0)
+		src->size = end;
+	if (direct || src->size == 0)
+		return 0;
+	m = mmap(NULL, src->size, PROT_READ, MAP_SHARED, src->fd, 0);
+	close(src->fd);
+	if (m == MAP_FAILED)
+	{
+		fprintf(stderr, "Can not map %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	madvise(m, src->size, MADV_SEQUENTIAL);
+	src->base = m;
+	return 0;
+}
+
+/* Create the 2^pbits spill files, unlinked, in the spill directory. */
+static void spillOpen(struct pass *ps)
+{
+	unsigned int part, nparts = 1U << ps->pbits;
+	char name[4096];
+	struct rlimit rl;
+
+	/* One descriptor per partition, on top of the paths'. */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < nparts + ps->nsrc + 64)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	ps->spill_fd = xcalloc(nparts, sizeof(*ps->spill_fd));
+	for (part = 0; part < nparts; part++)
+	{
+		snprintf(name, sizeof(name), "%s/comgen_spill_%d_%u", ps->o->spill, (int)getpid(), part);
+		ps->spill_fd[part] = open(name, O_RDWR | O_CREAT | O_EXCL | O_APPEND, 0600);
+		if (ps->spill_fd[part] < 0)
+		{
+			fprintf(stderr, "Can not create %s: %s\n", name, strerror(errno));
+			exit(-2);
+		}
+		unlink(name);
+	}
+}
+
+/*
+ * Measure the dedupe ratio of the n paths together at the chunk sizes
+ * of o. The report goes to stdout. Returns the exit status: 0, or 2
+ * when a path could not be read, without a report when none could.
+ */
+int chunkRun(char **paths, unsigned int n, const struct chunk_opts *o)
+{
+	struct pass ps;
+	struct counts c;
+	struct source *src;
+	struct rusage ru;
+	unsigned long long chunks = 0, bytes = 0, slots, *zero_fp;
+	unsigned long align, mult;
+	unsigned char *zero;
+	unsigned int i, k, nparts, passes = 1;
+	int bad = 0;
+	double t0, t;
+
+	memset(&ps, 0, sizeof(ps));
+	memset(&c, 0, sizeof(c));
+	ps.o = o;
+	ps.small = o->size[0];
+	for (k = 1; k < o->nsizes; k++)
+		if (o->size[k] < ps.small)
+			ps.small = o->size[k];
+	src = xcalloc(n, sizeof(*src));
+	for (i = 0; i < n; i++)
+	{
+		if (sourceOpen(&src[ps.nsrc], paths[i], o->direct) != 0)
+		{
+			bad = 1;
+			continue;
+		}
+		bytes += src[ps.nsrc].size;
+		for (k = 0; k < o->nsizes; k++)
+			chunks += (src[ps.nsrc].size + o->size[k] - 1) / o->size[k];
+		ps.nsrc++;
+	}
+	/* Nothing to report on. */
+	if (ps.nsrc == 0)
+	{
+		free(src);
+		return 2;
+	}
+	ps.src = src;
+
+	/* Runs are whole chunks of every size, and aligned for O_DIRECT. */
+	ps.run = ps.small;
+	for (k = 0; k < o->nsizes; k++)
+		while (ps.run % o->size[k] != 0)
+			ps.run += ps.small;
+	align = o->direct ? CHUNK_ALIGN : 1;
+	for (mult = 1; (ps.run * mult) % align != 0; mult++)
+		;
+	ps.run *= mult;
+	ps.run *= (CHUNK_RUN + ps.run - 1) / ps.run;
+
+	/* A chunk of zeros, to count the zero chunks by their fingerprint. */
+	zero = xcalloc(ps.small, 1);
+	zero_fp = xcalloc(ps.run / ps.small, sizeof(*zero_fp));
+	for (i = 0; i < ps.run / ps.small; i++)
+		zero_fp[i] = chunkHash(zero, ps.small, 0);
+	for (k = 0; k < o->nsizes; k++)
+		ps.zero_fp[k] = o->size[k] == ps.small ? zero_fp[0] :
+			chunkHash(zero_fp, o->size[k] / ps.small * sizeof(*zero_fp), o->size[k]);
+	free(zero);
+	free(zero_fp);
+
+	/*
+	 * Partitions so that the index of one fits the budget, with room
+	 * for their sizes to vary. Spilled partitions are indexed by all
+	 * the threads at once.
+	 */
+	for (ps.pbits = 0; ; ps.pbits++)
+	{
+		nparts = 1U << ps.pbits;
+		slots = indexSlots(chunks / nparts + 4 * sqrt((double)chunks / nparts) + 64);
+		if (slots * sizeof(*ps.index) * (o->spill && ps.pbits ? o->threads : 1) <= o->memory)
+			break;
+		if (nparts >= MAX_PARTS)
+		{
+			fprintf(stderr, "--memory of %llu MiB is too small for %llu chunks.\n",
+				o->memory >> 20, chunks);
+			exit(1);
+		}
+	}
+	if (ps.pbits && o->spill)
+	{
+		ps.spill_buf = o->memory / o->threads / nparts / sizeof(*ps.index) * sizeof(*ps.index);
+		if (ps.spill_buf > SPILL_BUF)
+			ps.spill_buf = SPILL_BUF;
+		if (ps.spill_buf < 512)
+			ps.spill_buf = 512;
+		spillOpen(&ps);
+	}
+	else
+		passes = nparts;
+
+	printf("Dedupe of %u paths, %llu MiB with %u threads, %s\n", ps.nsrc, bytes >> 20,
+		o->threads, o->direct ? "O_DIRECT" : "mapped");
+	if (ps.spill_fd)
+		printf("\tIndex %.1f MiB per thread, %u partitions spilled to %s\n",
+			slots * sizeof(*ps.index) / 1048576.0, nparts, o->spill);
+	else
+		printf("\tIndex %.1f MiB, %u pass%s over the data\n", slots * sizeof(*ps.index) / 1048576.0,
+			passes, passes > 1 ? "es" : "");
+	fflush(stdout);
+
+	pthread_mutex_init(&ps.lock, NULL);
+	t0 = now();
+	for (ps.part = 0; ps.part < passes; ps.part++)
+	{
+		ps.count = ps.part == 0;
+		if (!ps.spill_fd)
+			ps.index = xcalloc(slots, sizeof(*ps.index));
+		ps.mask = slots - 1;
+		runThreads(&ps, workerThread, &c);
+		free(ps.index);
+		ps.index = NULL;
+	}
+	if (ps.spill_fd)
+	{
+		runThreads(&ps, mergeThread, &c);
+		free(ps.spill_fd);
+	}
+	t = now() - t0;
+	pthread_mutex_destroy(&ps.lock);
+
+	for (k = 0; k < o->nsizes; k++)
+		printf("\tChunk %lu: %llu chunks, %llu unique, %.2f:1 dedupe, %llu zero (%.1f%%)\n",
+			o->size[k], c.total[k], c.unique[k], c.unique[k] ? (double)c.total[k] / c.unique[k] : 0,
+			c.zero[k], c.total[k] ? 100.0 * c.zero[k] / c.total[k] : 0);
+	if (t > 0)
+		printf("\t%.3f seconds, %.2f GB/s\n", t, bytes / t / 1e9);
+	/*
+	 * To check the index against --memory, the run and spill buffers
+	 * coming on top. Mapped paths count in the RSS too, so only with -O.
+	 */
+	if (o->direct && getrusage(RUSAGE_SELF, &ru) == 0)
+		printf("\tPeak RSS %.1f MiB\n", ru.ru_maxrss / 1024.0);
+
+	for (i = 0; i < ps.nsrc; i++)
+	{
+		if (src[i].base)
+			munmap((void *)src[i].base, src[i].size);
+		else
+			close(src[i].fd);
+	}
+	free(src);
+	return bad ? 2 : 0;
+}
+#endif /* !WIN32 */
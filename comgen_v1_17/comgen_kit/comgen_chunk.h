@@ -0,0 +1,25 @@
+/*
+ * comgen_chunk.h
+ *
+ * --analyze --chunks: the dedupe ratio of existing files or devices, the
+ * unique against the total fixed size chunks at several chunk sizes, in
+ * a bounded amount of memory.
+ */
+#ifndef __COMGEN_CHUNK_H__
+#define __COMGEN_CHUNK_H__
+
+#define CHUNK_SIZES	7	/* Chunk sizes at most, tagged 1 to 7.		*/
+
+struct chunk_opts {
+	unsigned long size[CHUNK_SIZES]; /* Bytes, multiples of the smallest.	*/
+	unsigned int nsizes;
+	unsigned long long memory; /* Budget of the index in bytes.		*/
+	const char *spill;       /* Directory of the spill files, or NULL.	*/
+	unsigned int threads;
+	int direct;              /* Read with O_DIRECT instead of mmap (-O).	*/
+};
+
+unsigned long long chunkHash(const void *, unsigned long, unsigned long long);
+int chunkRun(char **, unsigned int, const struct chunk_opts *);
+
+#endif
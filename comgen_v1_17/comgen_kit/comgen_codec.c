@@ -0,0 +1,257 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_codec.c
+ *
+ *  Compressors for the --ratio mode of comgen, and the reference codecs
+ *  of comgen_diff, which also decompresses with them.
+ *
+ *  zstd      ZSTD_compress(), levels 1-22, default 3.
+ *  lz4       LZ4_compress_default(), or LZ4_compress_HC() for levels 2-12.
+ *            The block format, without frame.
+ *  deflate   zlib compress2(), levels 1-9, default 6. This is the zlib
+ *            format, i.e. deflate with 6 bytes of header and checksum.
+ *
+ *  Decompression is ZSTD_decompress(), LZ4_decompress_safe() and zlib
+ *  uncompress(), whatever the level.
+ *
+ *  The shared libraries are opened with dlopen() and the few functions
+ *  used are looked up by name, so neither headers nor link time libraries
+ *  are needed. A codec whose library is not installed fails to open.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "comgen_codec.h"
+
+#define CODEC_ZSTD	0
+#define CODEC_LZ4	1
+#define CODEC_DEFLATE	2
+
+typedef size_t (*zstd_compress_t)(void *, size_t, const void *, size_t, int);
+typedef unsigned (*zstd_iserror_t)(size_t);
+typedef size_t (*zstd_bound_t)(size_t);
+typedef int (*lz4_compress_t)(const char *, char *, int, int);
+typedef int (*lz4_compress_hc_t)(const char *, char *, int, int, int);
+typedef int (*lz4_bound_t)(int);
+typedef int (*z_compress2_t)(unsigned char *, unsigned long *, const unsigned char *, unsigned long, int);
+typedef unsigned long (*z_bound_t)(unsigned long);
+typedef size_t (*zstd_decompress_t)(void *, size_t, const void *, size_t);
+typedef int (*lz4_decompress_t)(const char *, char *, int, int);
+typedef int (*z_uncompress_t)(unsigned char *, unsigned long *, const unsigned char *, unsigned long);
+
+struct codec {
+	int type;
+	int level;
+	char name[32];           /* "zstd:3" and so on.			*/
+	void *lib;
+	void *compress;          /* Compression entry point.		*/
+	void *compress_hc;       /* lz4: LZ4_compress_HC().		*/
+	void *decompress;        /* Decompression entry point.		*/
+	void *bound;             /* Worst case compressed size.		*/
+	void *iserror;           /* zstd: ZSTD_isError().		*/
+};
+
+static const struct {
+	const char *name;
+	int min_level, max_level, def_level;
+	const char *libs[4];
+} codecs[] = {
+	{ "zstd", 1, 22, 3,
+	  { "libzstd.so.1", "libzstd.so", "libzstd.1.dylib", "libzstd.dylib" } },
+	{ "lz4", 1, 12, 1,
+	  { "liblz4.so.1", "liblz4.so", "liblz4.1.dylib", "liblz4.dylib" } },
+	{ "deflate", 1, 9, 6,
+	  { "libz.so.1", "libz.so", "libz.1.dylib", "libz.dylib" } },
+};
+
+/* Look up a symbol, complaining when it is missing. */
+static void *codecSym(struct codec *c, const char *sym)
+{
+	void *p = dlsym(c->lib, sym);
+
+	if (p == NULL)
+		fprintf(stderr, "Codec %s: %s not found in its library\n", c->name, sym);
+	return p;
+}
+
+/*
+ * Open a codec from its "name[:level]" spelling. Returns NULL, with a
+ * message, for an unknown name or level or when the library is missing.
+ */
+struct codec *codecOpen(const char *spec)
+{
+	struct codec *c;
+	const char *colon;
+	size_t len;
+	int t, i;
+
+	colon = strchr(spec, ':');
+	len = colon ? (size_t)(colon - spec) : strlen(spec);
+	for (t = 0; t < 3; t++)
+		if (strlen(codecs[t].name) == len && strncmp(spec, codecs[t].name, len) == 0)
+			break;
+	if (t == 3)
+	{
+		fprintf(stderr, "Unknown codec '%s', use zstd, lz4 or deflate[:level].\n", spec);
+		return NULL;
+	}
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	c->type = t;
+	c->level = colon ? (int)strtol(colon + 1, NULL, 10) : codecs[t].def_level;
+	if (c->level < codecs[t].min_level || c->level > codecs[t].max_level)
+	{
+		fprintf(stderr, "Codec %s levels are %d to %d.\n", codecs[t].name,
+			codecs[t].min_level, codecs[t].max_level);
+		free(c);
+		return NULL;
+	}
+	sprintf(c->name, "%s:%d", codecs[t].name, c->level);
+
+	for (i = 0; i < 4 && c->lib == NULL; i++)
+		c->lib = dlopen(codecs[t].libs[i], RTLD_NOW | RTLD_LOCAL);
+	if (c->lib == NULL)
+	{
+		fprintf(stderr, "Codec %s: %s is not installed\n", c->name, codecs[t].libs[0]);
+		free(c);
+		return NULL;
+	}
+	switch (t)
+	{
+	case CODEC_ZSTD:
+		c->compress = codecSym(c, "ZSTD_compress");
+		c->bound = codecSym(c, "ZSTD_compressBound");
+		c->iserror = codecSym(c, "ZSTD_isError");
+		c->decompress = codecSym(c, "ZSTD_decompress");
+		break;
+	case CODEC_LZ4:
+		c->compress = codecSym(c, "LZ4_compress_default");
+		c->bound = codecSym(c, "LZ4_compressBound");
+		c->decompress = codecSym(c, "LZ4_decompress_safe");
+		if (c->level > 1)
+			c->compress_hc = codecSym(c, "LZ4_compress_HC");
+		if (c->level > 1 && c->compress_hc == NULL)
+			c->compress = NULL;
+		break;
+	case CODEC_DEFLATE:
+		c->compress = codecSym(c, "compress2");
+		c->bound = codecSym(c, "compressBound");
+		c->decompress = codecSym(c, "uncompress");
+		break;
+	}
+	if (c->compress == NULL || c->bound == NULL || c->decompress == NULL ||
+		(t == CODEC_ZSTD && c->iserror == NULL))
+	{
+		codecClose(c);
+		return NULL;
+	}
+	return c;
+}
+
+const char *codecName(struct codec *c)
+{
+	return c->name;
+}
+
+/* The format without level, "zstd", "lz4" or "deflate". */
+const char *codecFormat(struct codec *c)
+{
+	return codecs[c->type].name;
+}
+
+/*
+ * Size of the output buffer codecCompress() needs for len bytes.
+ */
+unsigned long codecBound(struct codec *c, unsigned long len)
+{
+	switch (c->type)
+	{
+	case CODEC_ZSTD:
+		return (unsigned long)((zstd_bound_t)c->bound)(len);
+	case CODEC_LZ4:
+		return (unsigned long)((lz4_bound_t)c->bound)((int)len);
+	default:
+		return ((z_bound_t)c->bound)(len);
+	}
+}
+
+/*
+ * Compress len bytes of src into dst, which holds cap bytes. Returns the
+ * compressed size, or -1 on error.
+ */
+long codecCompress(struct codec *c, const void *src, unsigned long len, void *dst, unsigned long cap)
+{
+	size_t zr;
+	unsigned long dlen;
+	int r;
+
+	switch (c->type)
+	{
+	case CODEC_ZSTD:
+		zr = ((zstd_compress_t)c->compress)(dst, cap, src, len, c->level);
+		if (((zstd_iserror_t)c->iserror)(zr))
+			return -1;
+		return (long)zr;
+	case CODEC_LZ4:
+		if (c->compress_hc)
+			r = ((lz4_compress_hc_t)c->compress_hc)(src, dst, (int)len, (int)cap, c->level);
+		else
+			r = ((lz4_compress_t)c->compress)(src, dst, (int)len, (int)cap);
+		return r > 0 ? r : -1;
+	default:
+		dlen = cap;
+		r = ((z_compress2_t)c->compress)(dst, &dlen, src, len, c->level);
+		return r == 0 ? (long)dlen : -1;
+	}
+}
+
+/*
+ * Decompress len bytes of src into dst, which holds cap bytes. Returns
+ * the decompressed size, or -1 on error, including output beyond cap.
+ */
+long codecDecompress(struct codec *c, const void *src, unsigned long len, void *dst, unsigned long cap)
+{
+	size_t zr;
+	unsigned long dlen;
+	int r;
+
+	switch (c->type)
+	{
+	case CODEC_ZSTD:
+		zr = ((zstd_decompress_t)c->decompress)(dst, cap, src, len);
+		if (((zstd_iserror_t)c->iserror)(zr))
+			return -1;
+		return (long)zr;
+	case CODEC_LZ4:
+		r = ((lz4_decompress_t)c->decompress)(src, dst, (int)len, (int)cap);
+		return r >= 0 ? r : -1;
+	default:
+		dlen = cap;
+		r = ((z_uncompress_t)c->decompress)(dst, &dlen, src, len);
+		return r == 0 ? (long)dlen : -1;
+	}
+}
+
+void codecClose(struct codec *c)
+{
+	if (c == NULL)
+		return;
+	if (c->lib)
+		dlclose(c->lib);
+	free(c);
+}
+#endif /* !WIN32 */
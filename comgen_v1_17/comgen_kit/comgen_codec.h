@@ -0,0 +1,23 @@
+/*
+ * comgen_codec.h
+ *
+ * Compressors used to calibrate the --ratio mode and as the reference
+ * codecs of comgen_diff. A codec is named as
+ * "zstd", "lz4" or "deflate", optionally followed by ":level". The
+ * libraries are loaded when the codec is opened, so comgen builds and
+ * runs without them.
+ */
+#ifndef __COMGEN_CODEC_H__
+#define __COMGEN_CODEC_H__
+
+struct codec;
+
+struct codec *codecOpen(const char *);
+const char *codecName(struct codec *);
+const char *codecFormat(struct codec *);
+unsigned long codecBound(struct codec *, unsigned long);
+long codecCompress(struct codec *, const void *, unsigned long, void *, unsigned long);
+long codecDecompress(struct codec *, const void *, unsigned long, void *, unsigned long);
+void codecClose(struct codec *);
+
+#endif
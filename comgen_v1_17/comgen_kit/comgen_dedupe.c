@@ -0,0 +1,210 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_dedupe.c
+ *
+ *  Block references of the dedupe patterns under --dedupe-ratio.
+ *
+ *  Without a ratio a dedupe file repeats one block. With one, the nrefs
+ *  blocks of the data set refer to a pool of nrefs / ratio unique blocks,
+ *  and the pool block of data set block g comes from counters alone, so
+ *  that no table of the pool or of the references is ever kept:
+ *
+ *   - g is first put through a keyed permutation of [0, nrefs), a four
+ *     round Feistel network on the next even power of two, walked until
+ *     it lands inside the range. The blocks the permutation sends below
+ *     nunique refer to that pool block, so every pool block is used at
+ *     least once and the ratio is exact.
+ *
+ *   - The other blocks draw their pool block from a hash of g, uniformly
+ *     or after Zipf's law. The Zipf draw is the rejection-inversion method
+ *     of Hormann and Derflinger, constant time and memory for any pool
+ *     size, with pool block 0 the most popular.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if defined(WIN32)
+#pragma warning(disable:4996)
+#pragma warning(disable:4267)
+#pragma warning(disable:4244)
+#pragma warning(disable:4018)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "comgen_dedupe.h"
+
+#if defined(WIN32)
+/* log1p() and expm1() are not in older Visual Studio C libraries. */
+#define log1p(x)	log(1 + (x))
+#define expm1(x)	(exp(x) - 1)
+#endif
+
+/*
+ * Finalizer of splitmix64, a well mixed hash of a 64 bit value. The
+ * references are built from it, and the tools seed their generators
+ * with it.
+ */
+unsigned long long mixHash(unsigned long long x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* A hash of x in [0, 1). */
+static double unitHash(unsigned long long x)
+{
+	return (double)(mixHash(x) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * The functions of the rejection-inversion sampler for exponent s: h(x)
+ * = x^-s, H(x) its integral and the inverse of H. helper1() and helper2()
+ * are log1p(x) / x and expm1(x) / x, kept accurate around x = 0 where the
+ * exponent is close to 1.
+ */
+static double helper1(double x)
+{
+	if (fabs(x) > 1e-8)
+		return log1p(x) / x;
+	return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x)
+{
+	if (fabs(x) > 1e-8)
+		return expm1(x) / x;
+	return 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+static double zipfH(double s, double x)
+{
+	return exp(-s * log(x));
+}
+
+static double zipfHIntegral(double s, double x)
+{
+	double lx = log(x);
+
+	return helper2((1 - s) * lx) * lx;
+}
+
+static double zipfHIntegralInverse(double s, double x)
+{
+	double t = x * (1 - s);
+
+	if (t < -1)
+		t = -1;
+	return exp(helper1(t) * x);
+}
+
+/*
+ * Plan the references of nrefs blocks to a pool of nrefs / ratio unique
+ * blocks, rounded, popular after dist with Zipf exponent s. key selects
+ * the references, different keys giving unrelated ones. Returns 0, or -1
+ * for a ratio below 1 or a Zipf exponent that is not positive.
+ */
+int dedupePlan(struct dedupe_plan *plan, unsigned long long nrefs, double ratio, int dist,
+	double s, unsigned long long key)
+{
+	unsigned int bits;
+
+	memset(plan, 0, sizeof(*plan));
+	if (ratio < 1 || (dist == DEDUPE_ZIPF && !(s > 0)))
+		return -1;
+	plan->nrefs = nrefs > 0 ? nrefs : 1;
+	plan->nunique = (unsigned long long)(plan->nrefs / ratio + 0.5);
+	if (plan->nunique < 1)
+		plan->nunique = 1;
+	if (plan->nunique > plan->nrefs)
+		plan->nunique = plan->nrefs;
+	plan->dist = dist;
+	plan->s = s;
+	plan->key = key;
+
+	/* The Feistel domain, an even number of bits covering nrefs. */
+	for (bits = 2; bits < 64 && (1ULL << bits) < plan->nrefs; bits += 2)
+		;
+	plan->half = bits / 2;
+
+	if (dist == DEDUPE_ZIPF)
+	{
+		plan->hx1 = zipfHIntegral(s, 1.5) - 1;
+		plan->hn = zipfHIntegral(s, plan->nunique + 0.5);
+		plan->sval = 2 - zipfHIntegralInverse(s, zipfHIntegral(s, 2.5) - zipfH(s, 2));
+	}
+	return 0;
+}
+
+/*
+ * The keyed permutation of [0, nrefs): Feistel rounds on 2 * half bits,
+ * repeated while the result is outside the range. The domain is less
+ * than four times nrefs, so that takes a few rounds at most on average.
+ */
+static unsigned long long dedupePermute(const struct dedupe_plan *plan, unsigned long long x)
+{
+	unsigned long long mask = (plan->half < 32) ? (1ULL << plan->half) - 1 : 0xffffffffULL;
+	unsigned long long l, r, t;
+	int k;
+
+	do
+	{
+		l = x >> plan->half;
+		r = x & mask;
+		for (k = 0; k < 4; k++)
+		{
+			t = l ^ (mixHash(r ^ mixHash(plan->key + k)) & mask);
+			l = r;
+			r = t;
+		}
+		x = (l << plan->half) | r;
+	} while (x >= plan->nrefs);
+	return x;
+}
+
+/*
+ * Zipf rank in [1, nunique] for the draws of the hash h.
+ */
+static unsigned long long zipfDraw(const struct dedupe_plan *plan, unsigned long long h)
+{
+	double u, x;
+	unsigned long long k;
+
+	for (;;)
+	{
+		h = mixHash(h);
+		u = plan->hn + unitHash(h) * (plan->hx1 - plan->hn);
+		x = zipfHIntegralInverse(plan->s, u);
+		k = (x < 1.5) ? 1 : (unsigned long long)(x + 0.5);
+		if (k > plan->nunique)
+			k = plan->nunique;
+		if (k - x <= plan->sval ||
+			u >= zipfHIntegral(plan->s, k + 0.5) - zipfH(plan->s, (double)k))
+			return k;
+	}
+}
+
+/*
+ * Pool block, in [0, nunique), that block g of the data set refers to.
+ */
+unsigned long long dedupeRef(const struct dedupe_plan *plan, unsigned long long g)
+{
+	unsigned long long q, h;
+
+	q = dedupePermute(plan, g % plan->nrefs);
+	if (q < plan->nunique)
+		return q;
+	h = mixHash(mixHash(plan->key + 4) ^ g);
+	if (plan->dist == DEDUPE_ZIPF)
+		return zipfDraw(plan, h) - 1;
+	return h % plan->nunique;
+}
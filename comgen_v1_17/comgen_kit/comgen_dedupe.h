@@ -0,0 +1,29 @@
+/*
+ * comgen_dedupe.h
+ *
+ * Block references of the dedupe patterns with a dedupe ratio. The nrefs
+ * blocks of a data set refer to a pool of nunique blocks; a plan maps any
+ * block to its pool block in constant time and memory, whatever the size
+ * of the pool.
+ */
+#ifndef __COMGEN_DEDUPE_H__
+#define __COMGEN_DEDUPE_H__
+
+#define DEDUPE_UNIFORM	0	/* Every pool block equally popular.		*/
+#define DEDUPE_ZIPF	1	/* Pool block k popular as 1 / (k + 1)^s.	*/
+
+struct dedupe_plan {
+	unsigned long long nrefs;   /* Blocks that refer to the pool.		*/
+	unsigned long long nunique; /* Blocks in the pool.			*/
+	int dist;                   /* DEDUPE_UNIFORM or DEDUPE_ZIPF.		*/
+	double s;                   /* Zipf exponent.				*/
+	unsigned long long key;     /* Hash key of the references.		*/
+	unsigned int half;          /* Bits of a Feistel half, see dedupeRef().	*/
+	double hx1, hn, sval;       /* Constants of the Zipf sampler.		*/
+};
+
+int dedupePlan(struct dedupe_plan *, unsigned long long, double, int, double, unsigned long long);
+unsigned long long dedupeRef(const struct dedupe_plan *, unsigned long long);
+unsigned long long mixHash(unsigned long long);
+
+#endif
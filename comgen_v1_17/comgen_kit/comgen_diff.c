@@ -0,0 +1,685 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_diff.c
+ *
+ *  Differential round trip testing of compressors. Blocks of the comgen
+ *  patterns stream through the -c reference codecs, each at its level,
+ *  and through -t backends: shared objects with the ABI of comgen_fuzz.h
+ *  that drive a device, an emulator or another implementation of one of
+ *  the formats. For every block and compressor:
+ *
+ *  identity  What the compressor made is decompressed by its own side,
+ *            the library for a codec, decompress for a backend, and must
+ *            give back the block.
+ *  cross     A backend declared as speaking a format (-t dev.so:zstd)
+ *            decompresses what each reference codec of the format made,
+ *            and the reference library decompresses what the backend
+ *            made. Two backends of one format also check each other.
+ *
+ *  Every check is a CSV row on stdout,
+ *
+ *      kib,pattern,block,compressor,decompressor,in,out,ratio,c_mbps,d_mbps,status
+ *
+ *  status being ok, mismatch (other bytes or length), cerror or derror
+ *  (the entry point failed). A summary per compressor and decompressor
+ *  goes to stderr. The -j threads take blocks in turn, so rows come in
+ *  the order the blocks finish.
+ *
+ *  A failing block is shrunk to a minimal input that fails the same way
+ *  for the same pair: chunks of halving size are cut while the failure
+ *  stays, then bytes are zeroed one at a time. The minimal input and the
+ *  block are written to the -o directory, a few per pair.
+ *
+ *  Usage: comgen_diff [-c codec[:level],...] [-t backend.so[:format]]...
+ *                     [-p CDBI] [-e entropy,...] [-b KiB,...] [-n blocks]
+ *                     [-s salt] [-j threads] [-o out dir]
+ *                     [-- backend arguments]
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "comgen_lib.h"
+#include "comgen_codec.h"
+#include "comgen_fuzz.h"
+
+#define MAX_CODERS	16
+#define MAX_SIZES	16
+#define MAX_STREAMS	256
+#define MAX_THREADS	256
+#define MAX_TRIES	20000    /* Round trips to minimize one input.	*/
+#define PAIR_DUMPS	4        /* Inputs written per pair.		*/
+
+#define ST_OK		0
+#define ST_MISMATCH	1
+#define ST_CERROR	2
+#define ST_DERROR	3
+
+static const char *status_names[] = { "ok", "mismatch", "cerror", "derror" };
+
+/* A reference codec or a backend. */
+struct coder {
+	char name[64];                /* "zstd:3", or the backend's name.	*/
+	const char *format;           /* "zstd", "lz4", "deflate" or NULL.	*/
+	struct codec *codec;          /* The reference codec, or		*/
+	const struct fuzz_target *be; /* the backend.			*/
+	int decoder;                  /* Decompresses in the cross checks.	*/
+};
+
+/* The blocks of one pattern in one block size. */
+struct stream {
+	unsigned int kib;
+	int pattern;
+	char name[32];
+	struct comgen_ctx *ctx;
+};
+
+/* Totals of a compressor (row) and decompressor (column). */
+struct pair_stats {
+	unsigned long long blocks, in, out, failed;
+	double ctime, dtime;
+	unsigned int dumped;
+};
+
+/* Buffers of a thread. */
+struct worker {
+	pthread_t tid;
+	unsigned char *blk, *cand, *trial, *out, *comp, *mcomp;
+};
+
+static struct coder coders[MAX_CODERS];
+static unsigned int ncoders;
+static struct stream streams[MAX_STREAMS];
+static unsigned int nstreams;
+static unsigned long nblocks = 64;
+static unsigned long max_len, max_bound;
+static const char *outdir = "comgen_diff.out";
+static struct pair_stats stats[MAX_CODERS][MAX_CODERS];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long next_item, nfailed;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(unsigned long len)
+{
+	void *p = malloc(len);
+
+	if (p == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static unsigned long coderBound(const struct coder *c, unsigned long len)
+{
+	if (c->codec)
+		return codecBound(c->codec, len);
+	return c->be->bound ? c->be->bound(len) : 2 * len + 1024;
+}
+
+static int canCompress(const struct coder *c)
+{
+	return c->codec != NULL || c->be->compress != NULL;
+}
+
+static long coderCompress(const struct coder *c, const void *src, unsigned long len,
+	void *dst, unsigned long cap)
+{
+	if (c->codec)
+		return codecCompress(c->codec, src, len, dst, cap);
+	return c->be->compress(src, len, dst, cap);
+}
+
+static long coderDecompress(const struct coder *c, const void *src, unsigned long len,
+	void *dst, unsigned long cap)
+{
+	if (c->codec)
+		return codecDecompress(c->codec, src, len, dst, cap);
+	return c->be->decompress(src, len, dst, cap);
+}
+
+/*
+ * Whether b decompresses what a makes: a's own side, or a decoder of the
+ * same format when at least one of them is a backend.
+ */
+static int checks(unsigned int a, unsigned int b)
+{
+	const struct coder *ca = &coders[a], *cb = &coders[b];
+
+	if (!canCompress(ca))
+		return 0;
+	if (a == b)
+		return ca->codec != NULL || ca->be->decompress != NULL;
+	return cb->decoder && ca->format && cb->format && strcmp(ca->format, cb->format) == 0 &&
+		(ca->be != NULL || cb->be != NULL);
+}
+
+/*
+ * Decompress clen bytes of comp with b and compare with the len bytes of
+ * src. There is room for one byte more than len, so output that is too
+ * long shows up as a mismatch.
+ */
+static int decodeCheck(const struct coder *b, const unsigned char *comp, long clen,
+	const unsigned char *src, unsigned long len, unsigned char *out, double *t)
+{
+	double t0 = now();
+	long r;
+
+	r = coderDecompress(b, comp, (unsigned long)clen, out, len + 1);
+	*t = now() - t0;
+	if (r < 0)
+		return ST_DERROR;
+	if ((unsigned long)r != len || memcmp(out, src, len) != 0)
+		return ST_MISMATCH;
+	return ST_OK;
+}
+
+/* One round trip through a and b, for the minimizer. */
+static int roundTrip(struct worker *w, unsigned int a, unsigned int b,
+	const unsigned char *src, unsigned long len)
+{
+	double t;
+	long clen;
+
+	clen = coderCompress(&coders[a], src, len, w->mcomp, max_bound);
+	if (clen < 0)
+		return ST_CERROR;
+	return decodeCheck(&coders[b], w->mcomp, clen, src, len, w->out, &t);
+}
+
+/*
+ * Shrink the len bytes of src, which fail with status st through a and b,
+ * into w->cand. Returns the length of the minimal input.
+ */
+static unsigned long minimize(struct worker *w, unsigned int a, unsigned int b, int st,
+	const unsigned char *src, unsigned long len)
+{
+	unsigned long n = len, chunk, off, k, i, tries = 0;
+	unsigned char save;
+	int cut;
+
+	memcpy(w->cand, src, len);
+	chunk = n / 2;
+	while (chunk > 0 && tries < MAX_TRIES)
+	{
+		cut = 0;
+		for (off = 0; off < n && tries < MAX_TRIES; )
+		{
+			k = off + chunk > n ? n - off : chunk;
+			if (k >= n)
+				break;
+			memcpy(w->trial, w->cand, off);
+			memcpy(w->trial + off, w->cand + off + k, n - off - k);
+			tries++;
+			if (roundTrip(w, a, b, w->trial, n - k) == st)
+			{
+				memcpy(w->cand, w->trial, n - k);
+				n -= k;
+				cut = 1;
+			}
+			else
+				off += k;
+		}
+		if (!cut)
+			chunk /= 2;
+		if (chunk > n / 2)
+			chunk = n / 2;
+	}
+	for (i = 0; i < n && tries < MAX_TRIES; i++)
+	{
+		if (w->cand[i] == 0)
+			continue;
+		save = w->cand[i];
+		w->cand[i] = 0;
+		tries++;
+		if (roundTrip(w, a, b, w->cand, n) != st)
+			w->cand[i] = save;
+	}
+	return n;
+}
+
+static void writeFile(const char *name, const void *buf, unsigned long len)
+{
+	FILE *f = fopen(name, "wb");
+
+	if (f == NULL || fwrite(buf, 1, len, f) != len || fclose(f) != 0)
+	{
+		fprintf(stderr, "Error: could not write %s: %s\n", name, strerror(errno));
+		exit(-3);
+	}
+}
+
+/* A coder name that can go in a file name. */
+static void fileName(char *dst, const char *name)
+{
+	int i;
+
+	for (i = 0; name[i] != '\0' && i < 63; i++)
+		dst[i] = (name[i] == ':' || name[i] == '/' || name[i] == ' ') ? '-' : name[i];
+	dst[i] = '\0';
+}
+
+/* Minimize and write a block that failed with status st through a and b. */
+static void dump(struct worker *w, const struct stream *s, unsigned long blk,
+	unsigned int a, unsigned int b, int st, unsigned long len)
+{
+	char na[64], nb[64], base[512], name[600];
+	unsigned long n;
+	unsigned int id;
+
+	pthread_mutex_lock(&lock);
+	id = stats[a][b].dumped;
+	if (id < PAIR_DUMPS)
+		stats[a][b].dumped++;
+	pthread_mutex_unlock(&lock);
+	if (id >= PAIR_DUMPS)
+		return;
+
+	n = minimize(w, a, b, st, w->blk, len);
+	fileName(na, coders[a].name);
+	fileName(nb, coders[b].name);
+	mkdir(outdir, 0777);
+	snprintf(base, sizeof(base), "%s/%s_%s_%s_%uk_%lu", outdir, na, nb, s->name, s->kib, blk);
+	snprintf(name, sizeof(name), "%s.min", base);
+	writeFile(name, w->cand, n);
+	snprintf(name, sizeof(name), "%s.orig", base);
+	writeFile(name, w->blk, len);
+	fprintf(stderr, "%s %s>%s, %s %uKiB block %lu: minimized %lu to %lu bytes, %s.min\n",
+		status_names[st], coders[a].name, coders[b].name, s->name, s->kib, blk, len, n, base);
+}
+
+/* Run every check of one block, which is in w->blk. */
+static void checkBlock(struct worker *w, const struct stream *s, unsigned long blk, unsigned long len)
+{
+	struct pair_stats *ps;
+	double t0, ct, dt;
+	unsigned int a, b;
+	long clen;
+	int st;
+
+	for (a = 0; a < ncoders; a++)
+	{
+		if (!canCompress(&coders[a]))
+			continue;
+		t0 = now();
+		clen = coderCompress(&coders[a], w->blk, len, w->comp, max_bound);
+		ct = now() - t0;
+		for (b = 0; b < ncoders; b++)
+		{
+			if (!checks(a, b))
+				continue;
+			dt = 0;
+			st = clen < 0 ? ST_CERROR : decodeCheck(&coders[b], w->comp, clen, w->blk, len, w->out, &dt);
+
+			pthread_mutex_lock(&lock);
+			printf("%u,%s,%lu,%s,%s,%lu,%ld,%.4f,%.1f,%.1f,%s\n", s->kib, s->name, blk,
+				coders[a].name, coders[b].name, len, clen,
+				clen > 0 ? (double)len / clen : 0.0,
+				ct > 0 ? len / ct / 1e6 : 0.0, dt > 0 ? len / dt / 1e6 : 0.0,
+				status_names[st]);
+			ps = &stats[a][b];
+			ps->blocks++;
+			ps->in += len;
+			ps->out += clen > 0 ? (unsigned long)clen : 0;
+			ps->ctime += ct;
+			ps->dtime += dt;
+			if (st != ST_OK)
+			{
+				ps->failed++;
+				nfailed++;
+			}
+			pthread_mutex_unlock(&lock);
+
+			if (st != ST_OK)
+				dump(w, s, blk, a, b, st, len);
+		}
+	}
+}
+
+static void *workerThread(void *arg)
+{
+	struct worker *w = arg;
+	struct stream *s;
+	unsigned long long item;
+	unsigned long len;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&lock);
+		item = next_item++;
+		pthread_mutex_unlock(&lock);
+		if (item >= nstreams * (unsigned long long)nblocks)
+			break;
+		s = &streams[item / nblocks];
+		len = s->kib * 1024UL;
+		if (comgen_fill(s->ctx, s->pattern, (unsigned long)(item % nblocks), 0, w->blk, len) != 0)
+		{
+			fprintf(stderr, "Error: could not generate block 0 of file %lu\n", (unsigned long)(item % nblocks));
+			exit(-1);
+		}
+		checkBlock(w, s, (unsigned long)(item % nblocks), len);
+	}
+	return NULL;
+}
+
+static const char *knownFormat(const char *f)
+{
+	static const char *formats[] = { "zstd", "lz4", "deflate" };
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (strcmp(f, formats[i]) == 0)
+			return formats[i];
+	return NULL;
+}
+
+static struct coder *newCoder(void)
+{
+	if (ncoders == MAX_CODERS)
+	{
+		fprintf(stderr, "At most %d codecs and backends.\n", MAX_CODERS);
+		exit(1);
+	}
+	return &coders[ncoders++];
+}
+
+static void addCodec(const char *spec, int must)
+{
+	struct codec *codec = codecOpen(spec);
+	struct coder *c;
+
+	if (codec == NULL)
+	{
+		if (must)
+			exit(1);
+		return;
+	}
+	c = newCoder();
+	c->codec = codec;
+	c->format = codecFormat(codec);
+	snprintf(c->name, sizeof(c->name), "%s", codecName(codec));
+}
+
+/* Load a backend from "file.so[:format]". */
+static void addBackend(char *spec)
+{
+	const struct fuzz_target *be;
+	struct coder *c;
+	char *colon, *slash;
+	void *h;
+
+	colon = strrchr(spec, ':');
+	if (colon != NULL)
+		*colon++ = '\0';
+	if (colon != NULL && knownFormat(colon) == NULL)
+	{
+		fprintf(stderr, "Backend %s: unknown format '%s', use zstd, lz4 or deflate.\n", spec, colon);
+		exit(1);
+	}
+	h = dlopen(spec, RTLD_NOW|RTLD_LOCAL);
+	if (h == NULL || (be = dlsym(h, "comgen_fuzz_target")) == NULL)
+	{
+		fprintf(stderr, "Could not load comgen_fuzz_target from %s: %s\n", spec, dlerror());
+		exit(-2);
+	}
+	if (be->abi != FUZZ_ABI_VERSION || (be->compress == NULL && be->decompress == NULL))
+	{
+		fprintf(stderr, "Backend %s has ABI %d, not %d, or no entry points.\n",
+			spec, be->abi, FUZZ_ABI_VERSION);
+		exit(1);
+	}
+	c = newCoder();
+	c->be = be;
+	c->format = colon ? knownFormat(colon) : NULL;
+	c->decoder = be->decompress != NULL;
+	slash = strrchr(spec, '/');
+	snprintf(c->name, sizeof(c->name), "%s", be->name ? be->name : slash ? slash + 1 : spec);
+}
+
+static void addStream(unsigned int kib, int pattern, double entropy, int salt)
+{
+	static const char *names[] = { "compress", "dedupe", "both", "irreducible" };
+	struct stream *s;
+
+	if (nstreams == MAX_STREAMS)
+		return;
+	s = &streams[nstreams++];
+	s->kib = kib;
+	s->pattern = pattern;
+	s->ctx = comgen_create(salt, kib, 1, nblocks, COMGEN_MASK(pattern));
+	if (s->ctx == NULL || (pattern == COMGEN_ENTROPY && comgen_set_entropy(s->ctx, entropy, 0) != 0))
+	{
+		fprintf(stderr, "Error: could not set up %uKiB blocks of pattern %d\n", kib, pattern);
+		exit(-1);
+	}
+	if (pattern == COMGEN_ENTROPY)
+		snprintf(s->name, sizeof(s->name), "entropy%g", entropy);
+	else
+		snprintf(s->name, sizeof(s->name), "%s", names[pattern]);
+}
+
+static void usage(const char *me)
+{
+	fprintf(stderr, "Usage: %s [-c codec[:level],...] [-t backend.so[:format]]... [-p CDBI]\n"
+		"\t[-e entropy,...] [-b KiB,...] [-n blocks] [-s salt] [-j threads] [-o out dir]\n"
+		"\t[-- backend arguments]\n", me);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int sizes[MAX_SIZES] = { 4, 64 };
+	unsigned int nsizes = 2, nthreads = 0, nentropies = 0, i, a, b;
+	double entropies[MAX_STREAMS];
+	const char *codec_list = "zstd:1,zstd:9,lz4:1,lz4:9,deflate:1,deflate:9", *pats = "CDBI";
+	char *list, *tok, *backends[MAX_CODERS];
+	struct worker *workers;
+	struct pair_stats *ps;
+	unsigned int nbackends = 0, first;
+	int c, salt = 0, given = 0, found;
+	double t0, t;
+	long ncpu;
+
+	while ((c = getopt(argc, argv, "c:t:p:e:b:n:s:j:o:")) != EOF)
+	{
+		switch (c)
+		{
+		case 'c':	/* Reference codecs */
+			codec_list = optarg;
+			given = 1;
+			break;
+		case 't':	/* Backend shared object and format */
+			if (nbackends == MAX_CODERS)
+				usage(argv[0]);
+			backends[nbackends++] = optarg;
+			break;
+		case 'p':	/* Patterns, as comgen -C -D -B -I */
+			pats = optarg;
+			break;
+		case 'e':	/* Entropies of -E streams */
+			list = strdup(optarg);
+			for (tok = strtok(list, ","); tok != NULL && nentropies < MAX_STREAMS; tok = strtok(NULL, ","))
+				entropies[nentropies++] = strtod(tok, NULL);
+			free(list);
+			break;
+		case 'b':	/* Block sizes in KiB */
+			nsizes = 0;
+			list = strdup(optarg);
+			for (tok = strtok(list, ","); tok != NULL && nsizes < MAX_SIZES; tok = strtok(NULL, ","))
+				if ((sizes[nsizes] = (unsigned int)strtol(tok, NULL, 10)) > 0)
+					nsizes++;
+			free(list);
+			if (nsizes == 0)
+				usage(argv[0]);
+			break;
+		case 'n':	/* Blocks per stream */
+			nblocks = strtoul(optarg, NULL, 10);
+			if (nblocks == 0)
+				usage(argv[0]);
+			break;
+		case 's':	/* Salt */
+			salt = (int)strtol(optarg, NULL, 10);
+			break;
+		case 'j':	/* Threads */
+			nthreads = (unsigned int)strtol(optarg, NULL, 10);
+			break;
+		case 'o':	/* Directory of failing inputs */
+			outdir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	list = strdup(codec_list);
+	for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ","))
+		addCodec(tok, given);
+	free(list);
+	first = ncoders;
+	for (i = 0; i < nbackends; i++)
+		addBackend(backends[i]);
+
+	/* The first reference codec of a format decodes for the backends. */
+	for (i = 0; i < nbackends; i++)
+	{
+		a = first + i;
+		if (coders[a].format == NULL)
+			continue;
+		found = 0;
+		for (b = 0; b < ncoders; b++)
+			if (coders[b].codec && strcmp(coders[b].format, coders[a].format) == 0)
+				found = 1;
+		if (!found)
+			addCodec(coders[a].format, 0);
+	}
+	for (a = 0; a < ncoders; a++)
+	{
+		if (coders[a].codec == NULL)
+			continue;
+		found = 0;
+		for (b = 0; b < a; b++)
+			if (coders[b].codec && strcmp(coders[b].format, coders[a].format) == 0)
+				found = 1;
+		coders[a].decoder = !found;
+	}
+	if (ncoders == 0)
+	{
+		fprintf(stderr, "No codec or backend to test.\n");
+		exit(1);
+	}
+	for (a = 0; a < ncoders; a++)
+		if (coders[a].be && coders[a].be->init && coders[a].be->init(argc - optind, argv + optind) != 0)
+		{
+			fprintf(stderr, "Backend %s failed to initialize.\n", coders[a].name);
+			exit(1);
+		}
+
+	for (i = 0; i < nsizes; i++)
+	{
+		for (tok = (char *)pats; *tok != '\0'; tok++)
+		{
+			switch (*tok)
+			{
+			case 'C': addStream(sizes[i], COMGEN_COMPRESS, 0, salt); break;
+			case 'D': addStream(sizes[i], COMGEN_DEDUPE, 0, salt); break;
+			case 'B': addStream(sizes[i], COMGEN_BOTH, 0, salt); break;
+			case 'I': addStream(sizes[i], COMGEN_IRREDUCIBLE, 0, salt); break;
+			default: usage(argv[0]);
+			}
+		}
+		for (a = 0; a < nentropies; a++)
+			addStream(sizes[i], COMGEN_ENTROPY, entropies[a], salt);
+		if (sizes[i] * 1024UL > max_len)
+			max_len = sizes[i] * 1024UL;
+	}
+	if (nstreams == 0)
+		usage(argv[0]);
+	for (a = 0; a < ncoders; a++)
+		if (coderBound(&coders[a], max_len) > max_bound)
+			max_bound = coderBound(&coders[a], max_len);
+
+	if (nthreads == 0)
+	{
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = ncpu > 0 ? (unsigned int)ncpu : 1;
+	}
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+
+	fprintf(stderr, "Checking %lu blocks of %u streams with %u threads:", nblocks, nstreams, nthreads);
+	for (a = 0; a < ncoders; a++)
+		fprintf(stderr, " %s%s%s", coders[a].name, coders[a].be && coders[a].format ? ":" : "",
+			coders[a].be && coders[a].format ? coders[a].format : "");
+	fprintf(stderr, "\n");
+	printf("kib,pattern,block,compressor,decompressor,in,out,ratio,c_mbps,d_mbps,status\n");
+
+	workers = xmalloc(nthreads * sizeof(*workers));
+	t0 = now();
+	for (i = 0; i < nthreads; i++)
+	{
+		workers[i].blk = xmalloc(max_len);
+		workers[i].cand = xmalloc(max_len);
+		workers[i].trial = xmalloc(max_len);
+		workers[i].out = xmalloc(max_len + 1);
+		workers[i].comp = xmalloc(max_bound);
+		workers[i].mcomp = xmalloc(max_bound);
+		if (pthread_create(&workers[i].tid, NULL, workerThread, &workers[i]) != 0)
+		{
+			fprintf(stderr, "Error: could not create thread\n");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(workers[i].tid, NULL);
+	t = now() - t0;
+	fflush(stdout);
+
+	fprintf(stderr, "%-24s %-24s %8s %8s %9s %9s %7s\n",
+		"compressor", "decompressor", "blocks", "ratio", "c_MB/s", "d_MB/s", "failed");
+	for (a = 0; a < ncoders; a++)
+		for (b = 0; b < ncoders; b++)
+		{
+			ps = &stats[a][b];
+			if (ps->blocks == 0)
+				continue;
+			fprintf(stderr, "%-24s %-24s %8llu %8.3f %9.1f %9.1f %7llu\n",
+				coders[a].name, coders[b].name, ps->blocks,
+				ps->out ? (double)ps->in / ps->out : 0.0,
+				ps->ctime > 0 ? ps->in / ps->ctime / 1e6 : 0.0,
+				ps->dtime > 0 ? ps->in / ps->dtime / 1e6 : 0.0, ps->failed);
+		}
+	fprintf(stderr, "%llu checks failed, %.1f seconds\n", nfailed, t);
+
+	for (i = 0; i < nstreams; i++)
+		comgen_destroy(streams[i].ctx);
+	for (a = 0; a < ncoders; a++)
+		if (coders[a].codec)
+			codecClose(coders[a].codec);
+	return nfailed ? 2 : 0;
+}
@@ -0,0 +1,286 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_entropy.c
+ *
+ *  Entropy targeted block generator, the native counterpart of
+ *  gen_ent_seq() in entSeqEngine.py.
+ *
+ *  Like the Python generator, a block is a run of one dominant byte plus
+ *  bytes spread over the other 255 values, cut into chunks of 3 to 8 bytes
+ *  that are shuffled. Instead of measuring the entropy of trial sequences,
+ *  the byte histogram is chosen up front: for n1 copies of the dominant
+ *  byte and the remainder spread as evenly as possible, the entropy falls
+ *  as n1 grows, so the n1 closest to the target is found with a binary
+ *  search over 256-entry histograms. Every block then has exactly these
+ *  counts, and only their order depends on the random number stream, so
+ *  the entropy of each block is known before it is written.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if defined(WIN32)
+#pragma warning(disable:4996)
+#pragma warning(disable:4267)
+#pragma warning(disable:4244)
+#pragma warning(disable:4018)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "comgen_fill.h"
+#include "comgen_entropy.h"
+
+/*
+ * Entropy, in bits per byte, of a histogram over n bytes.
+ */
+double entropyOfCounts(const unsigned long *count, unsigned long n)
+{
+	double e = 0, p;
+	int i;
+
+	if (n == 0)
+		return 0;
+	for (i = 0; i < 256; i++)
+	{
+		if (count[i] == 0)
+			continue;
+		p = (double)count[i] / n;
+		e -= p * log(p);
+	}
+	return e / log(2.0);
+}
+
+/* log2() is not in older Visual Studio C libraries. */
+#define LOG2(x)	(log(x) * 1.4426950408889634)
+
+/* c * log2(c), with 0 * log2(0) = 0. */
+static double clog2c(unsigned long c)
+{
+	return c ? c * LOG2((double)c) : 0;
+}
+
+/*
+ * Start a tracker from a histogram, or empty when count is NULL.
+ */
+void entropyTrackerInit(struct entropy_tracker *t, const unsigned long *count)
+{
+	int i;
+
+	memset(t, 0, sizeof(*t));
+	if (count == NULL)
+		return;
+	for (i = 0; i < 256; i++)
+	{
+		t->count[i] = count[i];
+		t->n += count[i];
+		t->sum += clog2c(count[i]);
+	}
+}
+
+/*
+ * Add k copies of byte b.
+ */
+void entropyTrackerAdd(struct entropy_tracker *t, unsigned int b, unsigned long k)
+{
+	unsigned long c = t->count[b & 255];
+
+	t->sum += clog2c(c + k) - clog2c(c);
+	t->count[b & 255] = c + k;
+	t->n += k;
+}
+
+/*
+ * Remove k copies of byte b; there must be at least k of them.
+ */
+void entropyTrackerRemove(struct entropy_tracker *t, unsigned int b, unsigned long k)
+{
+	unsigned long c = t->count[b & 255];
+
+	t->sum += clog2c(c - k) - clog2c(c);
+	t->count[b & 255] = c - k;
+	t->n -= k;
+}
+
+/*
+ * Entropy in bits per byte: log2(n) - sum(c * log2(c)) / n.
+ */
+double entropyTrackerValue(const struct entropy_tracker *t)
+{
+	double e;
+
+	if (t->n == 0)
+		return 0;
+	e = LOG2((double)t->n) - t->sum / t->n;
+	return e < 0 ? 0 : e;
+}
+
+/*
+ * Histogram with n1 dominant bytes and the rest spread evenly over up to
+ * 255 other values.
+ */
+static void planCounts(unsigned long *count, unsigned long n, unsigned long n1)
+{
+	unsigned long rest, m, i;
+
+	memset(count, 0, 256 * sizeof(count[0]));
+	count[0] = n1;
+	rest = n - n1;
+	m = rest < 255 ? rest : 255;
+	for (i = 1; i <= m; i++)
+		count[i] = rest / m + ((i - 1) < rest % m ? 1 : 0);
+}
+
+/*
+ * Build the plan for n byte blocks with the given entropy. Returns 0 when
+ * the achieved entropy is within 0.01 of the target, -1 when the block is
+ * too short to get that close (the plan then holds the closest histogram).
+ */
+int entropyPlan(struct entropy_plan *p, unsigned long n, double target)
+{
+	struct entropy_tracker t;
+	unsigned long lo, hi, mid, n1, first, best, rest;
+	double e, err, best_err;
+
+	memset(p, 0, sizeof(*p));
+	p->n = n;
+	p->target = target;
+	/* Same choice of dominant byte as entSeqEngine.py. */
+	p->zero_dominant = (target <= 2);
+	if (n == 0)
+		return 0;
+
+	/* Entropy falls as n1 goes from an even spread (n / 256) to n. */
+	lo = (n + 255) / 256;
+	hi = n;
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		planCounts(p->count, n, mid);
+		if (entropyOfCounts(p->count, n) > target)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/*
+	 * Rounding of the even spread makes it only nearly monotone, so scan
+	 * around lo. Going from n1 to n1 + 1 moves one byte from the last
+	 * rounded up bucket of the spread to the dominant one.
+	 */
+	first = (lo > 16 ? lo - 16 : 0);
+	if (first < (n + 255) / 256)
+		first = (n + 255) / 256;
+	planCounts(p->count, n, first);
+	entropyTrackerInit(&t, p->count);
+	best = first;
+	best_err = -1;
+	for (n1 = first; n1 <= lo + 16 && n1 <= n; n1++)
+	{
+		if (n1 > first)
+		{
+			rest = n - (n1 - 1);
+			entropyTrackerRemove(&t, (unsigned int)((rest - 1) % (rest < 255 ? rest : 255) + 1), 1);
+			entropyTrackerAdd(&t, 0, 1);
+		}
+		err = fabs(entropyTrackerValue(&t) - target);
+		if (best_err < 0 || err < best_err)
+		{
+			best = n1;
+			best_err = err;
+		}
+	}
+	planCounts(p->count, n, best);
+	e = entropyOfCounts(p->count, n);
+	p->achieved = e;
+	return (fabs(e - target) <= 0.01) ? 0 : -1;
+}
+
+/*
+ * xorshift64* stream for the shuffles, seeded from the block's Park &
+ * Miller state. Much cheaper per byte than the Park & Miller generator.
+ */
+static unsigned long long xsNext(unsigned long long *s)
+{
+	unsigned long long x = *s;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*s = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Uniform value in [0, range). */
+static unsigned long xsBelow(unsigned long long *s, unsigned long range)
+{
+	return (unsigned long)(((xsNext(s) >> 32) * (unsigned long long)range) >> 32);
+}
+
+/*
+ * Fill one block of p->n bytes. seed is the block's generator state, as
+ * for fillBlock_r(); the block consumes one Park & Miller number.
+ */
+void entropyFill(const struct entropy_plan *p, void *memarea, int seed)
+{
+	unsigned char *buf = memarea;
+	unsigned char map[256], t;
+	unsigned char tmp[8];
+	unsigned long long s;
+	unsigned long i, j, pos, rest, csz, nch;
+	unsigned int d, rot;
+
+	seed = _park_miller_next(seed);
+	/* splitmix64 finalizer spreads the 31 bit state over 64 bits. */
+	s = (unsigned long long)seed + 0x9E3779B97F4A7C15ULL;
+	s = (s ^ (s >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	s = (s ^ (s >> 27)) * 0x94D049BB133111EBULL;
+	s ^= s >> 31;
+	if (s == 0)
+		s = 1;
+
+	/* Byte value of every histogram entry. */
+	d = p->zero_dominant ? 0 : (unsigned int)xsBelow(&s, 256);
+	rot = (unsigned int)xsBelow(&s, 255);
+	map[0] = (unsigned char)d;
+	for (i = 1; i < 256; i++)
+		map[i] = (unsigned char)((d + 1 + (i - 1 + rot) % 255) & 255);
+
+	/* The non-dominant bytes, shuffled, followed by the dominant run. */
+	pos = 0;
+	for (i = 1; i < 256; i++)
+	{
+		memset(buf + pos, map[i], p->count[i]);
+		pos += p->count[i];
+	}
+	rest = pos;
+	for (i = rest; i > 1; i--)
+	{
+		j = xsBelow(&s, i);
+		t = buf[i - 1];
+		buf[i - 1] = buf[j];
+		buf[j] = t;
+	}
+	memset(buf + rest, map[0], p->count[0]);
+
+	/* Shuffle whole chunks so that parts of the run stay together. */
+	csz = 3 + xsBelow(&s, 6);
+	if (p->chunk)
+		csz = p->chunk;
+	nch = p->n / csz;
+	for (i = nch; i > 1; i--)
+	{
+		j = xsBelow(&s, i);
+		if (j == i - 1)
+			continue;
+		memcpy(tmp, buf + (i - 1) * csz, csz);
+		memcpy(buf + (i - 1) * csz, buf + j * csz, csz);
+		memcpy(buf + j * csz, tmp, csz);
+	}
+}
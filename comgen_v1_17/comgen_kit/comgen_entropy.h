@@ -0,0 +1,41 @@
+/*
+ * comgen_entropy.h
+ *
+ * Entropy targeted block generator. A plan holds the byte histogram whose
+ * Shannon entropy is closest to the target for a given block length; every
+ * block generated from the plan has exactly those counts.
+ */
+#ifndef __COMGEN_ENTROPY_H__
+#define __COMGEN_ENTROPY_H__
+
+#define ENTROPY_MAX	8.0	/* bits per byte */
+
+struct entropy_plan {
+	unsigned long n;         /* Block length in bytes.			*/
+	double target;           /* Requested entropy, bits per byte.		*/
+	double achieved;         /* Entropy of count[].				*/
+	int zero_dominant;       /* Dominant symbol is 0 rather than random.	*/
+	unsigned int chunk;      /* Shuffled chunk size, 0 = random 3 to 8.	*/
+	unsigned long count[256];/* count[0] is the dominant symbol, 1..255	*/
+	                         /* are spread over the other byte values.	*/
+};
+
+/*
+ * Byte histogram whose entropy is kept up to date as bytes are added and
+ * removed, in O(1) per update: sum holds the running sum of c * log2(c).
+ */
+struct entropy_tracker {
+	unsigned long n;         /* Bytes counted.				*/
+	double sum;              /* Sum over count[] of c * log2(c).		*/
+	unsigned long count[256];
+};
+
+double entropyOfCounts(const unsigned long *, unsigned long);
+void entropyTrackerInit(struct entropy_tracker *, const unsigned long *);
+void entropyTrackerAdd(struct entropy_tracker *, unsigned int, unsigned long);
+void entropyTrackerRemove(struct entropy_tracker *, unsigned int, unsigned long);
+double entropyTrackerValue(const struct entropy_tracker *);
+int entropyPlan(struct entropy_plan *, unsigned long, double);
+void entropyFill(const struct entropy_plan *, void *, int);
+
+#endif
@@ -0,0 +1,645 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_fill.c
+ *
+ *  Park & Miller random number generator and the block fill kernels.
+ *
+ *  fillBlock() and fillBlock2() come in a scalar version, which is the
+ *  reference, and SSE2, AVX2 and AVX-512 versions that produce exactly the
+ *  same bytes. The kernel is picked at run time from what the CPU supports.
+ *
+ *  The vector kernels rely on two observations:
+ *
+ *   - fillBlock2() stores consecutive generator outputs. Output i+L is
+ *     output i times A^L mod M, so L lanes can step independently with
+ *     one multiplier. Since M = 2^31-1, the reduction of the 62 bit
+ *     product is two shift/add folds and one conditional subtract.
+ *
+ *   - fillBlock() stores, within one granule, the granule's random value
+ *     plus the number of DENSITY boundaries passed so far. That offset
+ *     depends only on the position within the granule and on the phase of
+ *     the granule start modulo DENSITY, so it is precomputed into a table.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if defined(WIN32)
+#pragma warning(disable:4996)
+#pragma warning(disable:4267)
+#pragma warning(disable:4244)
+#pragma warning(disable:4018)
+
+#include <win32_sub.h>
+#define int32_t int
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(WIN32)
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#endif
+
+#include "comgen_fill.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILL_X86
+#include <immintrin.h>
+#endif
+
+#define CALLOC(typ, n)  (typ*)(calloc((n), sizeof(typ)))
+
+static void fillBlock_scalar(unsigned int, void *, unsigned int, int *);
+static void fillBlock2_scalar(unsigned int, void *, unsigned int, int *);
+
+/* Kernels in use, scalar until fillSelectKernel() is called. */
+static void (*fillBlock_kernel)(unsigned int, void *, unsigned int, int *) = fillBlock_scalar;
+static void (*fillBlock2_kernel)(unsigned int, void *, unsigned int, int *) = fillBlock2_scalar;
+static const char *fill_kernel = "scalar";
+static int fill_selected;	/* Set by fillSelectKernel().		*/
+
+const char *fill_kernel_names[] = { "scalar", "sse2", "avx2", "avx512", NULL };
+
+/*
+ * Per granule offset table for fillBlock(). Row p holds, for a granule
+ * starting at a word index i with i % DENSITY == p, the value added to
+ * the granule's random number at each word of the granule.
+ */
+static unsigned int *gran_table;
+static unsigned int gran_gransz;  /* gransz the table was built for.	*/
+static unsigned long gran_step;   /* Words per granule.			*/
+
+/*
+ * Words between granule boundaries; word i starts a granule when
+ * (i * 4) % gransz == 0.
+ */
+static unsigned long granuleStep(unsigned int gransz)
+{
+	unsigned long a, b, t;
+
+	a = gransz;
+	b = sizeof(unsigned int);
+	while (b)
+	{
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return gransz / a;
+}
+
+static void buildGranuleTable(unsigned int gransz)
+{
+	unsigned long p, k;
+	unsigned int density;
+
+#if defined(USE_DENSITY)
+	density = DENSITY;
+#else
+	density = 1;
+#endif
+	free(gran_table);
+	gran_step = granuleStep(gransz);
+	gran_table = CALLOC(unsigned int, density * gran_step);
+	if (gran_table == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (p = 0; p < density; p++)
+		for (k = 0; k < gran_step; k++)
+			gran_table[p * gran_step + k] = (unsigned int)((p + k) / density);
+	gran_gransz = gransz;
+}
+
+/*
+ * Row of gran_table for a granule starting at word i.
+ */
+static const unsigned int *granuleRow(unsigned long i)
+{
+#if defined(USE_DENSITY)
+	return gran_table + (i % DENSITY) * gran_step;
+#else
+	return gran_table;
+#endif
+}
+
+/*
+ * The vector kernels need the generator state inside [1, M-1]. Anything
+ * else is left to the scalar code, which handles it the way Schrage does.
+ */
+static int seedInRange(int seed)
+{
+	return seed > 0 && seed < _PARK_M_MODULUS;
+}
+
+/*
+ * One step of the generator, without touching any global state.
+ */
+int
+_park_miller_next(int seed)
+{
+    	int32_t	lo;
+    	int32_t	hi;
+    	int32_t	test;
+
+    	hi = seed / _PARK_Q_QUOTIENT;
+    	lo = seed % _PARK_Q_QUOTIENT;
+    	test = _PARK_A_MULTIPLIER * lo - _PARK_R_REMAINDER * hi;
+    	if (test > 0)
+	{
+		return(test);
+    	}
+	return(test + _PARK_M_MODULUS);
+}
+
+/*
+ * Advance the generator state by n steps in O(log n), using
+ * seed * A^n mod M. Matches n calls of _park_miller_next() exactly.
+ */
+int
+_park_miller_skip(int seed, unsigned long long n)
+{
+	unsigned long long r = 1;
+	unsigned long long b = _PARK_A_MULTIPLIER;
+
+	if (n == 0)
+		return(seed);
+	/* Bring a seed outside of [1, M-1] into range the way Schrage does. */
+	if (!seedInRange(seed))
+	{
+		seed = _park_miller_next(seed);
+		n--;
+		if (seed == _PARK_M_MODULUS)
+			return(seed);   /* Fixed point of the generator. */
+	}
+	while (n)
+	{
+		if (n & 1)
+			r = (r * b) % _PARK_M_MODULUS;
+		b = (b * b) % _PARK_M_MODULUS;
+		n >>= 1;
+	}
+	return((int)(((unsigned long long)seed * r) % _PARK_M_MODULUS));
+}
+
+/*
+ * Used to create buffers that are compressible, but not dedupable.
+ * The input parameters to this function:
+ *
+ *  bls  	..	Block size in kbyte units.
+ *  memarea 	..	Location where to put the data
+ *  gransz	..	size in bytes of the minimum granule to enable dedupe
+ *  seedp	..	generator state, updated on return
+ */
+void fillBlock_r(unsigned int bls, void *memarea, unsigned int gransz, int *seedp)
+{
+	fillBlock_kernel(bls, memarea, gransz, seedp);
+}
+
+/*
+ * Used to create buffer that is non-compressible, but may be used for dedupe.
+ * Parameters are the same as for fillBlock_r().
+ */
+void fillBlock2_r(unsigned int bls, void *memarea, unsigned int gransz, int *seedp)
+{
+	fillBlock2_kernel(bls, memarea, gransz, seedp);
+}
+
+/*
+ * Reference version of fillBlock_r().
+ */
+static void fillBlock_scalar(unsigned int bls, void *memarea, unsigned int gransz, int *seedp)
+{
+	unsigned int totBytes;   /* Total size of the block in bytes.		*/
+	unsigned limitloop;      /* Total number of loops to fill the block.	*/
+	unsigned int i;          /* traditional loop control			*/
+	unsigned int *placeData; /* pointer to fill data in the reserved mem area. */
+	unsigned int dat_in;     /* used to fill the buffer. 			*/
+	int seed;                /* local copy of the generator state.		*/
+
+	placeData = memarea;
+	seed = *seedp;
+	/* Get random number and start filling the data. */
+	seed = _park_miller_next(seed);
+	dat_in = (unsigned int)seed;
+	totBytes = bls * 1024;
+	limitloop = totBytes / sizeof(totBytes);
+	for (i = 0; i < limitloop; i++)
+	{
+
+#if defined(USE_DENSITY)
+		if((i % DENSITY) == 0)
+			dat_in++;
+#else
+		dat_in++;
+#endif
+
+		/* switch to new random number at granule boundary */
+		if( (( i * sizeof(dat_in)) % gransz) == 0)
+		{
+		  seed = _park_miller_next(seed);
+		  dat_in = (unsigned int) seed;
+		}
+		/*placeData[i] = dat_in;*/
+
+		/*
+		 * We need to convert to Network neutral format, or there will be
+ 	 	 * different compression for Big and Little Endians.
+		 */
+		placeData[i]=htonl(dat_in); /* Convert to one neutral format */
+	}
+	*seedp = seed;
+	return; /* exit after filling the block. */
+}
+
+/*
+ * Reference version of fillBlock2_r().
+ */
+static void fillBlock2_scalar(unsigned int bls, void *memarea, unsigned int gransz, int *seedp)
+{
+	unsigned int totBytes;   /* Total size of the block in bytes.	*/
+	unsigned limitloop;      /* Total number of loops to fill the block.*/
+	unsigned int i;          /* traditional loop control.		*/
+	unsigned int *placeData; /* pointer to fill data 		*/
+	int seed;                /* local copy of the generator state.	*/
+
+	placeData = memarea;
+	seed = *seedp;
+	/* Get the random number and start filling the data. */
+	seed = _park_miller_next(seed);
+	totBytes = bls * 1024;
+	limitloop = totBytes / sizeof(totBytes);
+	for (i = 0; i < limitloop; i++)
+	{
+		seed = _park_miller_next(seed);
+		placeData[i] = (unsigned int)seed;
+	}
+	*seedp = seed;
+	return; /* Exit after filling the buffer. */
+}
+
+/*
+ * Number of random numbers that fillBlock() consumes for one block.
+ * One for the initial value, plus one at every granule boundary.
+ */
+unsigned long fillBlockDraws(unsigned int bls, unsigned int gransz)
+{
+	unsigned long limitloop, step;
+
+	limitloop = ((unsigned long)bls * 1024) / sizeof(unsigned int);
+	step = granuleStep(gransz);
+	return 1 + (limitloop + step - 1) / step;
+}
+
+/*
+ * Number of random numbers that fillBlock2() consumes for one block.
+ */
+unsigned long fillBlock2Draws(unsigned int bls, unsigned int gransz)
+{
+	return 1 + ((unsigned long)bls * 1024) / sizeof(unsigned int);
+}
+
+#if defined(FILL_X86)
+
+/*
+ * The vector kernels are written once as a macro over a small set of
+ * per instruction set primitives:
+ *
+ *   VEC             vector type
+ *   W               32 bit lanes per vector
+ *   SET1(x)         broadcast a 32 bit value
+ *   LOAD/STORE      unaligned load and store
+ *   MULMOD(v, c)    v * c mod M per 32 bit lane, v and c in [1, M-1]
+ *   BSWAP(v)        byte swap every 32 bit lane (htonl on x86)
+ *
+ * fillBlock2 keeps two vectors in flight to hide the multiply latency.
+ */
+#define FILL_KERNELS(ISA, TARGET)						\
+__attribute__((target(TARGET)))						\
+static void fillBlock_##ISA(unsigned int bls, void *memarea,		\
+	unsigned int gransz, int *seedp)					\
+{									\
+	unsigned int *out = memarea;						\
+	unsigned long n, i, k, len;						\
+	const unsigned int *row;						\
+	int seed = *seedp;							\
+	VEC v;									\
+									\
+	if (gransz != gran_gransz)						\
+	{									\
+		fillBlock_scalar(bls, memarea, gransz, seedp);			\
+		return;								\
+	}									\
+	n = ((unsigned long)bls * 1024) / sizeof(unsigned int);		\
+	seed = _park_miller_next(seed);  /* replaced at word 0 */		\
+	for (i = 0; i < n; i += gran_step)					\
+	{									\
+		seed = _park_miller_next(seed);					\
+		row = granuleRow(i);						\
+		len = (n - i < gran_step) ? n - i : gran_step;			\
+		v = SET1((int)seed);						\
+		for (k = 0; k + W <= len; k += W)				\
+			STORE(out + i + k, BSWAP(ADD32(v, LOAD(row + k))));	\
+		for (; k < len; k++)						\
+			out[i + k] = htonl((unsigned int)seed + row[k]);	\
+	}									\
+	*seedp = seed;								\
+}									\
+									\
+__attribute__((target(TARGET)))						\
+static void fillBlock2_##ISA(unsigned int bls, void *memarea,		\
+	unsigned int gransz, int *seedp)					\
+{									\
+	unsigned int *out = memarea;						\
+	unsigned int first[2 * W];						\
+	unsigned long n, i;							\
+	unsigned long long c;							\
+	int seed = *seedp;							\
+	VEC v0, v1, vc;								\
+									\
+	n = ((unsigned long)bls * 1024) / sizeof(unsigned int);		\
+	if (!seedInRange(seed) || n < 2 * W)					\
+	{									\
+		fillBlock2_scalar(bls, memarea, gransz, seedp);			\
+		return;								\
+	}									\
+	seed = _park_miller_next(seed);  /* initial value, not stored */	\
+	for (i = 0; i < 2 * W; i++)						\
+	{									\
+		seed = _park_miller_next(seed);					\
+		first[i] = (unsigned int)seed;					\
+	}									\
+	c = _park_miller_skip(1, 2 * W);  /* A^(2W) mod M */			\
+	vc = SET1((int)c);							\
+	v0 = LOAD(first);							\
+	v1 = LOAD(first + W);							\
+	STORE(out, v0);								\
+	STORE(out + W, v1);							\
+	for (i = 2 * W; i + 2 * W <= n; i += 2 * W)				\
+	{									\
+		v0 = MULMOD(v0, vc);						\
+		v1 = MULMOD(v1, vc);						\
+		STORE(out + i, v0);						\
+		STORE(out + i + W, v1);						\
+	}									\
+	seed = (int)out[i - 1];							\
+	for (; i < n; i++)							\
+	{									\
+		seed = _park_miller_next(seed);					\
+		out[i] = (unsigned int)seed;					\
+	}									\
+	*seedp = seed;								\
+}
+
+/*
+ * Reduction of the 62 bit products held in 64 bit lanes: two folds of
+ * (p & M) + (p >> 31) leave a value in [0, M+1] that is congruent to the
+ * result. The caller removes the final extra M.
+ */
+
+/* ---- SSE2 */
+#define VEC		__m128i
+#define W		4
+#define SET1(x)		_mm_set1_epi32(x)
+#define LOAD(p)		_mm_loadu_si128((const __m128i *)(p))
+#define STORE(p, v)	_mm_storeu_si128((__m128i *)(p), (v))
+#define ADD32(a, b)	_mm_add_epi32((a), (b))
+#define BSWAP(v)	bswap_sse2(v)
+#define MULMOD(v, c)	mulmod_sse2((v), (c))
+
+__attribute__((target("sse2")))
+static inline __m128i bswap_sse2(__m128i x)
+{
+	__m128i lo = _mm_set1_epi32(0x0000FF00);
+	__m128i hi = _mm_set1_epi32(0x00FF0000);
+
+	return _mm_or_si128(
+		_mm_or_si128(_mm_slli_epi32(x, 24), _mm_srli_epi32(x, 24)),
+		_mm_or_si128(_mm_and_si128(_mm_slli_epi32(x, 8), hi),
+			_mm_and_si128(_mm_srli_epi32(x, 8), lo)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i mulmod_sse2(__m128i v, __m128i c)
+{
+	__m128i m64 = _mm_set1_epi64x(_PARK_M_MODULUS);
+	__m128i m32 = _mm_set1_epi32(_PARK_M_MODULUS);
+	__m128i pe, po, r, t, neg;
+
+	pe = _mm_mul_epu32(v, c);
+	po = _mm_mul_epu32(_mm_srli_epi64(v, 32), c);
+	pe = _mm_add_epi64(_mm_and_si128(pe, m64), _mm_srli_epi64(pe, 31));
+	po = _mm_add_epi64(_mm_and_si128(po, m64), _mm_srli_epi64(po, 31));
+	pe = _mm_add_epi64(_mm_and_si128(pe, m64), _mm_srli_epi64(pe, 31));
+	po = _mm_add_epi64(_mm_and_si128(po, m64), _mm_srli_epi64(po, 31));
+	r = _mm_or_si128(pe, _mm_slli_epi64(po, 32));
+	/* r - M is negative exactly when r is already reduced. */
+	t = _mm_sub_epi32(r, m32);
+	neg = _mm_srai_epi32(t, 31);
+	return _mm_or_si128(_mm_and_si128(neg, r), _mm_andnot_si128(neg, t));
+}
+
+FILL_KERNELS(sse2, "sse2")
+
+#undef VEC
+#undef W
+#undef SET1
+#undef LOAD
+#undef STORE
+#undef ADD32
+#undef BSWAP
+#undef MULMOD
+
+/* ---- AVX2 */
+#define VEC		__m256i
+#define W		8
+#define SET1(x)		_mm256_set1_epi32(x)
+#define LOAD(p)		_mm256_loadu_si256((const __m256i *)(p))
+#define STORE(p, v)	_mm256_storeu_si256((__m256i *)(p), (v))
+#define ADD32(a, b)	_mm256_add_epi32((a), (b))
+#define BSWAP(v)	_mm256_shuffle_epi8((v), _mm256_setr_epi8(		\
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,	\
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12))
+#define MULMOD(v, c)	mulmod_avx2((v), (c))
+
+__attribute__((target("avx2")))
+static inline __m256i mulmod_avx2(__m256i v, __m256i c)
+{
+	__m256i m64 = _mm256_set1_epi64x(_PARK_M_MODULUS);
+	__m256i m32 = _mm256_set1_epi32(_PARK_M_MODULUS);
+	__m256i pe, po, r;
+
+	pe = _mm256_mul_epu32(v, c);
+	po = _mm256_mul_epu32(_mm256_srli_epi64(v, 32), c);
+	pe = _mm256_add_epi64(_mm256_and_si256(pe, m64), _mm256_srli_epi64(pe, 31));
+	po = _mm256_add_epi64(_mm256_and_si256(po, m64), _mm256_srli_epi64(po, 31));
+	pe = _mm256_add_epi64(_mm256_and_si256(pe, m64), _mm256_srli_epi64(pe, 31));
+	po = _mm256_add_epi64(_mm256_and_si256(po, m64), _mm256_srli_epi64(po, 31));
+	r = _mm256_or_si256(pe, _mm256_slli_epi64(po, 32));
+	/* r - M wraps to a larger value unless r >= M. */
+	return _mm256_min_epu32(r, _mm256_sub_epi32(r, m32));
+}
+
+FILL_KERNELS(avx2, "avx2")
+
+#undef VEC
+#undef W
+#undef SET1
+#undef LOAD
+#undef STORE
+#undef ADD32
+#undef BSWAP
+#undef MULMOD
+
+/* ---- AVX-512 (foundation instructions only) */
+#define VEC		__m512i
+#define W		16
+#define SET1(x)		_mm512_set1_epi32(x)
+#define LOAD(p)		_mm512_loadu_si512((const void *)(p))
+#define STORE(p, v)	_mm512_storeu_si512((void *)(p), (v))
+#define ADD32(a, b)	_mm512_add_epi32((a), (b))
+#define BSWAP(v)	bswap_avx512(v)
+#define MULMOD(v, c)	mulmod_avx512((v), (c))
+
+__attribute__((target("avx512f")))
+static inline __m512i bswap_avx512(__m512i x)
+{
+	/* Byte shuffles need AVX512BW; two rotates do it with AVX512F. */
+	return _mm512_or_si512(
+		_mm512_and_si512(_mm512_rol_epi32(x, 8), _mm512_set1_epi32(0x00FF00FF)),
+		_mm512_and_si512(_mm512_ror_epi32(x, 8), _mm512_set1_epi32((int)0xFF00FF00)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i mulmod_avx512(__m512i v, __m512i c)
+{
+	__m512i m64 = _mm512_set1_epi64(_PARK_M_MODULUS);
+	__m512i m32 = _mm512_set1_epi32(_PARK_M_MODULUS);
+	__m512i pe, po, r;
+
+	pe = _mm512_mul_epu32(v, c);
+	po = _mm512_mul_epu32(_mm512_srli_epi64(v, 32), c);
+	pe = _mm512_add_epi64(_mm512_and_si512(pe, m64), _mm512_srli_epi64(pe, 31));
+	po = _mm512_add_epi64(_mm512_and_si512(po, m64), _mm512_srli_epi64(po, 31));
+	pe = _mm512_add_epi64(_mm512_and_si512(pe, m64), _mm512_srli_epi64(pe, 31));
+	po = _mm512_add_epi64(_mm512_and_si512(po, m64), _mm512_srli_epi64(po, 31));
+	r = _mm512_or_si512(pe, _mm512_slli_epi64(po, 32));
+	return _mm512_min_epu32(r, _mm512_sub_epi32(r, m32));
+}
+
+FILL_KERNELS(avx512, "avx512f")
+
+#undef VEC
+#undef W
+#undef SET1
+#undef LOAD
+#undef STORE
+#undef ADD32
+#undef BSWAP
+#undef MULMOD
+
+#endif /* FILL_X86 */
+
+/*
+ * Returns non-zero when the named kernel can run on this CPU.
+ */
+int fillKernelAvailable(const char *name)
+{
+	if (strcmp(name, "scalar") == 0)
+		return 1;
+#if defined(FILL_X86)
+	__builtin_cpu_init();
+	if (strcmp(name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(name, "avx512") == 0)
+		return __builtin_cpu_supports("avx512f");
+#endif
+	return 0;
+}
+
+/*
+ * Switch to the named kernel, or to the best available one. Must be
+ * called before any fill threads are started.
+ */
+const char *fillSelectKernel(const char *name)
+{
+	int i;
+
+	if (gran_gransz != GRANULE_SIZE)
+		buildGranuleTable(GRANULE_SIZE);
+
+	if (name == NULL || !fillKernelAvailable(name))
+	{
+		/* Pick the last, and therefore widest, supported kernel. */
+		for (i = 0; fill_kernel_names[i] != NULL; i++)
+			if (fillKernelAvailable(fill_kernel_names[i]))
+				name = fill_kernel_names[i];
+	}
+
+	fill_selected = 1;
+	fillBlock_kernel = fillBlock_scalar;
+	fillBlock2_kernel = fillBlock2_scalar;
+	fill_kernel = "scalar";
+#if defined(FILL_X86)
+	if (strcmp(name, "sse2") == 0)
+	{
+		fillBlock_kernel = fillBlock_sse2;
+		fillBlock2_kernel = fillBlock2_sse2;
+		fill_kernel = "sse2";
+	}
+	else if (strcmp(name, "avx2") == 0)
+	{
+		fillBlock_kernel = fillBlock_avx2;
+		fillBlock2_kernel = fillBlock2_avx2;
+		fill_kernel = "avx2";
+	}
+	else if (strcmp(name, "avx512") == 0)
+	{
+		fillBlock_kernel = fillBlock_avx512;
+		fillBlock2_kernel = fillBlock2_avx512;
+		fill_kernel = "avx512";
+	}
+#endif
+	return fill_kernel;
+}
+
+static void fillSelectOnce(void)
+{
+	if (!fill_selected)
+		fillSelectKernel(getenv("COMGEN_SIMD"));
+}
+
+#if defined(WIN32)
+static BOOL CALLBACK fillSelectOnceWin(PINIT_ONCE once, PVOID arg, PVOID *ctx)
+{
+	fillSelectOnce();
+	return TRUE;
+}
+#endif
+
+/*
+ * Switch to the kernel named by COMGEN_SIMD, or to the best available
+ * one, unless fillSelectKernel() already chose one. Only the first call
+ * does anything, so it is safe from several threads.
+ */
+void fillSelectDefault(void)
+{
+#if defined(WIN32)
+	static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+
+	InitOnceExecuteOnce(&once, fillSelectOnceWin, NULL, NULL);
+#else
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, fillSelectOnce);
+#endif
+}
@@ -0,0 +1,45 @@
+/*
+ * comgen_fill.h
+ *
+ * Park & Miller random number generator and the block fill kernels
+ * shared by comgen and its benchmark program.
+ */
+#ifndef __COMGEN_FILL_H__
+#define __COMGEN_FILL_H__
+
+/* Define minimum number of bytes that may trigger dedupe */
+#define GRANULE_SIZE 256
+
+/* Define the density of compression within the granule size */
+#define USE_DENSITY
+
+#define DENSITY 5
+
+/* Park & Miller generator constants */
+#define _PARK_A_MULTIPLIER  16807L
+#define _PARK_M_MODULUS     2147483647L /* (2**31)-1 */
+#define _PARK_Q_QUOTIENT    127773L     /* 2147483647 / 16807 */
+#define _PARK_R_REMAINDER   2836L       /* 2147483647 % 16807 */
+
+/* Generator steps, independent of any global state. */
+int _park_miller_next(int);
+int _park_miller_skip(int, unsigned long long);
+
+/* Block fill kernels, carrying the generator state in *seedp. */
+void fillBlock_r(unsigned int, void *, unsigned int, int *);
+void fillBlock2_r(unsigned int, void *, unsigned int, int *);
+unsigned long fillBlockDraws(unsigned int, unsigned int);
+unsigned long fillBlock2Draws(unsigned int, unsigned int);
+
+/*
+ * Kernel selection. All kernels produce the same bytes; they differ only
+ * in the instruction set used. Names are "scalar", "sse2", "avx2" and
+ * "avx512". A NULL or unknown name selects the best one the CPU supports.
+ * Returns the name of the kernel now in use.
+ */
+const char *fillSelectKernel(const char *);
+void fillSelectDefault(void);
+int fillKernelAvailable(const char *);
+extern const char *fill_kernel_names[];
+
+#endif
@@ -0,0 +1,870 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_fuzz.c
+ *
+ *  Coverage guided fuzzing of a compressor or decompressor, the target
+ *  being linked in or loaded through the ABI of comgen_fuzz.h.
+ *
+ *  The driver keeps the SanitizerCoverage callbacks the target is built
+ *  with: __sanitizer_cov_trace_pc() (gcc) hashes each pair of program
+ *  counters into a 64K map of hit counts, __sanitizer_cov_trace_pc_guard()
+ *  (clang) counts per edge. After every input the counts are put in AFL's
+ *  buckets (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+) and compared against
+ *  the map of all buckets seen so far; an input that reaches a new bucket
+ *  joins the corpus. Only the entries an input touched are classified and
+ *  cleared, so the cost per input follows the code it runs, not the map.
+ *
+ *  The main process sets the target up and builds the seeds, then forks
+ *  -j workers. A worker is a fork server: it forks a runner, which
+ *  inherits the set up target and runs -p inputs in process (persistent
+ *  mode, 1 forks once per input) before it exits and is forked again.
+ *  When a runner dies on a signal, or the round trip check fails, the
+ *  worker saves the input it was running if its coverage differs from
+ *  that of the crashes so far. Corpus, coverage and counters are in
+ *  memory shared by all of them, so every worker mutates what the others
+ *  found.
+ *
+ *  Seeds are blocks of each comgen pattern and of -E entropies 0 to 8 in
+ *  the -b block sizes, plus the files of -i. Besides the usual bit, byte
+ *  and arithmetic mutations, ranges are duplicated, and overwritten or
+ *  extended with slices of these blocks, so inputs keep runs, repeats and
+ *  entropy levels a compressor reacts to.
+ *
+ *  Usage: comgen_fuzz [-t target.so] [-j workers] [-p inputs per fork]
+ *                     [-i seed dir] [-o out dir] [-b KiB,...] [-m max len]
+ *                     [-s salt] [-d seconds] [-n inputs] [-T hang ms]
+ *                     [-P seconds] [-- target arguments]
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "comgen_fill.h"
+#include "comgen_entropy.h"
+#include "comgen_dedupe.h"
+#include "comgen_lib.h"
+#include "comgen_fuzz.h"
+
+#define MAP_SIZE	65536    /* Coverage map entries, a power of 2.		*/
+#define MAX_WORKERS	256
+#define MAX_SIZES	16
+#define MAX_CORPUS	65536
+#define ARENA_SIZE	(256UL * 1024 * 1024) /* Corpus bytes, shared.	*/
+#define MAX_SAVED	256      /* Crashes and hangs kept per kind.		*/
+#define EXIT_MISMATCH	86       /* Runner exit code of a failed round trip.	*/
+
+/* Coverage of the input a runner is running. */
+struct fuzz_cov {
+	unsigned int ntouched;            /* Entries of map[] not 0.		*/
+	unsigned short touched[MAP_SIZE];
+	unsigned char map[MAP_SIZE];      /* Hit counts, saturating at 255.	*/
+};
+
+/* Counters of one worker, written by it and its runner only. */
+struct fuzz_worker {
+	volatile unsigned long long execs;
+	volatile unsigned long len;       /* Length of the input being run.	*/
+	volatile pid_t runner;            /* Runner process, 0 between forks.	*/
+	volatile int hung;                /* Set when the runner was killed.	*/
+	unsigned long long forks;
+	unsigned long long crashes, hangs;
+};
+
+/* State shared by all processes. */
+struct fuzz_shared {
+	pthread_mutex_t lock;             /* Corpus and virgin[] updates.	*/
+	volatile int stop;
+	volatile unsigned int ncorpus;
+	unsigned long long arena_used;
+	unsigned long long edges;         /* Map entries ever hit.		*/
+	unsigned long long saved_crashes, saved_hangs;
+	unsigned long corpus_off[MAX_CORPUS];
+	unsigned long corpus_len[MAX_CORPUS];
+	unsigned char virgin[MAP_SIZE];   /* Buckets not yet seen, as AFL.	*/
+	unsigned char virgin_crash[MAP_SIZE]; /* The same for the crashes	*/
+	unsigned char virgin_hang[MAP_SIZE];  /* and for the hangs.		*/
+	struct fuzz_worker w[MAX_WORKERS];
+};
+
+extern const struct fuzz_target comgen_fuzz_target __attribute__((weak));
+
+static const struct fuzz_target *target;
+static struct fuzz_shared *sh;
+static unsigned char *arena;             /* Corpus inputs, shared.		*/
+static unsigned char *inputs;            /* Current input of each worker.	*/
+static struct fuzz_cov *covs;            /* Coverage of each worker's runner.	*/
+static unsigned char *material;          /* Generator blocks for mutations.	*/
+static unsigned long material_len;
+static unsigned long max_len = 65536;
+static unsigned char *outbuf, *backbuf;  /* Target outputs of a runner.	*/
+static unsigned long outcap;
+static const char *outdir = "fuzz_out";
+static unsigned long long rng;
+
+/* Coverage of the input being run; private until a runner starts. */
+static struct fuzz_cov cov_setup;
+static struct fuzz_cov *cov = &cov_setup;
+static unsigned int cov_guards;
+static unsigned long cov_prev;
+
+static unsigned char bucket[256];
+
+/*
+ * SanitizerCoverage callbacks. Guards are numbered from 1, 0 being a
+ * guard that has been switched off.
+ */
+void __sanitizer_cov_trace_pc_guard_init(unsigned int *start, unsigned int *stop)
+{
+	unsigned int *g;
+
+	if (start == stop || *start)
+		return;
+	for (g = start; g < stop; g++)
+		*g = (++cov_guards % (MAP_SIZE - 1)) + 1;
+}
+
+static inline void covHit(unsigned long k)
+{
+	if (cov->map[k] == 0)
+		cov->touched[cov->ntouched++] = (unsigned short)k;
+	if (cov->map[k] != 255)
+		cov->map[k]++;
+}
+
+void __sanitizer_cov_trace_pc_guard(unsigned int *guard)
+{
+	covHit(*guard);
+}
+
+void __sanitizer_cov_trace_pc(void)
+{
+	unsigned long pc = (unsigned long)__builtin_return_address(0);
+
+	pc = (pc >> 4) ^ (pc << 8);
+	covHit((pc ^ cov_prev) & (MAP_SIZE - 1));
+	cov_prev = (pc & (MAP_SIZE - 1)) >> 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift64*, the mutation random numbers of a runner. */
+static unsigned long long rnd(void)
+{
+	rng ^= rng >> 12;
+	rng ^= rng << 25;
+	rng ^= rng >> 27;
+	return rng * 0x2545f4914f6cdd1dULL;
+}
+
+static unsigned long rndBelow(unsigned long n)
+{
+	return n ? (unsigned long)(rnd() % n) : 0;
+}
+
+static void *xmalloc(unsigned long len)
+{
+	void *p = malloc(len ? len : 1);
+
+	if (p == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	return p;
+}
+
+static void *sharedMap(unsigned long len)
+{
+	void *p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	return p;
+}
+
+/*
+ * Add an input to the corpus. Returns its number, or -1 when the corpus
+ * is full. The caller holds the lock, except while setting up.
+ */
+static int corpusAdd(const unsigned char *buf, unsigned long len)
+{
+	unsigned int n = sh->ncorpus;
+
+	if (n == MAX_CORPUS || sh->arena_used + len > ARENA_SIZE)
+		return -1;
+	memcpy(arena + sh->arena_used, buf, len);
+	sh->corpus_off[n] = sh->arena_used;
+	sh->corpus_len[n] = len;
+	sh->arena_used += len;
+	__atomic_store_n(&sh->ncorpus, n + 1, __ATOMIC_RELEASE);
+	return (int)n;
+}
+
+static void saveFile(const char *name, const unsigned char *buf, unsigned long len)
+{
+	int fd = open(name, O_CREAT|O_WRONLY|O_TRUNC, 0666);
+
+	if (fd < 0 || write(fd, buf, len) != (ssize_t)len)
+		fprintf(stderr, "Could not write %s: %s\n", name, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+}
+
+/*
+ * Put the counts of c into buckets. Returns 1 when one of them is not yet
+ * in virgin, which is rare, so virgin is only read here and is updated
+ * under the lock by covMerge().
+ */
+static int covClassify(struct fuzz_cov *c, const unsigned char *virgin)
+{
+	unsigned int i, k;
+	int r = 0;
+
+	for (i = 0; i < c->ntouched; i++)
+	{
+		k = c->touched[i];
+		c->map[k] = bucket[c->map[k]];
+		if (c->map[k] & virgin[k])
+			r = 1;
+	}
+	return r;
+}
+
+/*
+ * Take the buckets of c out of virgin, counting the entries hit for the
+ * first time in *edges. Returns 1 when any of them was new.
+ */
+static int covMerge(const struct fuzz_cov *c, unsigned char *virgin, unsigned long long *edges)
+{
+	unsigned int i, k;
+	int r = 0;
+
+	for (i = 0; i < c->ntouched; i++)
+	{
+		k = c->touched[i];
+		if (!(c->map[k] & virgin[k]))
+			continue;
+		if (virgin[k] == 0xff && edges != NULL)
+			(*edges)++;
+		virgin[k] &= ~c->map[k];
+		r = 1;
+	}
+	return r;
+}
+
+static void covReset(struct fuzz_cov *c)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->ntouched; i++)
+		c->map[c->touched[i]] = 0;
+	c->ntouched = 0;
+}
+
+static void buildBuckets(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++)
+		bucket[i] = i == 0 ? 0 : i == 1 ? 1 : i == 2 ? 2 : i == 3 ? 4 : i < 8 ? 8 :
+			i < 16 ? 16 : i < 32 ? 32 : i < 128 ? 64 : 128;
+}
+
+/*
+ * Run one input through the target. Returns 0, or EXIT_MISMATCH when the
+ * round trip does not give the input back or compress fails.
+ */
+static int runTarget(const unsigned char *in, unsigned long len)
+{
+	long c, d;
+
+	if (target->compress == NULL)
+	{
+		target->decompress(in, len, outbuf, outcap);
+		return 0;
+	}
+	c = target->compress(in, len, outbuf, outcap);
+	if (c < 0)
+		return EXIT_MISMATCH;
+	if (target->decompress == NULL)
+		return 0;
+	d = target->decompress(outbuf, (unsigned long)c, backbuf, len + 1);
+	if (d != (long)len || memcmp(backbuf, in, len) != 0)
+		return EXIT_MISMATCH;
+	return 0;
+}
+
+/* Interesting values, after AFL. */
+static const int interesting[] = {
+	-128, -1, 0, 1, 16, 32, 64, 100, 127, 128, 255, 256, 512, 1000, 1024, 4096, 32767, 65535
+};
+#define NINTERESTING	(sizeof(interesting) / sizeof(interesting[0]))
+
+/*
+ * Mutate buf, of *lenp bytes and room for max_len, with a stack of 1 to
+ * 8 changes.
+ */
+static void mutate(unsigned char *buf, unsigned long *lenp)
+{
+	unsigned long len = *lenp, a, n, b, k;
+	unsigned int i, ops, c;
+	int v;
+
+	ops = 1 + (unsigned int)rndBelow(8);
+	for (i = 0; i < ops; i++)
+	{
+		if (len == 0)
+		{
+			/* Nothing to change, start from generator bytes. */
+			n = 1 + rndBelow(max_len < 256 ? max_len : 256);
+			memcpy(buf, material + rndBelow(material_len - n), n);
+			len = n;
+			continue;
+		}
+		a = rndBelow(len);
+		switch (rndBelow(10))
+		{
+		case 0:		/* Flip a bit */
+			buf[a] ^= 1 << rndBelow(8);
+			break;
+		case 1:		/* Random byte */
+			buf[a] = (unsigned char)rnd();
+			break;
+		case 2:		/* Interesting 8, 16 or 32 bit value */
+			v = interesting[rndBelow(NINTERESTING)];
+			n = 1UL << rndBelow(3);
+			for (k = 0; k < n && a + k < len; k++)
+				buf[a + k] = (unsigned char)(v >> (8 * k));
+			break;
+		case 3:		/* Small addition */
+			buf[a] += (unsigned char)(rndBelow(35) - 17);
+			break;
+		case 4:		/* Delete a range */
+			n = 1 + rndBelow(len - a);
+			memmove(buf + a, buf + a + n, len - a - n);
+			len -= n;
+			break;
+		case 5:		/* Copy a range to another place, a repeat */
+			n = 1 + rndBelow(len - a);
+			b = rndBelow(len);
+			if (rndBelow(2) && len + n <= max_len)
+			{
+				memmove(buf + b + n, buf + b, len - b);
+				memmove(buf + b, buf + (a >= b ? a + n : a), n);
+				len += n;
+			}
+			else
+			{
+				if (n > len - b)
+					n = len - b;
+				memmove(buf + b, buf + a, n);
+			}
+			break;
+		case 6:		/* Overwrite with generator bytes */
+			n = 1 + rndBelow(len - a < material_len ? len - a : material_len);
+			memcpy(buf + a, material + rndBelow(material_len - n), n);
+			break;
+		case 7:		/* Insert generator bytes */
+			n = 1 + rndBelow(max_len - len < 4096 ? max_len - len : 4096);
+			if (len + n > max_len)
+				break;
+			memmove(buf + a + n, buf + a, len - a);
+			memcpy(buf + a, material + rndBelow(material_len - n), n);
+			len += n;
+			break;
+		case 8:		/* Splice with another corpus input */
+			c = (unsigned int)rndBelow(__atomic_load_n(&sh->ncorpus, __ATOMIC_ACQUIRE));
+			b = rndBelow(sh->corpus_len[c]);
+			n = sh->corpus_len[c] - b;
+			if (a + n > max_len)
+				n = max_len - a;
+			memcpy(buf + a, arena + sh->corpus_off[c] + b, n);
+			len = a + n;
+			break;
+		case 9:		/* A run of one byte */
+			n = 1 + rndBelow(len - a);
+			memset(buf + a, rndBelow(2) ? buf[a] : (int)rndBelow(256), n);
+			break;
+		}
+	}
+	*lenp = len;
+}
+
+/*
+ * A runner: run up to persist inputs of worker id in process, then exit.
+ * A failed round trip exits with EXIT_MISMATCH, a crash dies on its
+ * signal; the worker finds the input in inputs[] either way.
+ */
+static void runner(unsigned int id, unsigned long persist)
+{
+	struct fuzz_worker *w = &sh->w[id];
+	unsigned char *buf = inputs + (unsigned long)id * max_len;
+	unsigned long long k;
+	unsigned long len;
+	unsigned int c, n;
+	char name[512];
+	int r;
+
+	rng = mixHash(rng ^ ((unsigned long long)id << 32) ^ w->forks) | 1;
+	cov = &covs[id];
+	covReset(cov);
+	for (k = 0; k < persist && !sh->stop; k++)
+	{
+		n = __atomic_load_n(&sh->ncorpus, __ATOMIC_ACQUIRE);
+		c = (unsigned int)rndBelow(n);
+		len = sh->corpus_len[c];
+		memcpy(buf, arena + sh->corpus_off[c], len);
+		mutate(buf, &len);
+		w->len = len;
+
+		covReset(cov);
+		cov_prev = 0;
+		r = runTarget(buf, len);
+		w->execs++;
+		if (r != 0)
+			_exit(r);
+
+		if (covClassify(cov, sh->virgin))
+		{
+			pthread_mutex_lock(&sh->lock);
+			if (covMerge(cov, sh->virgin, &sh->edges) && (r = corpusAdd(buf, len)) >= 0)
+			{
+				snprintf(name, sizeof(name), "%s/corpus/id_%06d", outdir, r);
+				saveFile(name, buf, len);
+			}
+			pthread_mutex_unlock(&sh->lock);
+		}
+	}
+	_exit(0);
+}
+
+/*
+ * Save the input worker id was running when its runner failed, unless
+ * the coverage of the failure was seen in an earlier one of its kind.
+ */
+static void saveFailure(unsigned int id, const char *kind, int sig)
+{
+	struct fuzz_worker *w = &sh->w[id];
+	int hang = strcmp(kind, "hang") == 0, r;
+	char name[512];
+
+	pthread_mutex_lock(&sh->lock);
+	covClassify(&covs[id], hang ? sh->virgin_hang : sh->virgin_crash);
+	r = covMerge(&covs[id], hang ? sh->virgin_hang : sh->virgin_crash, NULL);
+	if (r && (hang ? sh->saved_hangs++ : sh->saved_crashes++) >= MAX_SAVED)
+		r = 0;
+	pthread_mutex_unlock(&sh->lock);
+	if (!r)
+		return;
+	snprintf(name, sizeof(name), "%s/%s/%s_w%u_%llu_sig%d", outdir,
+		hang ? "hangs" : "crashes", kind, id, w->forks, sig);
+	saveFile(name, inputs + (unsigned long)id * max_len, w->len);
+	fprintf(stderr, "Worker %u: %s, input saved as %s\n", id, kind, name);
+}
+
+/*
+ * A worker: the fork server of one runner after another.
+ */
+static void worker(unsigned int id, unsigned long persist)
+{
+	struct fuzz_worker *w = &sh->w[id];
+	pid_t pid;
+	int status;
+
+	while (!sh->stop)
+	{
+		w->hung = 0;
+		w->forks++;
+		pid = fork();
+		if (pid < 0)
+		{
+			fprintf(stderr, "Worker %u: fork failed: %s\n", id, strerror(errno));
+			break;
+		}
+		if (pid == 0)
+			runner(id, persist);
+		w->runner = pid;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+		w->runner = 0;
+		if (w->hung)
+		{
+			w->hangs++;
+			saveFailure(id, "hang", SIGKILL);
+		}
+		else if (WIFSIGNALED(status) && !sh->stop)
+		{
+			w->crashes++;
+			saveFailure(id, "crash", WTERMSIG(status));
+		}
+		else if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_MISMATCH)
+		{
+			w->crashes++;
+			saveFailure(id, "mismatch", 0);
+		}
+	}
+	_exit(0);
+}
+
+/*
+ * Seeds and mutation material: one block of every pattern and of -E
+ * entropies 0 to 8 for each block size, up to max_len bytes of each.
+ */
+static void buildSeeds(int salt, const unsigned int *sizes, unsigned int nsizes)
+{
+	struct comgen_ctx *ctx;
+	unsigned char *blk;
+	unsigned long len, room = 0;
+	unsigned int i;
+	int p, e, r;
+
+	for (i = 0; i < nsizes; i++)
+		room += 13UL * sizes[i] * 1024;
+	material = xmalloc(room);
+	material_len = 0;
+	for (i = 0; i < nsizes; i++)
+	{
+		ctx = comgen_create(salt, sizes[i], 1, 1, COMGEN_DEFAULT | COMGEN_MASK(COMGEN_ENTROPY));
+		if (ctx == NULL)
+		{
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+		len = sizes[i] * 1024UL;
+		for (p = 0; p < COMGEN_PATTERNS - 1 + 9; p++)
+		{
+			blk = material + material_len;
+			if (p < COMGEN_ENTROPY)
+				r = comgen_fill(ctx, p, 0, 0, blk, len);
+			else
+			{
+				e = p - COMGEN_ENTROPY;
+				comgen_set_entropy(ctx, (double)e, 0);
+				r = comgen_fill(ctx, COMGEN_ENTROPY, 0, 0, blk, len);
+			}
+			if (r != 0)
+			{
+				fprintf(stderr, "Error: could not generate block 0 of file 0\n");
+				exit(-1);
+			}
+			material_len += len;
+			corpusAdd(blk, len < max_len ? len : max_len);
+		}
+		comgen_destroy(ctx);
+	}
+}
+
+/* Add the files of dir to the corpus. */
+static void loadSeeds(const char *dir)
+{
+	struct dirent *de;
+	unsigned char *buf;
+	char name[1024];
+	DIR *d;
+	long n;
+	int fd, count = 0;
+
+	d = opendir(dir);
+	if (d == NULL)
+	{
+		fprintf(stderr, "Could not open seed directory %s: %s\n", dir, strerror(errno));
+		exit(-2);
+	}
+	buf = xmalloc(max_len);
+	while ((de = readdir(d)) != NULL)
+	{
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(name, sizeof(name), "%s/%s", dir, de->d_name);
+		if ((fd = open(name, O_RDONLY)) < 0)
+			continue;
+		n = read(fd, buf, max_len);
+		close(fd);
+		if (n >= 0 && corpusAdd(buf, (unsigned long)n) >= 0)
+			count++;
+	}
+	closedir(d);
+	free(buf);
+	fprintf(stderr, "Loaded %d seeds from %s\n", count, dir);
+}
+
+static void onSignal(int sig)
+{
+	(void)sig;
+	if (sh != NULL)
+		sh->stop = 1;
+}
+
+static void usage(const char *me)
+{
+	fprintf(stderr, "Usage: %s [-t target.so] [-j workers] [-p inputs per fork] [-i seed dir]\n"
+		"\t[-o out dir] [-b KiB,...] [-m max len] [-s salt] [-d seconds] [-n inputs]\n"
+		"\t[-T hang ms] [-P seconds] [-- target arguments]\n", me);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int sizes[MAX_SIZES] = { 4, 64 };
+	unsigned int nsizes = 2, njobs = 0, i;
+	unsigned long persist = 10000;
+	unsigned long long limit = 0, total, last_total = 0, crashes, hangs;
+	unsigned long long last[MAX_WORKERS], seen[MAX_WORKERS];
+	double duration = 0, interval = 5, hang_ms = 1000, t0, t, tlast, seen_t[MAX_WORKERS];
+	const char *lib = NULL, *seed_dir = NULL;
+	char *list, *tok, dir[512];
+	pid_t pids[MAX_WORKERS], seen_pid[MAX_WORKERS];
+	pthread_mutexattr_t ma;
+	void *h;
+	int c, salt = 0, warned = 0;
+	long ncpu;
+
+	while ((c = getopt(argc, argv, "t:j:p:i:o:b:m:s:d:n:T:P:")) != EOF)
+	{
+		switch (c)
+		{
+		case 't':	/* Target shared object */
+			lib = optarg;
+			break;
+		case 'j':	/* Worker processes */
+			njobs = (unsigned int)strtol(optarg, NULL, 10);
+			break;
+		case 'p':	/* Inputs per runner fork, 1 = fork server only */
+			persist = strtoul(optarg, NULL, 10);
+			if (persist == 0)
+				persist = 1;
+			break;
+		case 'i':	/* Seed directory */
+			seed_dir = optarg;
+			break;
+		case 'o':	/* Output directory */
+			outdir = optarg;
+			break;
+		case 'b':	/* Generator block sizes in KiB */
+			nsizes = 0;
+			list = strdup(optarg);
+			for (tok = strtok(list, ","); tok != NULL && nsizes < MAX_SIZES; tok = strtok(NULL, ","))
+				if ((sizes[nsizes] = (unsigned int)strtol(tok, NULL, 10)) > 0)
+					nsizes++;
+			free(list);
+			if (nsizes == 0)
+				usage(argv[0]);
+			break;
+		case 'm':	/* Longest input */
+			max_len = strtoul(optarg, NULL, 10);
+			if (max_len < 16)
+				max_len = 16;
+			break;
+		case 's':	/* Salt of the generator seeds */
+			salt = (int)strtol(optarg, NULL, 10);
+			break;
+		case 'd':	/* Seconds to run, 0 = until interrupted */
+			duration = strtod(optarg, NULL);
+			break;
+		case 'n':	/* Inputs to run */
+			limit = strtoull(optarg, NULL, 10);
+			break;
+		case 'T':	/* Runner silent this long counts as a hang */
+			hang_ms = strtod(optarg, NULL);
+			break;
+		case 'P':	/* Seconds between reports */
+			interval = strtod(optarg, NULL);
+			if (interval <= 0)
+				interval = 5;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* A linked in target, or one from a shared object. */
+	target = &comgen_fuzz_target;
+	if (lib != NULL)
+	{
+		h = dlopen(lib, RTLD_NOW|RTLD_GLOBAL);
+		if (h == NULL || (target = dlsym(h, "comgen_fuzz_target")) == NULL)
+		{
+			fprintf(stderr, "Could not load comgen_fuzz_target from %s: %s\n", lib, dlerror());
+			exit(-2);
+		}
+	}
+	if (target == NULL)
+	{
+		fprintf(stderr, "No target: build with make fuzz TARGET=<file.c> or give -t <target.so>.\n");
+		exit(1);
+	}
+	if (target->abi != FUZZ_ABI_VERSION || (target->compress == NULL && target->decompress == NULL))
+	{
+		fprintf(stderr, "Target %s has ABI %d, not %d, or no entry points.\n",
+			target->name ? target->name : "?", target->abi, FUZZ_ABI_VERSION);
+		exit(1);
+	}
+	if (target->init != NULL && target->init(argc - optind, argv + optind) != 0)
+	{
+		fprintf(stderr, "Target %s failed to initialize.\n", target->name);
+		exit(1);
+	}
+
+	if (njobs == 0)
+	{
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		njobs = ncpu > 0 ? (unsigned int)ncpu : 1;
+	}
+	if (njobs > MAX_WORKERS)
+		njobs = MAX_WORKERS;
+
+	/* Shared state, the corpus and the input being run by each worker. */
+	sh = sharedMap(sizeof(*sh));
+	arena = sharedMap(ARENA_SIZE);
+	inputs = sharedMap((unsigned long)njobs * max_len);
+	covs = sharedMap((unsigned long)njobs * sizeof(*covs));
+	memset(sh->virgin, 0xff, sizeof(sh->virgin));
+	memset(sh->virgin_crash, 0xff, sizeof(sh->virgin_crash));
+	memset(sh->virgin_hang, 0xff, sizeof(sh->virgin_hang));
+	pthread_mutexattr_init(&ma);
+	pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&sh->lock, &ma);
+	buildBuckets();
+
+	outcap = target->bound ? target->bound(max_len) : 2 * max_len + 1024;
+	if (target->compress == NULL && outcap < 16 * max_len)
+		outcap = 16 * max_len;	/* Room for what decompress makes.	*/
+	outbuf = xmalloc(outcap);
+	backbuf = xmalloc(max_len + 1);
+
+	if (salt == 0)
+		salt = 79;
+	rng = mixHash((unsigned long long)salt);
+	buildSeeds(salt, sizes, nsizes);
+	if (seed_dir != NULL)
+		loadSeeds(seed_dir);
+
+	mkdir(outdir, 0777);
+	snprintf(dir, sizeof(dir), "%s/corpus", outdir);
+	mkdir(dir, 0777);
+	snprintf(dir, sizeof(dir), "%s/crashes", outdir);
+	mkdir(dir, 0777);
+	snprintf(dir, sizeof(dir), "%s/hangs", outdir);
+	mkdir(dir, 0777);
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	fprintf(stderr, "Fuzzing %s (%s) with %u workers, %lu inputs per fork, %u seeds, inputs up to %lu bytes\n",
+		target->name ? target->name : "target",
+		target->compress && target->decompress ? "round trip" : target->compress ? "compress" : "decompress",
+		njobs, persist, sh->ncorpus, max_len);
+
+	for (i = 0; i < njobs; i++)
+	{
+		pids[i] = fork();
+		if (pids[i] < 0)
+		{
+			fprintf(stderr, "Error creating worker: %s\n", strerror(errno));
+			exit(-1);
+		}
+		if (pids[i] == 0)
+			worker(i, persist);
+		last[i] = seen[i] = 0;
+		seen_pid[i] = 0;
+	}
+
+	/* Report, and kill runners that stopped making progress. */
+	t0 = tlast = now();
+	for (i = 0; i < njobs; i++)
+		seen_t[i] = t0;
+	while (!sh->stop)
+	{
+		usleep(50000);
+		t = now();
+		for (i = 0, total = crashes = hangs = 0; i < njobs; i++)
+		{
+			total += sh->w[i].execs;
+			crashes += sh->w[i].crashes;
+			hangs += sh->w[i].hangs;
+			if (sh->w[i].execs != seen[i] || sh->w[i].runner != seen_pid[i])
+			{
+				seen[i] = sh->w[i].execs;
+				seen_pid[i] = sh->w[i].runner;
+				seen_t[i] = t;
+			}
+			else if (seen_pid[i] > 0 && (t - seen_t[i]) * 1000 > hang_ms)
+			{
+				sh->w[i].hung = 1;
+				kill(seen_pid[i], SIGKILL);
+				seen_t[i] = t;
+			}
+		}
+		if ((duration > 0 && t - t0 >= duration) || (limit > 0 && total >= limit))
+			sh->stop = 1;
+		if (t - tlast < interval && !sh->stop)
+			continue;
+
+		printf("%.0fs: %llu inputs, %.0f/s, corpus %u, edges %llu, crashes %llu (%llu saved), hangs %llu (%llu saved) |",
+			t - t0, total, (total - last_total) / (t - tlast), sh->ncorpus, sh->edges,
+			crashes, sh->saved_crashes, hangs, sh->saved_hangs);
+		for (i = 0; i < njobs; i++)
+		{
+			printf(" w%u %.0f/s", i, (sh->w[i].execs - last[i]) / (t - tlast));
+			last[i] = sh->w[i].execs;
+		}
+		printf("\n");
+		fflush(stdout);
+		if (!warned && total > 0 && sh->edges == 0)
+		{
+			fprintf(stderr, "Warning: no coverage, build the target with -fsanitize-coverage=trace-pc\n");
+			warned = 1;
+		}
+		last_total = total;
+		tlast = t;
+	}
+
+	/* A runner stops after its current input, unless that one hangs. */
+	usleep(100000);
+	for (i = 0; i < njobs; i++)
+		if (sh->w[i].runner > 0)
+			kill(sh->w[i].runner, SIGKILL);
+	for (i = 0; i < njobs; i++)
+		waitpid(pids[i], NULL, 0);
+	t = now() - t0;
+	for (i = 0, total = 0; i < njobs; i++)
+	{
+		total += sh->w[i].execs;
+		printf("Worker %u: %llu inputs, %.0f/s, %llu forks, %llu crashes, %llu hangs\n", i,
+			sh->w[i].execs, sh->w[i].execs / t, sh->w[i].forks, sh->w[i].crashes, sh->w[i].hangs);
+	}
+	printf("Total: %llu inputs in %.1fs, %.0f/s, corpus %u, edges %llu\n", total, t, total / t,
+		sh->ncorpus, sh->edges);
+	return (sh->saved_crashes || sh->saved_hangs) ? 2 : 0;
+}
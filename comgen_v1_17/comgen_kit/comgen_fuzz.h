@@ -0,0 +1,37 @@
+/*
+ * comgen_fuzz.h
+ *
+ * The C ABI between comgen_fuzz and a compressor or decompressor under
+ * test. A target defines one struct fuzz_target named comgen_fuzz_target
+ * and is built with -fsanitize-coverage=trace-pc (gcc) or trace-pc-guard
+ * (clang). It is either linked into comgen_fuzz (make fuzz TARGET=x.c)
+ * or built as a shared object and loaded with -t.
+ *
+ * With both compress and decompress set, every input is compressed,
+ * decompressed and compared, and any difference counts as a crash. With
+ * one of them set the input is just passed to it. Both return the number
+ * of bytes written to dst, or a negative value on an error; an error of
+ * compress counts as a crash, one of decompress does not.
+ *
+ * comgen_diff loads the same targets, built as shared objects without
+ * the coverage flag, as backends of its differential round trips.
+ */
+#ifndef __COMGEN_FUZZ_H__
+#define __COMGEN_FUZZ_H__
+
+#define FUZZ_ABI_VERSION	1
+
+struct fuzz_target {
+	int abi;                 /* FUZZ_ABI_VERSION.				*/
+	const char *name;
+	/* Called once before any input, with the arguments after --. 0 = ok. */
+	int (*init)(int, char **);
+	long (*compress)(const void *, unsigned long, void *, unsigned long);
+	long (*decompress)(const void *, unsigned long, void *, unsigned long);
+	/* Largest compress output for an input length, NULL for 2n + 1KiB. */
+	unsigned long (*bound)(unsigned long);
+};
+
+extern const struct fuzz_target comgen_fuzz_target;
+
+#endif
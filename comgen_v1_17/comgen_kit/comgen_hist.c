@@ -0,0 +1,252 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_hist.c
+ *
+ *  Byte value histograms.
+ *
+ *  Counting bytes into one table stalls on the store to load dependency
+ *  whenever neighbouring bytes are equal, which in real data they often
+ *  are. Every kernel therefore counts into HIST_TABLES tables of 32 bit
+ *  counters, byte j of each 64 bit word into table j % HIST_TABLES, and
+ *  sums the tables at the end.
+ *
+ *  That is bound by one counter store per byte, and there is no
+ *  gather/scatter formulation that beats it for 256 bins, so the vector
+ *  kernels only add a fast path: HIST_RUN bytes at a time are compared
+ *  with their first byte broadcast, and a run of one value (zero pages,
+ *  padding, fill) is counted with a single add. Everything else goes
+ *  through the tables, 64 bits at a time, from the bytes just loaded.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if defined(WIN32)
+#pragma warning(disable:4996)
+#pragma warning(disable:4267)
+#pragma warning(disable:4244)
+#pragma warning(disable:4018)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(WIN32)
+#include <stdint.h>
+#else
+#define uint64_t unsigned __int64
+#endif
+
+#include "comgen_hist.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HIST_X86
+#include <immintrin.h>
+#endif
+
+#define HIST_TABLES	4
+#define HIST_RUN	256		/* Bytes tested for one value at a time. */
+#define HIST_CHUNK	(1UL << 30)	/* Bytes counted before the 32 bit tables could wrap. */
+
+typedef unsigned int hist_tables[HIST_TABLES][256];
+
+/* Count the 8 bytes of w. */
+#define COUNT64(t, w)					\
+	do {						\
+		(t)[0][(w) & 0xff]++;			\
+		(t)[1][((w) >> 8) & 0xff]++;		\
+		(t)[2][((w) >> 16) & 0xff]++;		\
+		(t)[3][((w) >> 24) & 0xff]++;		\
+		(t)[0][((w) >> 32) & 0xff]++;		\
+		(t)[1][((w) >> 40) & 0xff]++;		\
+		(t)[2][((w) >> 48) & 0xff]++;		\
+		(t)[3][(w) >> 56]++;			\
+	} while (0)
+
+static void byteHist_tables(const unsigned char *, unsigned long, hist_tables);
+
+/* Kernel in use, tables until byteHistSelectKernel() is called. */
+static void (*byteHist_kernel)(const unsigned char *, unsigned long, hist_tables) = byteHist_tables;
+static const char *byte_hist_kernel = "tables";
+
+const char *byte_hist_kernel_names[] = { "tables", "runs_sse2", "runs_avx2", "runs_avx512", NULL };
+
+static void byteHist_tables(const unsigned char *p, unsigned long len, hist_tables t)
+{
+	uint64_t w;
+
+	for (; len >= 8; p += 8, len -= 8)
+	{
+		memcpy(&w, p, 8);
+		COUNT64(t, w);
+	}
+	while (len--)
+		t[0][*p++]++;
+}
+
+#if defined(HIST_X86)
+
+/*
+ * One runs kernel per instruction set, over:
+ *
+ *   W               bytes per vector
+ *   MASK            type of a compare mask, all ones when all bytes equal
+ *   ONES            that value
+ *   SET1(c)         broadcast byte c
+ *   EQ(p, f)        compare mask of the vector at p with f
+ *
+ * The test for one value is over a whole HIST_RUN bytes, without a
+ * branch per vector, so that data without runs pays little for it.
+ */
+#define HIST_KERNEL(name, isa)						\
+__attribute__((target(isa)))						\
+static void byteHist_runs_##name(const unsigned char *p, unsigned long len,	\
+	hist_tables t)							\
+{									\
+	uint64_t w;							\
+	MASK m;								\
+	int i;								\
+									\
+	for (; len >= HIST_RUN; p += HIST_RUN, len -= HIST_RUN)	\
+	{								\
+		m = ONES;						\
+		for (i = 0; i < HIST_RUN; i += W)			\
+			m &= EQ(p + i, SET1(p[0]));			\
+		if (m == ONES)						\
+		{							\
+			t[0][p[0]] += HIST_RUN;				\
+			continue;					\
+		}							\
+		for (i = 0; i < HIST_RUN; i += 8)			\
+		{							\
+			memcpy(&w, p + i, 8);				\
+			COUNT64(t, w);					\
+		}							\
+	}								\
+	/* Not a tail call to byteHist_tables(), which loses the	\
+	 * vzeroupper and slows down the SSE code of libm after it. */	\
+	for (; len >= 8; p += 8, len -= 8)				\
+	{								\
+		memcpy(&w, p, 8);					\
+		COUNT64(t, w);						\
+	}								\
+	while (len--)							\
+		t[0][*p++]++;						\
+}
+
+#define W		16
+#define MASK		unsigned int
+#define ONES		0xffffU
+#define SET1(c)		_mm_set1_epi8((char)(c))
+#define EQ(p, f)	(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p)), f))
+HIST_KERNEL(sse2, "sse2")
+#undef W
+#undef MASK
+#undef ONES
+#undef SET1
+#undef EQ
+
+#define W		32
+#define MASK		unsigned int
+#define ONES		0xffffffffU
+#define SET1(c)		_mm256_set1_epi8((char)(c))
+#define EQ(p, f)	(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p)), f))
+HIST_KERNEL(avx2, "avx2")
+#undef W
+#undef MASK
+#undef ONES
+#undef SET1
+#undef EQ
+
+#define W		64
+#define MASK		unsigned long long
+#define ONES		~0ULL
+#define SET1(c)		_mm512_set1_epi8((char)(c))
+#define EQ(p, f)	(unsigned long long)_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)(p)), f)
+HIST_KERNEL(avx512, "avx512f,avx512bw")
+#undef W
+#undef MASK
+#undef ONES
+#undef SET1
+#undef EQ
+
+#endif /* HIST_X86 */
+
+/*
+ * count[256] = occurrences of each byte value in len bytes of buf.
+ */
+void byteHist(const void *buf, unsigned long len, unsigned long *count)
+{
+	const unsigned char *p = buf;
+	hist_tables t;
+	unsigned long n;
+	int i, j;
+
+	memset(count, 0, 256 * sizeof(*count));
+	while (len > 0)
+	{
+		n = len < HIST_CHUNK ? len : HIST_CHUNK;
+		memset(t, 0, sizeof(t));
+		byteHist_kernel(p, n, t);
+		for (i = 0; i < 256; i++)
+			for (j = 0; j < HIST_TABLES; j++)
+				count[i] += t[j][i];
+		p += n;
+		len -= n;
+	}
+}
+
+/*
+ * Returns non-zero when the named kernel can run on this CPU.
+ */
+int byteHistKernelAvailable(const char *name)
+{
+	if (strcmp(name, "tables") == 0)
+		return 1;
+#if defined(HIST_X86)
+	__builtin_cpu_init();
+	if (strcmp(name, "runs_sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+	if (strcmp(name, "runs_avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(name, "runs_avx512") == 0)
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	return 0;
+}
+
+/*
+ * Switch to the named kernel, or to runs_sse2 when available. The wider
+ * run tests only pay off on data that is mostly runs; on dense data the
+ * tables bound every kernel and the wider loads cost a little. Must be
+ * called before any counting threads are started.
+ */
+const char *byteHistSelectKernel(const char *name)
+{
+	if (name == NULL || !byteHistKernelAvailable(name))
+		name = byteHistKernelAvailable("runs_sse2") ? "runs_sse2" : "tables";
+
+	byteHist_kernel = byteHist_tables;
+	byte_hist_kernel = "tables";
+#if defined(HIST_X86)
+	if (strcmp(name, "runs_sse2") == 0)
+	{
+		byteHist_kernel = byteHist_runs_sse2;
+		byte_hist_kernel = "runs_sse2";
+	}
+	else if (strcmp(name, "runs_avx2") == 0)
+	{
+		byteHist_kernel = byteHist_runs_avx2;
+		byte_hist_kernel = "runs_avx2";
+	}
+	else if (strcmp(name, "runs_avx512") == 0)
+	{
+		byteHist_kernel = byteHist_runs_avx512;
+		byte_hist_kernel = "runs_avx512";
+	}
+#endif
+	return byte_hist_kernel;
+}
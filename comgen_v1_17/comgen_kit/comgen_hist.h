@@ -0,0 +1,25 @@
+/*
+ * comgen_hist.h
+ *
+ * Byte value histogram of a buffer, the inner loop of --analyze, with
+ * kernels picked at run time like the fill kernels.
+ */
+#ifndef __COMGEN_HIST_H__
+#define __COMGEN_HIST_H__
+
+/* count[256] = occurrences of each byte value in len bytes of buf. */
+void byteHist(const void *, unsigned long, unsigned long *);
+
+/*
+ * Kernel selection. All kernels count the same. "tables" counts every
+ * byte; "runs_sse2", "runs_avx2" and "runs_avx512" also count a run of
+ * one value with one add, testing for it with that instruction set. A
+ * NULL or unknown name selects "runs_sse2" where the CPU has it, which
+ * is as fast as the wider ones on data without runs. Returns the name of
+ * the kernel now in use.
+ */
+const char *byteHistSelectKernel(const char *);
+int byteHistKernelAvailable(const char *);
+extern const char *byte_hist_kernel_names[];
+
+#endif
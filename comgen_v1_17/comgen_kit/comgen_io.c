@@ -0,0 +1,1000 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_io.c
+ *
+ *  Write engines for comgen. ioqRead() queues reads through the same
+ *  engines, for --verify.
+ *
+ *  sync      pwrite() on the calling thread. Completions are immediate.
+ *  libaio    Linux native AIO through the io_setup()/io_submit() syscalls.
+ *  io_uring  io_uring with the block buffers registered as fixed buffers
+ *            and the target registered as a fixed file.
+ *
+ *  stream    write() in order, ignoring offsets, for the sinks opened by
+ *            sinkOpen(): stdout or a pipe, a Unix socket or a TCP socket.
+ *            Blocks go into a pipe with vmsplice(), which maps the buffer
+ *            pages into the pipe instead of copying them, so a buffer only
+ *            comes back from ioqWait() once the reader has consumed it.
+ *
+ *  Both asynchronous engines use the raw system calls, so no extra
+ *  libraries are needed to build. If an engine cannot be set up on the
+ *  running kernel, ioqOpen() falls back io_uring -> libaio -> sync.
+ *
+ *  ioRepeat() writes one block many times for the dedupe patterns, either
+ *  as large pwritev() calls whose iovecs all point at the same buffer, or
+ *  by cloning what has already been written (FICLONERANGE, then
+ *  copy_file_range()) so the data is not moved through user space again.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include <limits.h>
+
+#if defined(_linux_)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/aio_abi.h>
+#include <linux/sockios.h>
+#if defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING
+#endif
+#endif
+
+#include "comgen_io.h"
+
+#define CALLOC(typ, n)  (typ*)(calloc((n), sizeof(typ)))
+
+#if defined(HAVE_IO_URING)
+/*
+ * Mapped io_uring submission and completion rings.
+ */
+struct uring {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+	unsigned int pending;    /* Queued sqes not yet handed to the kernel. */
+	unsigned int batch;      /* Submit once this many are queued.	     */
+};
+#endif
+
+struct ioq {
+	int engine;
+	int fd;
+	char **bufs;
+	unsigned int nbufs;
+	unsigned long buflen;
+	unsigned int depth;      /* Maximum writes in flight.		*/
+	unsigned int inflight;   /* Writes submitted and not yet reaped.	*/
+	unsigned int *done;      /* sync: FIFO of completed buffer indexes.	*/
+	unsigned int done_head;
+	long *done_res;          /* sync: bytes moved by each done[] entry.	*/
+	long res;                /* Bytes moved by the last ioqWait() buffer.	*/
+	unsigned long long *stamp;/* Submit time of each tag, sync: latency.	*/
+	long *want;              /* Bytes each tag writes, -1 for a read.	*/
+	unsigned int *tags;      /* libaio, io_uring: free tags.		*/
+	unsigned int ntags;
+	unsigned long long lat;  /* Latency of the last ioqWait() buffer, ns.	*/
+	unsigned long long *ends;/* stream: bytes sent up to each done[] entry. */
+	unsigned long long sent; /* stream: bytes sent so far.		*/
+	int splice;              /* stream: fd is a pipe, use vmsplice().	*/
+#if defined(_linux_)
+	aio_context_t aio;
+	struct iocb *iocbs;      /* libaio: one control block per slot.	*/
+	unsigned int iocb_next;
+#endif
+#if defined(HAVE_IO_URING)
+	struct uring ring;
+#endif
+};
+
+static const char *engine_names[] = { "sync", "libaio", "io_uring", "stream" };
+static const char *repeat_names[] = { "write", "pwritev", "clone" };
+static int fallback_noted;       /* Report an engine fallback only once. */
+static int clone_noted;          /* Report a repeat mode fallback only once. */
+
+int ioEngineByName(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (strcmp(name, engine_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+const char *ioEngineName(int engine)
+{
+	if (engine < 0 || engine > 3)
+		return "unknown";
+	return engine_names[engine];
+}
+
+/* Monotonic clock in nanoseconds, for the latencies. */
+static unsigned long long ioNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ioFailed(long res)
+{
+	printf("%s\n", strerror((int)-res));
+	exit(-3);
+}
+
+static void ioShort(long res, long want)
+{
+	printf("Short write: %ld of %ld bytes\n", res, want);
+	exit(-3);
+}
+
+#if defined(_linux_)
+/* ---- libaio */
+
+static int aioOpen(struct ioq *q)
+{
+	q->aio = 0;
+	if (syscall(__NR_io_setup, q->depth, &q->aio) < 0)
+		return -1;
+	q->iocbs = CALLOC(struct iocb, q->depth);
+	if (q->iocbs == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	return 0;
+}
+
+static void aioSubmit(struct ioq *q, int op, unsigned int idx, unsigned int tag,
+	unsigned long len, unsigned long long off)
+{
+	struct iocb *cb;
+	long r;
+
+	/* At most depth writes are in flight, so control blocks cycle. */
+	cb = &q->iocbs[q->iocb_next++ % q->depth];
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_lio_opcode = op;
+	cb->aio_fildes = q->fd;
+	cb->aio_buf = (unsigned long)q->bufs[idx];
+	cb->aio_nbytes = len;
+	cb->aio_offset = off;
+	cb->aio_data = idx | (unsigned long long)tag << 32;
+	do
+		r = syscall(__NR_io_submit, q->aio, 1, &cb);
+	while (r < 0 && errno == EAGAIN);
+	if (r < 0)
+		ioFailed(-errno);
+}
+
+static int aioWait(struct ioq *q, unsigned int *tag)
+{
+	struct io_event ev;
+	long r;
+
+	do
+		r = syscall(__NR_io_getevents, q->aio, 1, 1, &ev, NULL);
+	while (r < 0 && errno == EINTR);
+	if (r < 0)
+		ioFailed(-errno);
+	if ((long long)ev.res < 0)
+		ioFailed((long)ev.res);
+	q->res = (long)ev.res;
+	*tag = (unsigned int)(ev.data >> 32);
+	return (int)(ev.data & 0xffffffffU);
+}
+
+static void aioClose(struct ioq *q)
+{
+	syscall(__NR_io_destroy, q->aio);
+	free(q->iocbs);
+}
+#endif
+
+#if defined(HAVE_IO_URING)
+/* ---- io_uring */
+
+static int uringEnter(int fd, unsigned int submit, unsigned int wait)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, submit, wait,
+		wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void uringUnmap(struct uring *r)
+{
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED)
+		munmap(r->sq_ptr, r->sq_len);
+	close(r->fd);
+}
+
+static int uringOpen(struct ioq *q)
+{
+	struct io_uring_params p;
+	struct uring *r = &q->ring;
+	struct iovec *iov;
+	unsigned int i;
+	int ret;
+
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->fd = (int)syscall(__NR_io_uring_setup, q->depth, &p);
+	if (r->fd < 0)
+		return -1;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = r->sq_len;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ptr = r->sq_ptr;
+	else
+	{
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			goto fail;
+	}
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail;
+
+	r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	/* Register the block buffers and the target. */
+	iov = CALLOC(struct iovec, q->nbufs);
+	if (iov == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (i = 0; i < q->nbufs; i++)
+	{
+		iov[i].iov_base = q->bufs[i];
+		iov[i].iov_len = q->buflen;
+	}
+	ret = (int)syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, q->nbufs);
+	free(iov);
+	if (ret < 0)
+		goto fail;
+	ret = (int)syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_FILES, &q->fd, 1);
+	if (ret < 0)
+		goto fail;
+
+	/* Hand sqes to the kernel in batches of about an eighth of the queue. */
+	r->batch = q->depth / 8;
+	if (r->batch == 0)
+		r->batch = 1;
+	return 0;
+fail:
+	ret = errno;
+	uringUnmap(r);
+	errno = ret;
+	return -1;
+}
+
+static void uringFlush(struct uring *r)
+{
+	int ret;
+
+	while (r->pending)
+	{
+		ret = uringEnter(r->fd, r->pending, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			ioFailed(-errno);
+		}
+		r->pending -= ret;
+	}
+}
+
+static void uringSubmit(struct ioq *q, int op, unsigned int idx, unsigned int tag,
+	unsigned long len, unsigned long long off)
+{
+	struct uring *r = &q->ring;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, slot;
+
+	tail = *r->sq_tail;
+	slot = tail & *r->sq_mask;
+	sqe = &r->sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = 0;                     /* Index into the registered files. */
+	sqe->addr = (unsigned long)q->bufs[idx];
+	sqe->len = len;
+	sqe->off = off;
+	sqe->buf_index = idx;
+	sqe->user_data = idx | (unsigned long long)tag << 32;
+	r->sq_array[slot] = slot;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	if (++r->pending >= r->batch)
+		uringFlush(r);
+}
+
+static int uringWait(struct ioq *q, unsigned int *tag)
+{
+	struct uring *r = &q->ring;
+	struct io_uring_cqe *cqe;
+	unsigned int head;
+	int res, idx;
+
+	uringFlush(r);
+	for (;;)
+	{
+		head = *r->cq_head;
+		if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+			break;
+		if (uringEnter(r->fd, 0, 1) < 0 && errno != EINTR)
+			ioFailed(-errno);
+	}
+	cqe = &r->cqes[head & *r->cq_mask];
+	res = cqe->res;
+	idx = (int)(cqe->user_data & 0xffffffffU);
+	*tag = (unsigned int)(cqe->user_data >> 32);
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	if (res < 0)
+		ioFailed(res);
+	q->res = res;
+	return idx;
+}
+#endif
+
+/* ---- stream */
+
+/*
+ * Pipe size asked for on sinks, so that many blocks can be in the pipe.
+ */
+#define SINK_PIPE_SIZE	(1024 * 1024)
+
+/*
+ * Open an output sink: "-" or "stdout", "unix:<path>" or
+ * "tcp:[<host>:]<port>", the host defaulting to the loopback address.
+ * comgen connects to a consumer that is already listening.
+ */
+int sinkOpen(const char *spec)
+{
+	struct sockaddr_un sun;
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1, r, sz;
+
+	/* A consumer that goes away is reported as a write error. */
+	signal(SIGPIPE, SIG_IGN);
+	if (strcmp(spec, "-") == 0 || strcmp(spec, "stdout") == 0)
+	{
+		if (isatty(1))
+		{
+			fprintf(stderr, "Refusing to write binary data to a terminal\n");
+			exit(1);
+		}
+		fd = 1;
+#if defined(F_SETPIPE_SZ)
+		fcntl(fd, F_SETPIPE_SZ, SINK_PIPE_SIZE);
+#endif
+	}
+	else if (strncmp(spec, "unix:", 5) == 0)
+	{
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if (strlen(spec + 5) >= sizeof(sun.sun_path))
+		{
+			fprintf(stderr, "Socket path too long: %s\n", spec + 5);
+			exit(1);
+		}
+		strcpy(sun.sun_path, spec + 5);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		{
+			fprintf(stderr, "Error connecting to %s: %s\n", spec, strerror(errno));
+			exit(-2);
+		}
+	}
+	else if (strncmp(spec, "tcp:", 4) == 0)
+	{
+		port = strrchr(spec + 4, ':');
+		if (port == NULL)
+		{
+			strcpy(host, "127.0.0.1");
+			port = spec + 4;
+		}
+		else if ((size_t)(port - (spec + 4)) < sizeof(host))
+		{
+			memcpy(host, spec + 4, port - (spec + 4));
+			host[port - (spec + 4)] = 0;
+			port++;
+		}
+		else
+		{
+			fprintf(stderr, "Host name too long: %s\n", spec + 4);
+			exit(1);
+		}
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		r = getaddrinfo(host, port, &hints, &res);
+		if (r != 0)
+		{
+			fprintf(stderr, "Error resolving %s: %s\n", spec, gai_strerror(r));
+			exit(-2);
+		}
+		for (ai = res; ai != NULL; ai = ai->ai_next)
+		{
+			fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd < 0)
+				continue;
+			if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+				break;
+			close(fd);
+			fd = -1;
+		}
+		freeaddrinfo(res);
+		if (fd < 0)
+		{
+			fprintf(stderr, "Error connecting to %s: %s\n", spec, strerror(errno));
+			exit(-2);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Unknown output '%s', use -, unix:<path> or tcp:[<host>:]<port>.\n", spec);
+		exit(1);
+	}
+	if (fd != 1)
+	{
+		sz = SINK_PIPE_SIZE * 4;
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+	}
+	return fd;
+}
+
+/*
+ * Set up the stream engine. vmsplice() is used when the fd is a pipe and
+ * the bytes still in it can be read back with FIONREAD.
+ */
+static void streamOpen(struct ioq *q)
+{
+#if defined(_linux_)
+	struct stat st;
+	int n;
+
+	if (fstat(q->fd, &st) == 0 && S_ISFIFO(st.st_mode) && ioctl(q->fd, FIONREAD, &n) == 0)
+		q->splice = 1;
+#endif
+	q->ends = CALLOC(unsigned long long, q->depth);
+	if (q->ends == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+}
+
+static void streamWrite(struct ioq *q, unsigned int idx, unsigned long len)
+{
+	unsigned long off = 0;
+	ssize_t ret;
+#if defined(_linux_)
+	struct iovec iov;
+#endif
+
+	while (off < len)
+	{
+#if defined(_linux_)
+		if (q->splice)
+		{
+			iov.iov_base = q->bufs[idx] + off;
+			iov.iov_len = len - off;
+			ret = vmsplice(q->fd, &iov, 1, 0);
+		}
+		else
+#endif
+			ret = write(q->fd, q->bufs[idx] + off, len - off);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ioFailed(-errno);
+		}
+		off += ret;
+	}
+	q->sent += len;
+}
+
+/*
+ * Wait until the reader has taken the first until bytes out of the pipe,
+ * after which a spliced buffer is free to be written again.
+ */
+static void streamDrain(struct ioq *q, unsigned long long until)
+{
+#if defined(_linux_)
+	struct timespec ts = { 0, 20000 };
+	int n;
+
+	while (q->splice)
+	{
+		if (ioctl(q->fd, FIONREAD, &n) != 0 || q->sent - (unsigned long long)n >= until)
+			break;
+		nanosleep(&ts, NULL);
+	}
+#endif
+}
+
+/*
+ * Create a write queue for fd over the given block buffers. With the
+ * io_uring engine the buffers are registered with the kernel, so they
+ * must stay in place until ioqClose().
+ */
+struct ioq *ioqOpen(int engine, int fd, char **bufs, unsigned int nbufs,
+	unsigned long buflen, unsigned int depth)
+{
+	struct ioq *q;
+
+	q = CALLOC(struct ioq, 1);
+	if (q == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	q->fd = fd;
+	q->bufs = bufs;
+	q->nbufs = nbufs;
+	q->buflen = buflen;
+	q->depth = depth ? depth : 1;
+	q->stamp = CALLOC(unsigned long long, q->depth);
+	q->want = CALLOC(long, q->depth);
+	q->tags = CALLOC(unsigned int, q->depth);
+	if (q->stamp == NULL || q->want == NULL || q->tags == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (q->ntags = 0; q->ntags < q->depth; q->ntags++)
+		q->tags[q->ntags] = q->ntags;
+
+	if (engine == IO_ENGINE_STREAM)
+		streamOpen(q);
+#if defined(HAVE_IO_URING)
+	if (engine == IO_ENGINE_IO_URING)
+	{
+		if (uringOpen(q) == 0)
+		{
+			q->engine = IO_ENGINE_IO_URING;
+			return q;
+		}
+		if (!fallback_noted)
+			fprintf(stderr, "io_uring not available (%s), trying libaio\n", strerror(errno));
+		fallback_noted = 1;
+		engine = IO_ENGINE_LIBAIO;
+	}
+#endif
+#if defined(_linux_)
+	if (engine == IO_ENGINE_LIBAIO)
+	{
+		if (aioOpen(q) == 0)
+		{
+			q->engine = IO_ENGINE_LIBAIO;
+			return q;
+		}
+		if (!fallback_noted)
+			fprintf(stderr, "libaio not available (%s), using sync writes\n", strerror(errno));
+		fallback_noted = 1;
+	}
+#endif
+	if (engine != IO_ENGINE_SYNC && engine != IO_ENGINE_STREAM && !fallback_noted)
+	{
+		fprintf(stderr, "%s engine not supported here, using sync writes\n", ioEngineName(engine));
+		fallback_noted = 1;
+	}
+	q->engine = (engine == IO_ENGINE_STREAM) ? IO_ENGINE_STREAM : IO_ENGINE_SYNC;
+	q->done = CALLOC(unsigned int, q->depth);
+	q->done_res = CALLOC(long, q->depth);
+	if (q->done == NULL || q->done_res == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	return q;
+}
+
+/*
+ * Queue a write or read of bufs[idx] at offset off. Each request gets a
+ * tag that finds its submit time again on completion: libaio and
+ * io_uring complete out of order and carry it next to the buffer index,
+ * the other engines complete in order and use their FIFO position.
+ */
+static void ioqSubmit(struct ioq *q, int write, unsigned int idx, unsigned long len, unsigned long long off)
+{
+	unsigned int tag, pos = (q->done_head + q->inflight) % q->depth;
+	ssize_t ret;
+
+	if (q->engine == IO_ENGINE_IO_URING || q->engine == IO_ENGINE_LIBAIO)
+		tag = q->tags[--q->ntags];
+	else
+		tag = pos;
+	q->stamp[tag] = ioNow();
+	q->want[tag] = write ? (long)len : -1;
+	switch (q->engine)
+	{
+#if defined(HAVE_IO_URING)
+	case IO_ENGINE_IO_URING:
+		uringSubmit(q, write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED, idx, tag, len, off);
+		break;
+#endif
+#if defined(_linux_)
+	case IO_ENGINE_LIBAIO:
+		aioSubmit(q, write ? IOCB_CMD_PWRITE : IOCB_CMD_PREAD, idx, tag, len, off);
+		break;
+#endif
+	case IO_ENGINE_STREAM:
+		if (!write)
+		{
+			fprintf(stderr, "Error: the stream engine cannot read\n");
+			exit(-3);
+		}
+		streamWrite(q, idx, len);
+		q->ends[pos] = q->sent;
+		q->done[pos] = idx;
+		q->done_res[pos] = (long)len;
+		break;
+	default:
+		if (write)
+			ret = pwrite(q->fd, q->bufs[idx], len, (off_t)off);
+		else
+			ret = pread(q->fd, q->bufs[idx], len, (off_t)off);
+		if (ret < 0)
+			ioFailed(-errno);
+		if (write && ret != (ssize_t)len)
+			ioShort((long)ret, (long)len);
+		/* Complete already, keep the latency rather than the start. */
+		q->stamp[tag] = ioNow() - q->stamp[tag];
+		q->done[pos] = idx;
+		q->done_res[pos] = (long)ret;
+		break;
+	}
+	q->inflight++;
+}
+
+/*
+ * Queue a write of bufs[idx] at offset off. The caller keeps the number
+ * of writes in flight at or below the queue depth by calling ioqWait().
+ * The same buffer may be in flight more than once.
+ */
+void ioqWrite(struct ioq *q, unsigned int idx, unsigned long len, unsigned long long off)
+{
+	ioqSubmit(q, 1, idx, len, off);
+}
+
+/*
+ * Queue a read of len bytes at offset off into bufs[idx]. ioqResult()
+ * then tells how many bytes arrived, fewer at the end of the target.
+ * The stream engine cannot read.
+ */
+void ioqRead(struct ioq *q, unsigned int idx, unsigned long len, unsigned long long off)
+{
+	ioqSubmit(q, 0, idx, len, off);
+}
+
+/*
+ * Wait for a write to complete and return the index of its buffer, or
+ * -1 when nothing is in flight. A write that moved fewer bytes than it
+ * asked for fails like an I/O error; a short read is left to the caller.
+ */
+int ioqWait(struct ioq *q)
+{
+	unsigned int tag;
+	int idx;
+
+	if (q->inflight == 0)
+		return -1;
+	switch (q->engine)
+	{
+#if defined(HAVE_IO_URING)
+	case IO_ENGINE_IO_URING:
+		idx = uringWait(q, &tag);
+		q->lat = ioNow() - q->stamp[tag];
+		q->tags[q->ntags++] = tag;
+		break;
+#endif
+#if defined(_linux_)
+	case IO_ENGINE_LIBAIO:
+		idx = aioWait(q, &tag);
+		q->lat = ioNow() - q->stamp[tag];
+		q->tags[q->ntags++] = tag;
+		break;
+#endif
+	case IO_ENGINE_STREAM:
+		/* Done when the reader has taken the data. */
+		streamDrain(q, q->ends[q->done_head]);
+		tag = q->done_head;
+		idx = (int)q->done[q->done_head];
+		q->res = q->done_res[q->done_head];
+		q->lat = ioNow() - q->stamp[q->done_head];
+		q->done_head = (q->done_head + 1) % q->depth;
+		break;
+	default:
+		tag = q->done_head;
+		idx = (int)q->done[q->done_head];
+		q->res = q->done_res[q->done_head];
+		q->lat = q->stamp[q->done_head];
+		q->done_head = (q->done_head + 1) % q->depth;
+		break;
+	}
+	if (q->want[tag] >= 0 && q->res != q->want[tag])
+		ioShort(q->res, q->want[tag]);
+	q->inflight--;
+	return idx;
+}
+
+/*
+ * Bytes written or read by the buffer the last ioqWait() returned.
+ */
+long ioqResult(struct ioq *q)
+{
+	return q->res;
+}
+
+/*
+ * Submit to completion time, in nanoseconds, of the buffer the last
+ * ioqWait() returned.
+ */
+unsigned long long ioqLatency(struct ioq *q)
+{
+	return q->lat;
+}
+
+unsigned int ioqInflight(struct ioq *q)
+{
+	return q->inflight;
+}
+
+/*
+ * Engine in use, after any fallback.
+ */
+int ioqEngine(struct ioq *q)
+{
+	return q->engine;
+}
+
+/*
+ * Wait for everything in flight and release the queue.
+ */
+void ioqClose(struct ioq *q)
+{
+	while (ioqWait(q) >= 0)
+		;
+	switch (q->engine)
+	{
+#if defined(HAVE_IO_URING)
+	case IO_ENGINE_IO_URING:
+		uringUnmap(&q->ring);
+		break;
+#endif
+#if defined(_linux_)
+	case IO_ENGINE_LIBAIO:
+		aioClose(q);
+		break;
+#endif
+	default:
+		break;
+	}
+	free(q->done);
+	free(q->done_res);
+	free(q->ends);
+	free(q->stamp);
+	free(q->want);
+	free(q->tags);
+	free(q);
+}
+
+/*
+ * Largest iovec array for one pwritev(), and the most bytes Linux moves
+ * in a single read/write style call.
+ */
+#if defined(IOV_MAX)
+#define REPEAT_IOV	IOV_MAX
+#else
+#define REPEAT_IOV	1024
+#endif
+#define REPEAT_MAX_BYTES	0x7ffff000UL
+
+int ioRepeatByName(const char *name)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (strcmp(name, repeat_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ * Write blocks [first, count) of buf with as few pwritev() calls as the
+ * iovec and byte limits allow. Short writes resume mid block. Returns
+ * the number of whole blocks written, short of count at the end of a device.
+ */
+static unsigned long repeatVector(int fd, char *buf, unsigned long len,
+	unsigned long first, unsigned long count)
+{
+	struct iovec *iov;
+	unsigned long long off, end;
+	unsigned long per, n, i, skip;
+	ssize_t ret;
+
+	per = REPEAT_MAX_BYTES / len;
+	if (per > REPEAT_IOV)
+		per = REPEAT_IOV;
+	if (per == 0)
+		per = 1;
+	iov = CALLOC(struct iovec, per + 1);
+	if (iov == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+
+	off = (unsigned long long)first * len;
+	end = (unsigned long long)count * len;
+	while (off < end)
+	{
+		/* Resume inside a block after a short write. */
+		skip = (unsigned long)(off % len);
+		n = 0;
+		if (skip)
+		{
+			iov[n].iov_base = buf + skip;
+			iov[n].iov_len = len - skip;
+			n++;
+		}
+		for (i = (unsigned long)((off + len - 1) / len); n < per && i < count; i++, n++)
+		{
+			iov[n].iov_base = buf;
+			iov[n].iov_len = len;
+		}
+#if defined(_linux_) || defined(_freebsd_)
+		ret = pwritev(fd, iov, (int)n, (off_t)off);
+#else
+		ret = pwrite(fd, iov[0].iov_base, iov[0].iov_len, (off_t)off);
+#endif
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ioFailed(-errno);
+		}
+		if (ret == 0)
+			break;		/* End of device. */
+		off += ret;
+	}
+	free(iov);
+	return (unsigned long)(off / len);
+}
+
+#if defined(_linux_)
+/*
+ * Copy bytes [0, n) of fd to offset dst inside the kernel, sharing extents
+ * where the filesystem can. Returns 0 on success, -1 if neither cloning
+ * nor copy_file_range() is supported for this file.
+ */
+static int repeatClone(int fd, unsigned long long n, unsigned long long dst)
+{
+	struct file_clone_range fcr;
+	loff_t in, out;
+	ssize_t ret;
+
+	fcr.src_fd = fd;
+	fcr.src_offset = 0;
+	fcr.src_length = n;
+	fcr.dest_offset = dst;
+	if (ioctl(fd, FICLONERANGE, &fcr) == 0)
+		return 0;
+
+	in = 0;
+	out = (loff_t)dst;
+	while (n)
+	{
+		ret = copy_file_range(fd, &in, fd, &out,
+			n > REPEAT_MAX_BYTES ? REPEAT_MAX_BYTES : n, 0);
+		if (ret <= 0)
+			return -1;
+		n -= ret;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Write the len byte block in buf count times to fd, from offset 0.
+ * REPEAT_CLONE writes the first block and then doubles the written range
+ * by cloning it onto the end, falling back to pwritev() for whatever
+ * cannot be cloned. Returns the number of blocks written, fewer than count
+ * when the device ends early.
+ */
+unsigned long ioRepeat(int fd, int mode, char *buf, unsigned long len, unsigned long count)
+{
+	unsigned long done = 0;
+
+	if (count == 0)
+		return 0;
+#if defined(_linux_)
+	if (mode == REPEAT_CLONE)
+	{
+		unsigned long n;
+
+		if (repeatVector(fd, buf, len, 0, 1) < 1)
+			return 0;
+		done = 1;
+		while (done < count)
+		{
+			n = (count - done < done) ? count - done : done;
+			if (repeatClone(fd, (unsigned long long)n * len,
+				(unsigned long long)done * len) != 0)
+			{
+				if (!clone_noted)
+					fprintf(stderr, "Cloning not supported here (%s), using pwritev\n",
+						strerror(errno));
+				clone_noted = 1;
+				break;
+			}
+			done += n;
+		}
+	}
+#endif
+	return repeatVector(fd, buf, len, done, count);
+}
+
+#endif /* !WIN32 */
@@ -0,0 +1,43 @@
+/*
+ * comgen_io.h
+ *
+ * Write engines for comgen. A queue owns a set of block buffers and
+ * keeps up to "depth" writes of them in flight. Buffers come back to the
+ * caller, in completion order, through ioqWait(), along with the bytes
+ * moved and the latency of the request. Reads go through the same
+ * queues, for --verify.
+ */
+#ifndef __COMGEN_IO_H__
+#define __COMGEN_IO_H__
+
+#define IO_ENGINE_SYNC		0	/* pwrite(), queue depth 1		*/
+#define IO_ENGINE_LIBAIO	1	/* Linux native AIO			*/
+#define IO_ENGINE_IO_URING	2	/* io_uring, fixed buffers and files	*/
+#define IO_ENGINE_STREAM	3	/* In order write()/vmsplice(), for sinks	*/
+
+/* How the dedupe patterns repeat their single block. */
+#define REPEAT_WRITE		0	/* One write per block (engine above)	*/
+#define REPEAT_PWRITEV		1	/* pwritev() of many iovecs of the block	*/
+#define REPEAT_CLONE		2	/* Clone written extents, else pwritev	*/
+
+struct ioq;
+
+int ioEngineByName(const char *);
+const char *ioEngineName(int);
+
+struct ioq *ioqOpen(int, int, char **, unsigned int, unsigned long, unsigned int);
+void ioqWrite(struct ioq *, unsigned int, unsigned long, unsigned long long);
+void ioqRead(struct ioq *, unsigned int, unsigned long, unsigned long long);
+int ioqWait(struct ioq *);
+long ioqResult(struct ioq *);
+unsigned long long ioqLatency(struct ioq *);
+unsigned int ioqInflight(struct ioq *);
+int ioqEngine(struct ioq *);
+void ioqClose(struct ioq *);
+
+int sinkOpen(const char *);
+
+int ioRepeatByName(const char *);
+unsigned long ioRepeat(int, int, char *, unsigned long, unsigned long);
+
+#endif
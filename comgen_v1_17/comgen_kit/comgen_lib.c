@@ -0,0 +1,273 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_lib.c
+ *
+ *  libcomgen, the block generation of comgen without its files.
+ *
+ *  comgen runs one Park & Miller stream from the salt through the
+ *  selected patterns in order, file after file. Every pattern uses a
+ *  fixed number of random numbers per block (or per file for the dedupe
+ *  patterns), so the stream position of a block follows from its
+ *  coordinates and the generator can skip straight to it. With a dedupe
+ *  ratio the dedupe patterns refer to pools of unique blocks, which take
+ *  their random numbers from after the end of the stream.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if defined(WIN32)
+#pragma warning(disable:4996)
+#pragma warning(disable:4267)
+#pragma warning(disable:4244)
+#pragma warning(disable:4018)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "comgen_fill.h"
+#include "comgen_entropy.h"
+#include "comgen_dedupe.h"
+#include "comgen_lib.h"
+
+struct comgen_ctx {
+	int base;                /* Generator state right after seeding.	*/
+	unsigned int blcksz;     /* Block size in KiB.				*/
+	unsigned long nblocks;   /* Blocks per file.				*/
+	unsigned long nfiles;    /* Files per pattern.				*/
+	unsigned int patterns;   /* COMGEN_MASK() of the patterns in the set.	*/
+	unsigned long long start[COMGEN_PATTERNS]; /* Stream position of file 0. */
+	struct entropy_plan plan;/* Byte histogram of COMGEN_ENTROPY blocks.	*/
+	int plan_set;
+	unsigned long long end;  /* Stream position after the last file.	*/
+	struct dedupe_plan pool[COMGEN_PATTERNS]; /* References of the dedupe patterns. */
+	unsigned long long pool_start[COMGEN_PATTERNS]; /* Stream position of pool block 0. */
+	int pool_set;
+};
+
+/*
+ * Random numbers consumed by one file of the pattern.
+ */
+static unsigned long long fileDraws(int pattern, unsigned int blcksz, unsigned long nblocks)
+{
+	switch (pattern)
+	{
+	case COMGEN_COMPRESS:	/* fillBlock() for every block */
+		return (unsigned long long)nblocks * fillBlockDraws(blcksz, GRANULE_SIZE);
+	case COMGEN_DEDUPE:	/* fillBlock2() once per file */
+		return fillBlock2Draws(blcksz, GRANULE_SIZE);
+	case COMGEN_BOTH:	/* fillBlock() once per file */
+		return fillBlockDraws(blcksz, GRANULE_SIZE);
+	case COMGEN_IRREDUCIBLE:	/* fillBlock2() for every block */
+		return (unsigned long long)nblocks * fillBlock2Draws(blcksz, GRANULE_SIZE);
+	case COMGEN_ENTROPY:	/* entropyFill() for every block */
+		return nblocks;
+	}
+	return 0;
+}
+
+/*
+ * Context for a data set made with salt (the comgen -s value, 0 for the
+ * default), blcksz KiB blocks, nblocks blocks per file and nfiles files
+ * per pattern. patterns is a mask of COMGEN_MASK() bits, 0 meaning
+ * COMGEN_DEFAULT. Returns NULL when out of memory.
+ */
+struct comgen_ctx *comgen_create(int salt, unsigned int blcksz, unsigned long nblocks,
+	unsigned long nfiles, unsigned int patterns)
+{
+	struct comgen_ctx *ctx;
+	unsigned long long pos = 0;
+	int p;
+
+	/* The fill kernel, unless the program has picked one already. */
+	fillSelectDefault();
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+	if (salt == 0)
+		salt = 79;
+	ctx->base = salt + 10000;
+	ctx->blcksz = blcksz;
+	ctx->nblocks = nblocks;
+	ctx->nfiles = nfiles;
+	ctx->patterns = patterns ? patterns : COMGEN_DEFAULT;
+	for (p = 0; p < COMGEN_PATTERNS; p++)
+	{
+		ctx->start[p] = pos;
+		if (ctx->patterns & COMGEN_MASK(p))
+			pos += nfiles * fileDraws(p, blcksz, nblocks);
+	}
+	ctx->end = pos;
+	return ctx;
+}
+
+/*
+ * Plan COMGEN_ENTROPY blocks with this entropy in bits per byte. chunk is
+ * the size of the shuffled chunks, COMGEN_CHUNK_MIN to COMGEN_CHUNK_MAX,
+ * or 0 for a random one per block. Returns 0 when the blocks get within
+ * 0.01 of the target, -1 for any other chunk, which leaves the context as
+ * it was, or when the block is too small, in which case the closest
+ * histogram is used.
+ */
+int comgen_set_entropy(struct comgen_ctx *ctx, double entropy, unsigned int chunk)
+{
+	int r;
+
+	if (chunk != 0 && (chunk < COMGEN_CHUNK_MIN || chunk > COMGEN_CHUNK_MAX))
+		return -1;
+	r = entropyPlan(&ctx->plan, ctx->blcksz * 1024UL, entropy);
+	ctx->plan.chunk = chunk;
+	ctx->plan_set = 1;
+	return r;
+}
+
+/*
+ * Entropy every COMGEN_ENTROPY block has.
+ */
+double comgen_entropy(const struct comgen_ctx *ctx)
+{
+	return ctx->plan.achieved;
+}
+
+/*
+ * Give the dedupe patterns in the set a dedupe ratio: the blocks of all
+ * files of a pattern refer to a pool of ratio times fewer unique blocks,
+ * each used at least once, popular after dist (COMGEN_UNIFORM or
+ * COMGEN_ZIPF with exponent s). The blocks of a pool are filled like
+ * those of the pattern, from stream positions past all of the files.
+ * Returns 0, or -1 for a ratio below 1 or a bad exponent.
+ */
+int comgen_set_dedupe(struct comgen_ctx *ctx, double ratio, int dist, double s)
+{
+	unsigned long long pos = ctx->end;
+	int p;
+
+	for (p = COMGEN_DEDUPE; p <= COMGEN_BOTH; p++)
+	{
+		if (dedupePlan(&ctx->pool[p], (unsigned long long)ctx->nfiles * ctx->nblocks, ratio,
+			dist == COMGEN_ZIPF ? DEDUPE_ZIPF : DEDUPE_UNIFORM, s,
+			(unsigned long long)ctx->base << 8 | p) != 0)
+			return -1;
+		ctx->pool_start[p] = pos;
+		if (ctx->patterns & COMGEN_MASK(p))
+			pos += ctx->pool[p].nunique * fileDraws(p, ctx->blcksz, ctx->nblocks);
+	}
+	ctx->pool_set = 1;
+	return 0;
+}
+
+/*
+ * Unique blocks of the pattern: the pool size under a dedupe ratio, one
+ * per file for the dedupe patterns without, every block otherwise.
+ */
+unsigned long long comgen_unique_blocks(const struct comgen_ctx *ctx, int pattern)
+{
+	if (pattern == COMGEN_DEDUPE || pattern == COMGEN_BOTH)
+		return ctx->pool_set ? ctx->pool[pattern].nunique : ctx->nfiles;
+	return (unsigned long long)ctx->nfiles * ctx->nblocks;
+}
+
+unsigned long comgen_block_size(const struct comgen_ctx *ctx)
+{
+	return ctx->blcksz * 1024UL;
+}
+
+/*
+ * Generator state the fill of the given block starts from. For the
+ * dedupe patterns every block of a file holds the same data, so the
+ * block number is ignored, unless a dedupe ratio is set; the block then
+ * starts at the pool block it refers to.
+ */
+int comgen_seed(const struct comgen_ctx *ctx, int pattern, unsigned long file, unsigned long block)
+{
+	unsigned long long pos;
+
+	if (ctx->pool_set && (pattern == COMGEN_DEDUPE || pattern == COMGEN_BOTH))
+	{
+		pos = dedupeRef(&ctx->pool[pattern], (unsigned long long)file * ctx->nblocks + block);
+		pos = ctx->pool_start[pattern] + pos * fileDraws(pattern, ctx->blcksz, ctx->nblocks);
+		return _park_miller_skip(ctx->base, pos);
+	}
+	pos = ctx->start[pattern] + file * fileDraws(pattern, ctx->blcksz, ctx->nblocks);
+	if (pattern == COMGEN_COMPRESS)
+		pos += (unsigned long long)block * fillBlockDraws(ctx->blcksz, GRANULE_SIZE);
+	else if (pattern == COMGEN_IRREDUCIBLE)
+		pos += (unsigned long long)block * fillBlock2Draws(ctx->blcksz, GRANULE_SIZE);
+	else if (pattern == COMGEN_ENTROPY)
+		pos += block;
+	return _park_miller_skip(ctx->base, pos);
+}
+
+/* Fill one whole block. */
+static void fillOne(const struct comgen_ctx *ctx, int pattern, unsigned long file,
+	unsigned long block, void *buf)
+{
+	int seed = comgen_seed(ctx, pattern, file, block);
+
+	switch (pattern)
+	{
+	case COMGEN_COMPRESS:
+	case COMGEN_BOTH:
+		fillBlock_r(ctx->blcksz, buf, GRANULE_SIZE, &seed);
+		break;
+	case COMGEN_DEDUPE:
+	case COMGEN_IRREDUCIBLE:
+		fillBlock2_r(ctx->blcksz, buf, GRANULE_SIZE, &seed);
+		break;
+	case COMGEN_ENTROPY:
+		entropyFill(&ctx->plan, buf, seed);
+		break;
+	}
+}
+
+/*
+ * Fill len bytes of buf with the data of the file, starting at block
+ * block. len need not be a whole number of blocks, but whole blocks
+ * are filled in place and are fastest. Returns 0, or -1 for a pattern
+ * that is not in the set, a range outside the file, an entropy pattern
+ * without comgen_set_entropy() or when out of memory.
+ */
+int comgen_fill(const struct comgen_ctx *ctx, int pattern, unsigned long file,
+	unsigned long block, void *buf, unsigned long len)
+{
+	unsigned long bls = ctx->blcksz * 1024UL, n;
+	char *out = buf, *tmp;
+
+	if (pattern < 0 || pattern >= COMGEN_PATTERNS || !(ctx->patterns & COMGEN_MASK(pattern)))
+		return -1;
+	if (file >= ctx->nfiles || bls == 0)
+		return -1;
+	if (block > ctx->nblocks || (len + bls - 1) / bls > ctx->nblocks - block)
+		return -1;
+	if (pattern == COMGEN_ENTROPY && !ctx->plan_set)
+		return -1;
+
+	for (n = 0; len >= bls; n++, out += bls, len -= bls)
+	{
+		/* The dedupe patterns repeat the first block of the file. */
+		if (n > 0 && !ctx->pool_set && (pattern == COMGEN_DEDUPE || pattern == COMGEN_BOTH))
+			memcpy(out, buf, bls);
+		else
+			fillOne(ctx, pattern, file, block + n, out);
+	}
+	if (len > 0)
+	{
+		tmp = malloc(bls);
+		if (tmp == NULL)
+			return -1;
+		fillOne(ctx, pattern, file, block + n, tmp);
+		memcpy(out, tmp, len);
+		free(tmp);
+	}
+	return 0;
+}
+
+void comgen_destroy(struct comgen_ctx *ctx)
+{
+	free(ctx);
+}
@@ -0,0 +1,46 @@
+/*
+ * comgen_lib.h
+ *
+ * libcomgen: the comgen data set as a function of its coordinates. A
+ * context holds the salt, block size, file size and the patterns of a
+ * data set; comgen_fill() then produces any block of any file, the same
+ * bytes the comgen program writes for it, without generating what comes
+ * before. The context is read only once set up, so several threads can
+ * fill from one context.
+ */
+#ifndef __COMGEN_LIB_H__
+#define __COMGEN_LIB_H__
+
+/* Patterns, in the order comgen generates them. */
+#define COMGEN_COMPRESS		0	/* Compress_no_dedupe_N.dat		*/
+#define COMGEN_DEDUPE		1	/* Dedupe_no_compress_N.dat		*/
+#define COMGEN_BOTH		2	/* Compress_and_dedupe_N.dat		*/
+#define COMGEN_IRREDUCIBLE	3	/* Irreducible_N.dat			*/
+#define COMGEN_ENTROPY		4	/* Entropy_N.dat, see comgen_set_entropy() */
+#define COMGEN_PATTERNS		5
+
+/* Pattern masks for comgen_create(). */
+#define COMGEN_MASK(p)		(1U << (p))
+#define COMGEN_DEFAULT		0x0fU	/* What comgen makes without -C/-D/-B/-I/-E */
+
+/* Popularity of the unique blocks, see comgen_set_dedupe(). */
+#define COMGEN_UNIFORM		0
+#define COMGEN_ZIPF		1
+
+/* Shuffled chunk sizes of comgen_set_entropy(), 0 picks one per block. */
+#define COMGEN_CHUNK_MIN	3
+#define COMGEN_CHUNK_MAX	8
+
+struct comgen_ctx;
+
+struct comgen_ctx *comgen_create(int, unsigned int, unsigned long, unsigned long, unsigned int);
+int comgen_set_entropy(struct comgen_ctx *, double, unsigned int);
+double comgen_entropy(const struct comgen_ctx *);
+int comgen_set_dedupe(struct comgen_ctx *, double, int, double);
+unsigned long long comgen_unique_blocks(const struct comgen_ctx *, int);
+unsigned long comgen_block_size(const struct comgen_ctx *);
+int comgen_seed(const struct comgen_ctx *, int, unsigned long, unsigned long);
+int comgen_fill(const struct comgen_ctx *, int, unsigned long, unsigned long, void *, unsigned long);
+void comgen_destroy(struct comgen_ctx *);
+
+#endif
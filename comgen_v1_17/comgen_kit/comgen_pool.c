@@ -0,0 +1,318 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_pool.c
+ *
+ *  Block buffer pool for comgen.
+ *
+ *  The buffers of a run are cut from one anonymous mapping, so there is
+ *  no allocation per file or per block and the original mapping is kept
+ *  for poolDestroy(). The mapping is tried, in order, with 1 GiB and
+ *  2 MiB hugetlb pages, then as normal pages with MADV_HUGEPAGE so that
+ *  transparent hugepages may back it; large blocks then take a fraction
+ *  of the TLB misses. COMGEN_HUGEPAGES=off, 2m or 1g limits the choice.
+ *
+ *  On a NUMA host the pool is bound, preferred rather than strict, to the
+ *  node of the device being written, and the threads are pinned to that
+ *  node's CPUs so that blocks are filled and written without crossing
+ *  the interconnect. Pages are not touched here: without a device node
+ *  they are first touched, and so placed, by the thread filling them.
+ *  COMGEN_NUMA=off disables this, COMGEN_NUMA=<node> picks the node.
+ *
+ *  mbind() and the hugepage flags are used through the raw system calls
+ *  and /sys, so libnuma is not needed.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#if defined(_linux_)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+#include "comgen_pool.h"
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS	MAP_ANON
+#endif
+#if !defined(MAP_HUGE_SHIFT)
+#define MAP_HUGE_SHIFT	26
+#endif
+
+#define SZ_2M		(2UL * 1024 * 1024)
+#define SZ_1G		(1024UL * 1024 * 1024)
+#define MPOL_PREFERRED	1
+#define MAX_NODES	1024
+
+struct bufpool {
+	char *base;              /* First buffer.				*/
+	void *map;               /* The mapping, for munmap().			*/
+	unsigned long maplen;
+	unsigned long stride;    /* Buffer length rounded up to a page.	*/
+	unsigned int nbufs;
+	int backing;             /* POOL_*.					*/
+};
+
+static const char *backing_names[] = {
+	"pages", "transparent hugepages", "2 MiB hugepages", "1 GiB hugepages"
+};
+
+const char *poolBackingName(int b)
+{
+	if (b < POOL_PAGES || b > POOL_HUGE_1G)
+		return "unknown";
+	return backing_names[b];
+}
+
+static unsigned long roundUp(unsigned long x, unsigned long to)
+{
+	return (x + to - 1) / to * to;
+}
+
+#if defined(_linux_)
+/*
+ * Try a hugetlb mapping of len bytes with pages of 2^shift bytes.
+ */
+static int poolHugetlb(struct bufpool *p, unsigned long len, int shift)
+{
+	unsigned long maplen = roundUp(len, 1UL << shift);
+	void *m;
+
+	m = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+	if (m == MAP_FAILED)
+		return -1;
+	p->map = m;
+	p->maplen = maplen;
+	p->base = m;
+	return 0;
+}
+
+/*
+ * Prefer node for the pages of the pool. Nothing has been touched yet,
+ * so every page is allocated under the policy.
+ */
+static void poolBind(struct bufpool *p, int node)
+{
+	unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+
+	if (node < 0 || node >= MAX_NODES)
+		return;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(__NR_mbind, p->map, p->maplen, MPOL_PREFERRED, mask, MAX_NODES, 0) != 0)
+		fprintf(stderr, "Could not bind buffers to node %d: %s\n", node, strerror(errno));
+}
+#endif
+
+/*
+ * Create a pool of nbufs buffers of buflen bytes each, page aligned,
+ * preferably on NUMA node node (-1 for no preference).
+ */
+struct bufpool *poolCreate(unsigned long buflen, unsigned int nbufs, int node)
+{
+	struct bufpool *p;
+	const char *env = getenv("COMGEN_HUGEPAGES");
+	long pg = sysconf(_SC_PAGESIZE);
+	unsigned long len;
+	int max = POOL_HUGE_1G;
+	char *m;
+
+	if (env != NULL)
+	{
+		if (strcmp(env, "off") == 0)
+			max = POOL_PAGES;
+		else if (strcmp(env, "2m") == 0)
+			max = POOL_HUGE_2M;
+	}
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return NULL;
+	if (pg <= 0)
+		pg = 4096;
+	p->nbufs = nbufs ? nbufs : 1;
+	p->stride = roundUp(buflen ? buflen : 1, (unsigned long)pg);
+	len = p->stride * p->nbufs;
+
+#if defined(_linux_)
+	/* Hugetlb pages only when the pool fills at least half of one. */
+	if (max >= POOL_HUGE_1G && len >= SZ_1G / 2 && poolHugetlb(p, len, 30) == 0)
+		p->backing = POOL_HUGE_1G;
+	else if (max >= POOL_HUGE_2M && len >= SZ_2M / 2 && poolHugetlb(p, len, 21) == 0)
+		p->backing = POOL_HUGE_2M;
+	else
+#endif
+	{
+		/*
+		 * 2 MiB aligned and a whole number of 2 MiB pages, so that
+		 * transparent hugepages can back all of it.
+		 */
+		p->maplen = len >= SZ_2M ? roundUp(len, SZ_2M) + SZ_2M : len;
+		p->map = mmap(NULL, p->maplen, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p->map == MAP_FAILED)
+		{
+			free(p);
+			return NULL;
+		}
+		m = p->map;
+		p->backing = POOL_PAGES;
+		if (len >= SZ_2M)
+		{
+			m = (char *)roundUp((unsigned long)m, SZ_2M);
+#if defined(MADV_HUGEPAGE)
+			if (max > POOL_PAGES && madvise(m, roundUp(len, SZ_2M), MADV_HUGEPAGE) == 0)
+				p->backing = POOL_THP;
+#endif
+		}
+		p->base = m;
+	}
+#if defined(_linux_)
+	poolBind(p, node);
+#endif
+	return p;
+}
+
+char *poolBuf(struct bufpool *p, unsigned int i)
+{
+	return p->base + (unsigned long)(i % p->nbufs) * p->stride;
+}
+
+unsigned int poolCount(struct bufpool *p)
+{
+	return p->nbufs;
+}
+
+int poolBacking(struct bufpool *p)
+{
+	return p->backing;
+}
+
+void poolDestroy(struct bufpool *p)
+{
+	if (p == NULL)
+		return;
+	munmap(p->map, p->maplen);
+	free(p);
+}
+
+/*
+ * Number of NUMA nodes with memory, 1 when it cannot be told.
+ */
+int poolNumaNodes(void)
+{
+	int n = 0;
+#if defined(_linux_)
+	struct dirent *d;
+	DIR *dir;
+
+	dir = opendir("/sys/devices/system/node");
+	if (dir == NULL)
+		return 1;
+	while ((d = readdir(dir)) != NULL)
+		if (strncmp(d->d_name, "node", 4) == 0 && d->d_name[4] >= '0' && d->d_name[4] <= '9')
+			n++;
+	closedir(dir);
+#endif
+	return n > 0 ? n : 1;
+}
+
+/*
+ * The node to place a run on that writes to the block device dev (the
+ * st_rdev of a device, the st_dev of a file), or -1 for none: a single
+ * node host, COMGEN_NUMA=off, or a device without a node such as tmpfs,
+ * md or dm. COMGEN_NUMA=<node> overrides the device.
+ */
+int poolNodeOfDevice(unsigned long dev)
+{
+	const char *env = getenv("COMGEN_NUMA");
+#if defined(_linux_)
+	/* Partitions and NVMe namespaces keep the node further up. */
+	static const char *where[] = {
+		"device/numa_node", "device/device/numa_node",
+		"../device/numa_node", "../device/device/numa_node", NULL
+	};
+	char path[128];
+	FILE *fp;
+	int i, node;
+#endif
+
+	if (env != NULL && strcmp(env, "off") == 0)
+		return -1;
+	if (env != NULL && *env >= '0' && *env <= '9')
+		return atoi(env);
+	if (poolNumaNodes() < 2)
+		return -1;
+#if defined(_linux_)
+	for (i = 0; where[i] != NULL; i++)
+	{
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s",
+			major((dev_t)dev), minor((dev_t)dev), where[i]);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			continue;
+		if (fscanf(fp, "%d", &node) != 1)
+			node = -1;
+		fclose(fp);
+		if (node >= 0)
+			return node;
+	}
+#endif
+	return -1;
+}
+
+/*
+ * Pin the calling thread, and the threads it creates from now on, to the
+ * CPUs of node. Returns 0 on success.
+ */
+int poolPinNode(int node)
+{
+#if defined(_linux_)
+	char path[128], list[4096], *s, *e;
+	unsigned long a, b;
+	cpu_set_t set;
+	FILE *fp;
+
+	if (node < 0)
+		return -1;
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	if (fgets(list, sizeof(list), fp) == NULL)
+		list[0] = 0;
+	fclose(fp);
+
+	/* "0-3,8-11" */
+	CPU_ZERO(&set);
+	for (s = list; *s >= '0' && *s <= '9'; s = e + (*e == ','))
+	{
+		a = b = strtoul(s, &e, 10);
+		if (*e == '-')
+			b = strtoul(e + 1, &e, 10);
+		for (; a <= b && a < CPU_SETSIZE; a++)
+			CPU_SET(a, &set);
+	}
+	if (CPU_COUNT(&set) == 0)
+		return -1;
+	return sched_setaffinity(0, sizeof(set), &set);
+#else
+	return -1;
+#endif
+}
+#endif
@@ -0,0 +1,31 @@
+/*
+ * comgen_pool.h
+ *
+ * Block buffer pool. A pool is one region cut into equally sized, page
+ * aligned buffers, allocated once and used for the whole run. The region
+ * is backed by 1 GiB or 2 MiB hugepages when the system has them, and is
+ * placed on a NUMA node when one is given.
+ */
+#ifndef __COMGEN_POOL_H__
+#define __COMGEN_POOL_H__
+
+/* Backing of a pool, see poolBacking(). */
+#define POOL_PAGES		0	/* Normal pages				*/
+#define POOL_THP		1	/* Transparent hugepages (madvise)	*/
+#define POOL_HUGE_2M		2	/* 2 MiB hugetlb pages			*/
+#define POOL_HUGE_1G		3	/* 1 GiB hugetlb pages			*/
+
+struct bufpool;
+
+struct bufpool *poolCreate(unsigned long, unsigned int, int);
+char *poolBuf(struct bufpool *, unsigned int);
+unsigned int poolCount(struct bufpool *);
+int poolBacking(struct bufpool *);
+const char *poolBackingName(int);
+void poolDestroy(struct bufpool *);
+
+int poolNumaNodes(void);
+int poolNodeOfDevice(unsigned long);
+int poolPinNode(int);
+
+#endif
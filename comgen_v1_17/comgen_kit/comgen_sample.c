@@ -0,0 +1,321 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_sample.c
+ *
+ *  Sampled block entropy, the native counterpart of sample_ent.py.
+ *
+ *  The sample is n = ratio * len bytes, byte i taken at a random offset
+ *  in the i-th of n equal strides, for any ratio and block length. The
+ *  entropy of the sample histogram (the plug-in estimate) falls short of
+ *  the block's, the more so the smaller the sample and the more byte
+ *  values the block has, which is what the sample_ent_adjust table of
+ *  sample_ent.py made up for at two ratios. Two corrections replace it:
+ *
+ *  mm   Miller-Madow: plus (m - 1) / 2n nats, m being the byte values
+ *       seen. The interval is the delta method standard error of the
+ *       plug-in estimate, widened on the low side by a quarter of the
+ *       correction, on the high side by the correction once more and by
+ *       what the byte values not seen could add: the block's bytes
+ *       outside the values seen are taken to be the Good-Turing missing
+ *       mass, the share of values seen once, or 3 / n (the rule of three)
+ *       when larger. Below a few bytes per byte value that still falls
+ *       short, so the high side is also at least the Chao-Shen estimate,
+ *       which scales the sample down to its coverage and weighs each
+ *       value by the chance that the sample saw it, plus twice the
+ *       standard error. Calibrated on the blocks of every comgen pattern
+ *       and random blocks, 4 to 128 KiB sampled at 2 to 25%, the interval
+ *       holds the block's entropy 95% of the time or more from SAMPLE_MIN
+ *       sampled bytes on.
+ *  nsb  The Wolpert-Wolf posterior mean of the entropy under symmetric
+ *       Dirichlet priors, averaged over the concentration with the prior
+ *       of Nemenman, Shafee and Bialek, which is flat in the expected
+ *       entropy, and weighted by the evidence of the sample. It does much
+ *       better on samples of a few bytes per byte value, but a block of
+ *       one dominant value over a flat rest fits no single Dirichlet
+ *       and comes out high. The interval covers both the spread of the
+ *       mixture and the Miller-Madow interval.
+ *
+ *  Both estimate the entropy of the block itself, a finite population
+ *  sampled without replacement: the corrections and errors are scaled by
+ *  the finite population factor (len - n) / (len - 1), so a sample of the
+ *  whole block gives its exact entropy.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if defined(WIN32)
+#pragma warning(disable:4996)
+#pragma warning(disable:4267)
+#pragma warning(disable:4244)
+#pragma warning(disable:4018)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "comgen_sample.h"
+#include "comgen_hist.h"
+#include "comgen_dedupe.h"
+
+#define LN2		0.69314718055994531
+#define NSB_POINTS	48       /* Concentrations, log spaced,		*/
+#define NSB_MIN		1e-4     /* from this				*/
+#define NSB_MAX		1e4      /* to this.				*/
+#define UNSEEN		3.0      /* -ln(0.05), the rule of three.	*/
+
+/*
+ * Plan the sample of a block of len bytes at ratio, 0 < ratio <= 1.
+ */
+void samplePlan(struct sample_plan *p, unsigned long len, double ratio)
+{
+	double n = ratio * len + 0.5;
+
+	p->len = len;
+	p->n = n < 1 ? 1 : n > len ? len : (unsigned long)n;
+	if (len == 0)
+		p->n = 0;
+	p->stride = p->n ? len / p->n : 0;
+	p->rem = p->n ? len % p->n : 0;
+}
+
+/*
+ * Histogram of the sample of a block into count[256]. Byte i is at a
+ * random offset in [i * len / n, (i + 1) * len / n), stepped without a
+ * division per byte. The offsets come from seed, so a block sampled
+ * again with the same seed gives the same histogram, and a stride never
+ * lines up with a period of the data.
+ */
+void sampleCounts(const struct sample_plan *p, const void *block, unsigned long long seed, unsigned long *count)
+{
+	const unsigned char *b = block;
+	unsigned long i, start, width, err;
+	unsigned long long r;
+
+	if (p->n == p->len)
+	{
+		byteHist(block, p->len, count);
+		return;
+	}
+	memset(count, 0, 256 * sizeof(*count));
+	start = 0;
+	err = 0;
+	seed = mixHash(seed);
+	for (i = 0; i < p->n; i++)
+	{
+		width = p->stride;
+		err += p->rem;
+		if (err >= p->n)
+		{
+			width++;
+			err -= p->n;
+		}
+		r = mixHash(seed + i) >> 32;
+		count[b[start + (unsigned long)((r * width) >> 32)]]++;
+		start += width;
+	}
+}
+
+/* log(gamma(x)), x > 0, by Stirling's series after shifting x up. */
+static double logGamma(double x)
+{
+	double shift = 0, r;
+
+	while (x < 7)
+	{
+		shift += log(x);
+		x += 1;
+	}
+	r = 1 / (x * x);
+	return (x - 0.5) * log(x) - x + 0.91893853320467274 +
+		(1.0 / 12 - r * (1.0 / 360 - r / 1260)) / x - shift;
+}
+
+/* The digamma function, x > 0. */
+static double digamma(double x)
+{
+	double shift = 0, r;
+
+	while (x < 6)
+	{
+		shift -= 1 / x;
+		x += 1;
+	}
+	r = 1 / (x * x);
+	return log(x) - 0.5 / x - r * (1.0 / 12 - r * (1.0 / 120 - r * (1.0 / 252 - r / 240))) + shift;
+}
+
+/* The trigamma function, x > 0. */
+static double trigamma(double x)
+{
+	double shift = 0, r;
+
+	while (x < 6)
+	{
+		shift += 1 / (x * x);
+		x += 1;
+	}
+	r = 1 / (x * x);
+	return 1 / x + r / 2 + (1.0 / 6 - r * (1.0 / 30 - r * (1.0 / 42 - r / 30))) / (x * x * x) + shift;
+}
+
+static int countOrder(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * NSB posterior mean entropy, in nats, of the m counts c[] (the values
+ * not seen being 0) over n bytes, and its variance over the mixture.
+ * Equal counts are summed once, with their multiplicity; c[] is sorted.
+ */
+static double nsbEntropy(unsigned long *c, unsigned int m, unsigned long n, double *var)
+{
+	double la[NSB_POINTS], h[NSB_POINTS], mult[256], a, A, ev, w, wsum = 0, mean = 0, sq = 0, top;
+	unsigned int k, nd = 0;
+	int j;
+
+	qsort(c, m, sizeof(*c), countOrder);
+	for (k = 0; k < m; k++)
+	{
+		if (nd > 0 && c[nd - 1] == c[k])
+			mult[nd - 1] += 1;
+		else
+		{
+			c[nd] = c[k];
+			mult[nd++] = 1;
+		}
+	}
+	for (j = 0; j < NSB_POINTS; j++)
+	{
+		a = NSB_MIN * pow(NSB_MAX / NSB_MIN, (double)j / (NSB_POINTS - 1));
+		A = n + 256 * a;
+		/* log evidence of the counts, and the prior d xi / d log a. */
+		ev = logGamma(256 * a) - logGamma(A) - m * logGamma(a);
+		h[j] = digamma(A + 1) - (256 - m) * (a / A) * digamma(a + 1);
+		for (k = 0; k < nd; k++)
+		{
+			ev += mult[k] * logGamma(c[k] + a);
+			h[j] -= mult[k] * (c[k] + a) / A * digamma(c[k] + a + 1);
+		}
+		w = a * (256 * trigamma(256 * a + 1) - trigamma(a + 1));
+		la[j] = ev + log(w > 0 ? w : 1e-300);
+	}
+	top = la[0];
+	for (j = 1; j < NSB_POINTS; j++)
+		if (la[j] > top)
+			top = la[j];
+	for (j = 0; j < NSB_POINTS; j++)
+	{
+		w = exp(la[j] - top);
+		wsum += w;
+		mean += w * h[j];
+		sq += w * h[j] * h[j];
+	}
+	mean /= wsum;
+	*var = sq / wsum - mean * mean;
+	if (*var < 0)
+		*var = 0;
+	return mean;
+}
+
+/*
+ * Estimate, with the given estimator, the entropy of a block of len
+ * bytes from the histogram count[256] of an n byte sample of it.
+ */
+void sampleEstimate(const unsigned long *count, unsigned long n, unsigned long len, int estimator,
+	struct sample_estimate *e)
+{
+	unsigned long c[256];
+	double p, lp, s1 = 0, s2 = 0, fpc, var, nvar, mm, h, u, hu, cov, cs;
+	unsigned int m = 0, f1 = 0;
+	int i;
+
+	memset(e, 0, sizeof(*e));
+	e->n = n;
+	if (n == 0)
+		return;
+	for (i = 0; i < 256; i++)
+	{
+		if (count[i] == 0)
+			continue;
+		c[m++] = count[i];
+		f1 += count[i] == 1;
+		p = (double)count[i] / n;
+		lp = log(p);
+		s1 -= p * lp;
+		s2 += p * lp * lp;
+	}
+	e->support = m;
+	e->plugin = s1 / LN2;
+	fpc = len > 1 && len > n ? (double)(len - n) / (len - 1) : 0;
+	var = fpc * (s2 - s1 * s1) / n;
+	if (var < 0)
+		var = 0;
+
+	mm = s1 + fpc * (m - 1) / (2.0 * n);
+	e->value = mm / LN2;
+	/*
+	 * The first order correction falls short by up to its own size, and
+	 * overshoots by up to a quarter of it when many values are rare.
+	 */
+	e->lo = (mm - (mm - s1) / 4 - SAMPLE_Z * sqrt(var)) / LN2;
+	e->hi = (mm + (mm - s1) + SAMPLE_Z * sqrt(var)) / LN2;
+
+	/* A share u of the block spread over the values not seen adds this. */
+	if (fpc > 0 && m < 256)
+	{
+		u = fpc * (f1 > UNSEEN ? f1 : UNSEEN) / n;
+		if (u > 0.99)
+			u = 0.99;
+		hu = (1 - u) * s1 - u * log(u) - (1 - u) * log(1 - u) + u * log(256.0 - m);
+		if (hu / LN2 > e->hi)
+			e->hi = hu / LN2;
+	}
+
+	/* Chao-Shen: the sample covers cov of the block, by Good-Turing. */
+	if (fpc > 0)
+	{
+		cov = 1 - (double)(f1 < n ? f1 : n - 1) / n;
+		cs = 0;
+		for (i = 0; i < 256; i++)
+		{
+			if (count[i] == 0)
+				continue;
+			p = cov * count[i] / n;
+			cs -= p * log(p) / (1 - pow(1 - p, (double)n));
+		}
+		cs = s1 + fpc * (cs - s1);
+		if ((cs + 2 * SAMPLE_Z * sqrt(var)) / LN2 > e->hi)
+			e->hi = (cs + 2 * SAMPLE_Z * sqrt(var)) / LN2;
+	}
+
+	if (estimator == SAMPLE_NSB && fpc > 0)
+	{
+		h = nsbEntropy(c, m, n, &nvar);
+		h = s1 + fpc * (h - s1);
+		nvar = sqrt(var + fpc * nvar);
+		e->value = h / LN2;
+		if ((h - SAMPLE_Z * nvar) / LN2 < e->lo)
+			e->lo = (h - SAMPLE_Z * nvar) / LN2;
+		if ((h + SAMPLE_Z * nvar) / LN2 > e->hi)
+			e->hi = (h + SAMPLE_Z * nvar) / LN2;
+	}
+	if (e->value > 8)
+		e->value = 8;
+	if (e->lo < 0)
+		e->lo = 0;
+	if (e->hi > 8)
+		e->hi = 8;
+	if (e->lo > e->value)
+		e->lo = e->value;
+	if (e->hi < e->value)
+		e->hi = e->value;
+}
@@ -0,0 +1,39 @@
+/*
+ * comgen_sample.h
+ *
+ * Entropy of a block estimated from a sample of its bytes, the way an
+ * inline compressor decides whether a block is worth compressing. The
+ * sample is one byte at a seeded random place in each of n even strides,
+ * for any fraction of any block length; the estimate corrects the bias
+ * of a small sample and comes with a confidence interval.
+ */
+#ifndef __COMGEN_SAMPLE_H__
+#define __COMGEN_SAMPLE_H__
+
+#define SAMPLE_MM	0	/* Miller-Madow bias correction.		*/
+#define SAMPLE_NSB	1	/* Mixture of Dirichlet priors, as NSB.		*/
+
+#define SAMPLE_Z	1.96	/* The intervals are 95%, two sided,		*/
+#define SAMPLE_MIN	160	/* from this many bytes sampled on.		*/
+
+struct sample_plan {
+	unsigned long len;       /* Block length in bytes.			*/
+	unsigned long n;         /* Bytes sampled, 1 to len.			*/
+	unsigned long stride;    /* Whole part of len / n.			*/
+	unsigned long rem;       /* len % n, spread by the position stepping.	*/
+};
+
+struct sample_estimate {
+	unsigned long n;         /* Bytes sampled.				*/
+	unsigned int support;    /* Byte values seen.				*/
+	double plugin;           /* Entropy of the sample histogram.		*/
+	double value;            /* Corrected estimate, bits per byte.		*/
+	double lo, hi;           /* Confidence interval of value.		*/
+};
+
+void samplePlan(struct sample_plan *, unsigned long, double);
+void sampleCounts(const struct sample_plan *, const void *, unsigned long long, unsigned long *);
+void sampleEstimate(const unsigned long *, unsigned long, unsigned long, int,
+	struct sample_estimate *);
+
+#endif
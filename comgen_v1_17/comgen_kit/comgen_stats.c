@@ -0,0 +1,561 @@
+/*
+ * -----------------------------------------------------------------------------
+ *  comgen_stats.c
+ *
+ *  --stats instrumentation for comgen.
+ *
+ *  For every file the time spent filling blocks, per fill thread, and the
+ *  time the writer spends submitting and waiting for writes are summed,
+ *  and the latency of every write, from submission to completion, goes
+ *  into an HDR style histogram. A reporter thread emits progress every
+ *  interval: throughput over the last interval, ETA and the writes in
+ *  flight, so write stalls during long preconditioning runs show up as
+ *  they happen. With --jobs every job has its own file counters, and the
+ *  progress is the sum over the files being written.
+ *
+ *  The sink is either JSON lines, one object per progress tick, finished
+ *  file and for the whole run, or a Prometheus textfile ("prom:path")
+ *  that is replaced atomically on every update, for the node exporter's
+ *  textfile collector.
+ *
+ *  Copyright 2009-2016 SNIA. All rights reserved.
+ *
+ *  This program is licensed under the BSD license.
+ *  No warranties made or implied.
+ * -----------------------------------------------------------------------------
+ */
+
+#if !defined(WIN32)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "comgen_stats.h"
+
+#define CALLOC(typ, n)  (typ*)(calloc((n), sizeof(typ)))
+
+/* Counters of a file, or of the whole run. */
+struct stats_set {
+	unsigned long long bytes;
+	unsigned long long writes;
+	unsigned long long write_ns;    /* Writer in submit and wait.	*/
+	unsigned long long *fill_ns;    /* Per fill thread.		*/
+	struct lat_hist lat;
+};
+
+/* The file a job is writing. */
+struct stats_job {
+	struct stats_set set;
+	char name[256];
+	unsigned long long start;
+	unsigned int inflight;   /* Writes in flight after the last submit.	*/
+};
+
+static struct {
+	int on;
+	int prom;                /* Prometheus textfile, else JSON lines.	*/
+	FILE *fp;                /* JSON lines stream.				*/
+	char *path;              /* Prometheus textfile.			*/
+	char *tmp;
+	double interval;         /* Seconds between progress reports.		*/
+	unsigned int nthreads;   /* Fill threads accounted separately.		*/
+	unsigned long long total;/* Bytes the run will write, for the ETA.	*/
+	unsigned long long start;/* statsOpen() time.				*/
+	unsigned long long last, last_bytes; /* Previous progress report.	*/
+	unsigned long files;     /* Files finished.				*/
+	char name[256];          /* File started last.				*/
+	unsigned int njobs;
+	struct stats_job *job;
+	struct stats_set run;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t reporter;
+	int stop;
+} st;
+
+/* ---- Histogram */
+
+static unsigned int histIndex(unsigned long long v)
+{
+	unsigned int msb = 0;
+	unsigned long long x = v;
+
+	if (v < (2U << HIST_SUB_BITS))
+		return (unsigned int)v;
+	while (x >>= 1)
+		msb++;
+	if (msb >= HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+	return (2U << HIST_SUB_BITS) + (msb - HIST_SUB_BITS - 1) * (1U << HIST_SUB_BITS) +
+		(unsigned int)(v >> (msb - HIST_SUB_BITS)) - (1U << HIST_SUB_BITS);
+}
+
+/* Highest value that lands in bucket i. */
+static unsigned long long histValue(unsigned int i)
+{
+	unsigned int msb, shift;
+	unsigned long long sub;
+
+	if (i < (2U << HIST_SUB_BITS))
+		return i;
+	i -= 2U << HIST_SUB_BITS;
+	msb = i / (1U << HIST_SUB_BITS) + HIST_SUB_BITS + 1;
+	sub = i % (1U << HIST_SUB_BITS) + (1U << HIST_SUB_BITS);
+	shift = msb - HIST_SUB_BITS;
+	return ((sub + 1) << shift) - 1;
+}
+
+void histAdd(struct lat_hist *h, unsigned long long v)
+{
+	h->bucket[histIndex(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+void histMerge(struct lat_hist *h, const struct lat_hist *o)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		h->bucket[i] += o->bucket[i];
+	h->count += o->count;
+	h->sum += o->sum;
+	if (o->max > h->max)
+		h->max = o->max;
+}
+
+/*
+ * Value below which the fraction p of the samples lie, 0 when empty.
+ */
+unsigned long long histPercentile(const struct lat_hist *h, double p)
+{
+	unsigned long long want, seen = 0, v;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+	want = (unsigned long long)(p * h->count + 0.5);
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += h->bucket[i];
+		if (seen >= want)
+		{
+			v = histValue(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/* ---- Reporting */
+
+unsigned long long statsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void setInit(struct stats_set *s)
+{
+	memset(s, 0, sizeof(*s));
+	s->fill_ns = CALLOC(unsigned long long, st.nthreads);
+	if (s->fill_ns == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+}
+
+static void setClear(struct stats_set *s)
+{
+	unsigned long long *fill = s->fill_ns;
+
+	memset(s, 0, sizeof(*s));
+	memset(fill, 0, st.nthreads * sizeof(fill[0]));
+	s->fill_ns = fill;
+}
+
+static unsigned long long setFill(const struct stats_set *s)
+{
+	unsigned long long ns = 0;
+	unsigned int t;
+
+	for (t = 0; t < st.nthreads; t++)
+		ns += s->fill_ns[t];
+	return ns;
+}
+
+/* Bytes written so far, including the files being written. */
+static unsigned long long liveBytes(void)
+{
+	unsigned long long bytes = st.run.bytes;
+	unsigned int j;
+
+	for (j = 0; j < st.njobs; j++)
+		bytes += st.job[j].set.bytes;
+	return bytes;
+}
+
+static unsigned int liveInflight(void)
+{
+	unsigned int n = 0, j;
+
+	for (j = 0; j < st.njobs; j++)
+		n += st.job[j].inflight;
+	return n;
+}
+
+/* Latencies of the files being written. */
+static void liveLat(struct lat_hist *h)
+{
+	unsigned int j;
+
+	memset(h, 0, sizeof(*h));
+	for (j = 0; j < st.njobs; j++)
+		histMerge(h, &st.job[j].set.lat);
+}
+
+static double mbps(unsigned long long bytes, unsigned long long ns)
+{
+	return ns ? (double)bytes / (1024 * 1024) / (ns / 1e9) : 0;
+}
+
+/* JSON record of a finished file or of the run. */
+static void jsonSet(const char *event, const char *name, const struct stats_set *s,
+	unsigned long long ns)
+{
+	unsigned int t;
+
+	fprintf(st.fp, "{\"event\":\"%s\",", event);
+	if (name != NULL)
+		fprintf(st.fp, "\"file\":\"%s\",", name);
+	fprintf(st.fp, "\"bytes\":%llu,\"seconds\":%.6f,\"mbps\":%.1f,"
+		"\"fill_seconds\":%.6f,\"write_seconds\":%.6f,\"writes\":%llu,"
+		"\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p99.9\":%.1f,\"max\":%.1f,\"mean\":%.1f},"
+		"\"fill_thread_seconds\":[",
+		s->bytes, ns / 1e9, mbps(s->bytes, ns), setFill(s) / 1e9, s->write_ns / 1e9,
+		s->writes, histPercentile(&s->lat, 0.5) / 1e3, histPercentile(&s->lat, 0.99) / 1e3,
+		histPercentile(&s->lat, 0.999) / 1e3, s->lat.max / 1e3,
+		s->lat.count ? (double)s->lat.sum / s->lat.count / 1e3 : 0);
+	for (t = 0; t < st.nthreads; t++)
+		fprintf(st.fp, "%s%.6f", t ? "," : "", s->fill_ns[t] / 1e9);
+	fprintf(st.fp, "]}\n");
+	fflush(st.fp);
+}
+
+/*
+ * Rewrite the Prometheus textfile. Latencies are a summary over the run,
+ * with the file being written as a label on the progress gauges.
+ */
+static void promWrite(double rate, double eta)
+{
+	const struct stats_set *s = &st.run;
+	static const double q[] = { 0.5, 0.99, 0.999 };
+	unsigned long long ns;
+	struct lat_hist lat;
+	unsigned int t, j;
+	FILE *fp;
+	int i;
+
+	liveLat(&lat);
+	histMerge(&lat, &st.run.lat);
+	fp = fopen(st.tmp, "w");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", st.tmp, strerror(errno));
+		return;
+	}
+	fprintf(fp, "# HELP comgen_written_bytes Bytes written so far.\n");
+	fprintf(fp, "# TYPE comgen_written_bytes counter\n");
+	fprintf(fp, "comgen_written_bytes %llu\n", liveBytes());
+	fprintf(fp, "# HELP comgen_write_mbps MiB/s over the last interval.\n");
+	fprintf(fp, "# TYPE comgen_write_mbps gauge\n");
+	fprintf(fp, "comgen_write_mbps{file=\"%s\"} %.1f\n", st.name, rate);
+	fprintf(fp, "# HELP comgen_eta_seconds Estimated time to completion.\n");
+	fprintf(fp, "# TYPE comgen_eta_seconds gauge\n");
+	fprintf(fp, "comgen_eta_seconds %.0f\n", eta);
+	fprintf(fp, "# HELP comgen_queue_depth Writes in flight.\n");
+	fprintf(fp, "# TYPE comgen_queue_depth gauge\n");
+	fprintf(fp, "comgen_queue_depth %u\n", liveInflight());
+	fprintf(fp, "# HELP comgen_files_done Files written.\n");
+	fprintf(fp, "# TYPE comgen_files_done counter\n");
+	fprintf(fp, "comgen_files_done %lu\n", st.files);
+	fprintf(fp, "# HELP comgen_fill_seconds_total Time spent filling blocks.\n");
+	fprintf(fp, "# TYPE comgen_fill_seconds_total counter\n");
+	for (t = 0; t < st.nthreads; t++)
+	{
+		for (ns = s->fill_ns[t], j = 0; j < st.njobs; j++)
+			ns += st.job[j].set.fill_ns[t];
+		fprintf(fp, "comgen_fill_seconds_total{thread=\"%u\"} %.6f\n", t, ns / 1e9);
+	}
+	fprintf(fp, "# HELP comgen_write_seconds_total Time the writer spent submitting and waiting.\n");
+	fprintf(fp, "# TYPE comgen_write_seconds_total counter\n");
+	for (ns = s->write_ns, j = 0; j < st.njobs; j++)
+		ns += st.job[j].set.write_ns;
+	fprintf(fp, "comgen_write_seconds_total %.6f\n", ns / 1e9);
+	fprintf(fp, "# HELP comgen_write_latency_seconds Write submission to completion.\n");
+	fprintf(fp, "# TYPE comgen_write_latency_seconds summary\n");
+	for (i = 0; i < 3; i++)
+		fprintf(fp, "comgen_write_latency_seconds{quantile=\"%g\"} %.9f\n", q[i],
+			histPercentile(&lat, q[i]) / 1e9);
+	fprintf(fp, "comgen_write_latency_seconds_sum %.9f\n", lat.sum / 1e9);
+	fprintf(fp, "comgen_write_latency_seconds_count %llu\n", lat.count);
+	fprintf(fp, "# HELP comgen_write_latency_max_seconds Slowest write.\n");
+	fprintf(fp, "# TYPE comgen_write_latency_max_seconds gauge\n");
+	fprintf(fp, "comgen_write_latency_max_seconds %.9f\n", lat.max / 1e9);
+	if (fclose(fp) != 0 || rename(st.tmp, st.path) != 0)
+		fprintf(stderr, "Error writing %s: %s\n", st.path, strerror(errno));
+}
+
+/* One progress report; the lock is held. */
+static void progress(void)
+{
+	unsigned long long now = statsNow();
+	unsigned long long bytes = liveBytes();
+	struct lat_hist lat;
+	double rate, eta;
+
+	rate = mbps(bytes - st.last_bytes, now - st.last);
+	/* ETA from the average rate, steadier than the last interval. */
+	eta = 0;
+	if (bytes > 0 && st.total > bytes)
+		eta = (double)(st.total - bytes) * ((now - st.start) / 1e9) / bytes;
+	st.last = now;
+	st.last_bytes = bytes;
+
+	if (st.prom)
+	{
+		promWrite(rate, eta);
+		return;
+	}
+	liveLat(&lat);
+	fprintf(st.fp, "{\"event\":\"progress\",\"time\":%.3f,\"file\":\"%s\",\"bytes\":%llu,"
+		"\"mbps\":%.1f,\"eta\":%.0f,\"queue_depth\":%u,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+		(now - st.start) / 1e9, st.name, bytes, rate, eta, liveInflight(),
+		histPercentile(&lat, 0.99) / 1e3, lat.max / 1e3);
+	fflush(st.fp);
+}
+
+static void *reporter(void *arg)
+{
+	struct timespec ts;
+	double next;
+
+	pthread_mutex_lock(&st.lock);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	next = ts.tv_sec + ts.tv_nsec / 1e9;
+	while (!st.stop)
+	{
+		next += st.interval;
+		ts.tv_sec = (time_t)next;
+		ts.tv_nsec = (long)((next - ts.tv_sec) * 1e9);
+		while (!st.stop && pthread_cond_timedwait(&st.wake, &st.lock, &ts) != ETIMEDOUT)
+			;
+		if (!st.stop)
+			progress();
+	}
+	pthread_mutex_unlock(&st.lock);
+	return arg;
+}
+
+/*
+ * Start the instrumentation. spec is "-" for JSON lines on stderr, a
+ * file name for JSON lines, or "prom:<file>" for a Prometheus textfile.
+ * Progress is reported every interval seconds, never when 0. nthreads
+ * fill threads are accounted apart, njobs files are written at a time,
+ * total is the bytes the run writes.
+ */
+void statsOpen(const char *spec, double interval, unsigned int nthreads, unsigned int njobs,
+	unsigned long long total)
+{
+	unsigned int j;
+
+	memset(&st, 0, sizeof(st));
+	st.nthreads = nthreads ? nthreads : 1;
+	st.njobs = njobs ? njobs : 1;
+	st.interval = interval;
+	st.total = total;
+	if (strncmp(spec, "prom:", 5) == 0)
+	{
+		st.prom = 1;
+		st.path = strdup(spec + 5);
+		st.tmp = malloc(strlen(spec) + 8);
+		if (st.path == NULL || st.tmp == NULL)
+		{
+			fprintf(stderr, "Error: out of memory\n");
+			exit(-1);
+		}
+		sprintf(st.tmp, "%s.tmp", st.path);
+	}
+	else if (strcmp(spec, "-") == 0)
+		st.fp = stderr;
+	else
+	{
+		st.fp = fopen(spec, "w");
+		if (st.fp == NULL)
+		{
+			fprintf(stderr, "Error opening %s: %s\n", spec, strerror(errno));
+			exit(-2);
+		}
+	}
+	st.job = CALLOC(struct stats_job, st.njobs);
+	if (st.job == NULL)
+	{
+		fprintf(stderr, "Error: out of memory\n");
+		exit(-1);
+	}
+	for (j = 0; j < st.njobs; j++)
+		setInit(&st.job[j].set);
+	setInit(&st.run);
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.wake, NULL);
+	st.start = st.last = statsNow();
+	st.on = 1;
+	if (interval > 0 && pthread_create(&st.reporter, NULL, reporter, NULL) != 0)
+	{
+		fprintf(stderr, "Error creating stats thread: %s\n", strerror(errno));
+		exit(-1);
+	}
+}
+
+/*
+ * Job job starts writing file name.
+ */
+void statsFileStart(unsigned int job, const char *name)
+{
+	struct stats_job *f;
+
+	if (!st.on)
+		return;
+	pthread_mutex_lock(&st.lock);
+	f = &st.job[job % st.njobs];
+	snprintf(f->name, sizeof(f->name), "%s", name);
+	snprintf(st.name, sizeof(st.name), "%s", name);
+	f->start = statsNow();
+	pthread_mutex_unlock(&st.lock);
+}
+
+/*
+ * Report the file of job and fold its counters into the run.
+ */
+void statsFileEnd(unsigned int job)
+{
+	struct stats_job *f;
+	unsigned int t;
+
+	if (!st.on)
+		return;
+	pthread_mutex_lock(&st.lock);
+	f = &st.job[job % st.njobs];
+	if (!st.prom)
+		jsonSet("file", f->name, &f->set, statsNow() - f->start);
+	st.run.bytes += f->set.bytes;
+	st.run.writes += f->set.writes;
+	st.run.write_ns += f->set.write_ns;
+	for (t = 0; t < st.nthreads; t++)
+		st.run.fill_ns[t] += f->set.fill_ns[t];
+	histMerge(&st.run.lat, &f->set.lat);
+	setClear(&f->set);
+	f->inflight = 0;
+	st.files++;
+	if (st.prom)
+		progress();
+	pthread_mutex_unlock(&st.lock);
+}
+
+/*
+ * Fill thread t of job spent ns filling a block.
+ */
+void statsFill(unsigned int job, unsigned int t, unsigned long long ns)
+{
+	if (!st.on)
+		return;
+	pthread_mutex_lock(&st.lock);
+	st.job[job % st.njobs].set.fill_ns[t % st.nthreads] += ns;
+	pthread_mutex_unlock(&st.lock);
+}
+
+/*
+ * A write of bytes by job completed, ns after it was submitted. ns 0 counts
+ * bytes written without a latency, as by the pwritev and clone repeats.
+ */
+void statsWrite(unsigned int job, unsigned long bytes, unsigned long long ns)
+{
+	struct stats_set *s;
+
+	if (!st.on)
+		return;
+	pthread_mutex_lock(&st.lock);
+	s = &st.job[job % st.njobs].set;
+	s->bytes += bytes;
+	if (ns > 0)
+	{
+		s->writes++;
+		histAdd(&s->lat, ns);
+	}
+	pthread_mutex_unlock(&st.lock);
+}
+
+/*
+ * The writer of job spent ns submitting or waiting, inflight writes are
+ * queued.
+ */
+void statsWriteTime(unsigned int job, unsigned long long ns, unsigned int inflight)
+{
+	struct stats_job *f;
+
+	if (!st.on)
+		return;
+	pthread_mutex_lock(&st.lock);
+	f = &st.job[job % st.njobs];
+	f->set.write_ns += ns;
+	f->inflight = inflight;
+	pthread_mutex_unlock(&st.lock);
+}
+
+/*
+ * Stop the reporter and write the summary of the run.
+ */
+void statsClose(void)
+{
+	unsigned int j;
+
+	if (!st.on)
+		return;
+	pthread_mutex_lock(&st.lock);
+	st.stop = 1;
+	pthread_cond_signal(&st.wake);
+	pthread_mutex_unlock(&st.lock);
+	if (st.interval > 0)
+		pthread_join(st.reporter, NULL);
+
+	for (j = 0; j < st.njobs; j++)
+		st.job[j].inflight = 0;
+	if (st.prom)
+		progress();
+	else
+	{
+		jsonSet("run", NULL, &st.run, statsNow() - st.start);
+		if (st.fp != stderr)
+			fclose(st.fp);
+	}
+	st.on = 0;
+	for (j = 0; j < st.njobs; j++)
+		free(st.job[j].set.fill_ns);
+	free(st.job);
+	free(st.run.fill_ns);
+	free(st.path);
+	free(st.tmp);
+	pthread_cond_destroy(&st.wake);
+	pthread_mutex_destroy(&st.lock);
+}
+#endif
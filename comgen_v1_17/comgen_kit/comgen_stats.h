@@ -0,0 +1,41 @@
+/*
+ * comgen_stats.h
+ *
+ * --stats instrumentation: fill and write time per file and per fill
+ * thread, write latency histograms and periodic progress, exported as
+ * JSON lines or as a Prometheus textfile. All entry points do nothing
+ * until statsOpen() has been called.
+ */
+#ifndef __COMGEN_STATS_H__
+#define __COMGEN_STATS_H__
+
+/*
+ * HDR style latency histogram in nanoseconds: exact below 64, then 32
+ * linear buckets per power of two, so every value is kept to within 3%.
+ * Values of 2^40 ns (about 18 minutes) and more share the last bucket.
+ */
+#define HIST_SUB_BITS	5
+#define HIST_MAX_BITS	40
+#define HIST_BUCKETS	((2 << HIST_SUB_BITS) + (HIST_MAX_BITS - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS))
+
+struct lat_hist {
+	unsigned long long count;
+	unsigned long long sum;  /* Of all values, for the mean.		*/
+	unsigned long long max;
+	unsigned long long bucket[HIST_BUCKETS];
+};
+
+void histAdd(struct lat_hist *, unsigned long long);
+void histMerge(struct lat_hist *, const struct lat_hist *);
+unsigned long long histPercentile(const struct lat_hist *, double);
+
+unsigned long long statsNow(void);
+void statsOpen(const char *, double, unsigned int, unsigned int, unsigned long long);
+void statsFileStart(unsigned int, const char *);
+void statsFileEnd(unsigned int);
+void statsFill(unsigned int, unsigned int, unsigned long long);
+void statsWrite(unsigned int, unsigned long, unsigned long long);
+void statsWriteTime(unsigned int, unsigned long long, unsigned int);
+void statsClose(void);
+
+#endif
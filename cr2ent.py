@@ -1,50 +1,266 @@
-import sys
-import zstd
+###############################################################################
+# Compression ratio to entropy calibration
+#
+# Execute cmd: python3 cr2ent.py [-c zstd:1,deflate:6,lz4:1] [-b 4096,65536]
+#                                [-s 16] [-j jobs] [-f]
+#
+#     For every codec:level and block size, entropy is swept over a grid and
+#     the compression ratio of many gen_ent_seq() samples is measured. The
+#     work is spread over all cores, and samples are shared by the codecs.
+#
+#     The results go to cr2ent.bin, a table that is memory mapped for
+#     lookups. Series already in the table are kept as long as the codec
+#     library version is unchanged, so only new or upgraded codecs are
+#     measured again (-f measures everything again).
+#
+#     cr2ent.bin layout, little endian:
+#       header  8s magic, I series count, I reserved
+#       series  16s codec, i level, I block size, 24s codec version,
+#               Q offset of the points, I point count, I reserved
+#       points  d ratio, d entropy; ascending ratio, descending entropy
+###############################################################################
+
+import sys, os, argparse, bisect, mmap, random, struct, zlib
+import multiprocessing
 import entSeqEngine
-import json, os
-
-#cr = round(float(sys.argv[1]), 1)
-ent_list = [x*0.1 for x in range(1, 80)]
-json_file = "cr2ent.json"
-
-cr_ent_dict = {}
-
-if os.path.exists(json_file):
-    with open(json_file) as jf:
-        cr_ent_dict = json.load(jf)
-else:
-    for e in ent_list:
-        a, b = entSeqEngine.gen_ent_seq(4096, e)
-        retry = 20
-        while not b and retry:
-            a, b = entSeqEngine.gen_ent_seq(4096, e)
-            retry -= 1
-    
-        if b:
-            h = ''
-            for i in b:
-                t = hex(i)[2:]
-                if len(t) != 2:
-                    t = '0' * (2-len(t)) + t
-                h = h + t
-            if h:
-                byte_content = entSeqEngine.hex2bin(h)
-                ret = zstd.compress(byte_content, 1, 1)
-                cr_ent_dict[str(round(4096/len(ret), 1))] = round(e,1)
-
-    with open(json_file, "w") as outfile:
-        json.dump(cr_ent_dict, outfile)
-
-#print(cr)
-#print(cr_ent_dict)
-
-def cr2ent_fun(c):
-    cr = c
-    while str(round(cr,1)) not in cr_ent_dict and cr <= 40:
-        cr += 0.1
 
+bin_file = "cr2ent.bin"
+MAGIC = b"CR2ENT01"
+HEADER = struct.Struct("<8sII")
+SERIES = struct.Struct("<16siI24sQII")
+POINT = struct.Struct("<dd")
+
+# the series cr2ent_fun() uses, as the old cr2ent.json did
+default_series = ("zstd", 1, 4096)
+default_levels = {"zstd": 3, "lz4": 1, "deflate": 6}
+ent_list = [x*0.05 for x in range(1, 160)] + [7.99]
+
+
+def codec_version(name):
+    """
+    version of the library behind a codec, None when it is not installed
+    """
     try:
-        return cr_ent_dict[str(round(cr,1))]
-    except:
-        print("Compression ratio {} is too high to be achieved!".format(round(cr,1)))
+        if name == "deflate":
+            return zlib.ZLIB_VERSION
+        if name == "zstd":
+            import zstd
+            return str(getattr(zstd, "ZSTD_version", zstd.version)())
+        if name == "lz4":
+            import lz4.block
+            return lz4.library_version_string()
+    except (ImportError, AttributeError):
         return None
+    raise ValueError("unknown codec {}".format(name))
+
+
+def compress(name, level, data):
+    if name == "deflate":
+        return zlib.compress(data, level)
+    if name == "zstd":
+        import zstd
+        return zstd.compress(data, level, 1)
+    import lz4.block
+    if level > 1:
+        return lz4.block.compress(data, mode="high_compression",
+                                  compression=level, store_size=False)
+    return lz4.block.compress(data, store_size=False)
+
+
+def parse_codec(spec):
+    name, _, level = spec.partition(":")
+    if name not in default_levels:
+        raise ValueError("unknown codec {}, use zstd, lz4 or deflate".format(name))
+    return name, int(level) if level else default_levels[name]
+
+
+def _measure(task):
+    """
+    worker: compression ratio of each codec over samples at one entropy
+    """
+    block, e, samples, codecs = task
+    random.seed("{}:{}".format(block, round(e, 4)))
+    total = {c: 0 for c in codecs}
+    n = 0
+    for _ in range(samples):
+        a, s = entSeqEngine.gen_ent_seq(block, e)
+        if not s:
+            continue
+        data = bytes(s)
+        n += len(data)
+        for c in codecs:
+            total[c] += len(compress(c[0], c[1], data))
+    return block, e, {c: (n/total[c] if n else 0) for c in codecs}
+
+
+def monotone(points):
+    """
+    (entropy, ratio) points to (ratio, entropy) sorted by ratio, with the
+    ratio made non-increasing in entropy so the table can be inverted
+    """
+    points = sorted(points)
+    out = []
+    r_max = 0
+    for e, r in reversed(points):
+        if r <= 0:
+            continue
+        r_max = max(r_max, r)
+        out.append((r_max, e))
+    return out
+
+
+class CalTable:
+    """
+    memory mapped cr2ent.bin; each series is looked up by bisection
+    """
+    class _Ratios:
+        def __init__(self, mm, off, n):
+            self.mm, self.off, self.n = mm, off, n
+        def __len__(self):
+            return self.n
+        def __getitem__(self, i):
+            return POINT.unpack_from(self.mm, self.off + i*POINT.size)[0]
+
+    def __init__(self, path=bin_file):
+        self.series = {}
+        self.mm = None
+        if not os.path.exists(path) or os.path.getsize(path) < HEADER.size:
+            return
+        with open(path, "rb") as fp:
+            self.mm = mmap.mmap(fp.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, count, _ = HEADER.unpack_from(self.mm, 0)
+        if magic != MAGIC:
+            print("{} is not a calibration table".format(path))
+            self.mm = None
+            return
+        for i in range(count):
+            name, level, block, version, off, n, _ = \
+                SERIES.unpack_from(self.mm, HEADER.size + i*SERIES.size)
+            key = (name.rstrip(b"\0").decode(), level, block)
+            self.series[key] = (version.rstrip(b"\0").decode(), off, n)
+
+    def points(self, key):
+        version, off, n = self.series[key]
+        return [POINT.unpack_from(self.mm, off + i*POINT.size) for i in range(n)]
+
+    def entropy(self, ratio, key=default_series):
+        """
+        entropy giving this compression ratio, interpolated between the
+        two calibration points around it; None when the ratio is higher
+        than any measured
+        """
+        if key not in self.series:
+            return None
+        version, off, n = self.series[key]
+        if n == 0:
+            return None
+        i = bisect.bisect_left(self._Ratios(self.mm, off, n), ratio)
+        if i == n:
+            return None
+        r1, e1 = POINT.unpack_from(self.mm, off + i*POINT.size)
+        if i == 0 or r1 == ratio:
+            return e1
+        r0, e0 = POINT.unpack_from(self.mm, off + (i-1)*POINT.size)
+        return e0 + (e1 - e0) * (ratio - r0) / (r1 - r0)
+
+
+def write_table(series, path=bin_file):
+    """
+    series: {(codec, level, block): (version, [(ratio, entropy), ...])}
+    """
+    keys = sorted(series)
+    off = HEADER.size + len(keys)*SERIES.size
+    out = bytearray(HEADER.pack(MAGIC, len(keys), 0))
+    for k in keys:
+        version, pts = series[k]
+        out += SERIES.pack(k[0].encode(), k[1], k[2], version.encode()[:24],
+                           off, len(pts), 0)
+        off += len(pts)*POINT.size
+    for k in keys:
+        for p in series[k][1]:
+            out += POINT.pack(*p)
+    tmp = path + ".tmp"
+    with open(tmp, "wb") as fp:
+        fp.write(out)
+    os.replace(tmp, path)
+
+
+def calibrate(codecs, blocks, samples=16, jobs=None, force=False, path=bin_file):
+    """
+    measure the (codec, level) x block size series that are missing from
+    the table or were measured with another codec version
+    """
+    table = CalTable(path)
+    series = {k: (v[0], table.points(k)) for k, v in table.series.items()}
+    versions = {}
+    for c in codecs:
+        versions[c[0]] = codec_version(c[0])
+        if versions[c[0]] is None:
+            print("Codec {} is not installed, skipped".format(c[0]))
+    todo = {}
+    for b in blocks:
+        for c in codecs:
+            k = (c[0], c[1], b)
+            if versions[c[0]] and (force or k not in series or series[k][0] != versions[c[0]]):
+                todo.setdefault(b, []).append(c)
+    if not todo:
+        return table
+
+    # fewer samples of large blocks: up to 1 MiB per point, at least 4
+    tasks = [(b, e, max(4, min(samples, (1 << 20)//b)), cs)
+             for b, cs in todo.items() for e in ent_list]
+    measured = {}
+    with multiprocessing.Pool(jobs) as pool:
+        for b, e, ratios in pool.imap_unordered(_measure, tasks):
+            for c, r in ratios.items():
+                measured.setdefault((c[0], c[1], b), []).append((e, r))
+    for k, pts in measured.items():
+        series[k] = (versions[k[0]], monotone(pts))
+    del table
+    write_table(series, path)
+    return CalTable(path)
+
+
+_table = None
+
+def cr2ent_fun(c, key=default_series):
+    global _table
+    if _table is None or key not in _table.series:
+        _table = CalTable()
+        if key not in _table.series:
+            _table = calibrate([key[:2]], [key[2]])
+    if key not in _table.series:
+        print("No {}:{} calibration for {} byte blocks".format(*key))
+        return None
+    e = _table.entropy(c, key)
+    if e is None:
+        print("Compression ratio {} is too high to be achieved!".format(round(c, 1)))
+        return None
+    return round(e, 4)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-c", "--codecs", type=str, default="zstd:1",
+                        help="comma separated codec[:level] list, codecs are zstd, lz4 and deflate")
+    parser.add_argument("-b", "--blocks", type=str, default="4096",
+                        help="comma separated block sizes in bytes")
+    parser.add_argument("-s", "--samples", type=int, default=16,
+                        help="samples per entropy point")
+    parser.add_argument("-j", "--jobs", type=int, default=None,
+                        help="worker processes, defaults to all cores")
+    parser.add_argument("-f", "--force", action="store_true",
+                        help="measure all series again")
+    args = parser.parse_args()
+
+    try:
+        codecs = [parse_codec(x) for x in args.codecs.split(",")]
+    except ValueError as err:
+        print(err)
+        sys.exit(1)
+    blocks = [int(x) for x in args.blocks.split(",")]
+    t = calibrate(codecs, blocks, args.samples, args.jobs, args.force)
+    for k in sorted(t.series):
+        pts = t.points(k)
+        print("{}:{} {} bytes, {} points, ratio {:.2f} to {:.2f}".format(
+            k[0], k[1], k[2], len(pts), pts[0][0] if pts else 0, pts[-1][0] if pts else 0))
@@ -1,7 +1,5 @@
 ###############################################################################
 # Execute cmd: python3 entSeqEngine.py 4096 2 ent2_4k.bin
-# !!! Note, because random algorithms are used, you may need to try more than 1 time to successfully generated the target file
-#
 #     Arg 4096 is number of bytes to generate
 #     Arg 2 is entropy. The lower this value, the higher the compression ratio
 #       -set this value to 3 can generate a file with compression ratio of ~4
@@ -278,32 +276,113 @@ def m_entropy_cal(s):
     return round(e_x, 4)
 
 
-def gen_ent_seq(n, e):
+def _clog2c(c):
+    return c*math.log(c, 2) if c else 0
+
+
+class EntropyTracker:
     """
-    generate a n bytes sequence with entropy value of e
-    n: int
-    e: float
+    256-bucket byte histogram with a running sum of c*log2(c), so the
+    entropy is updated in O(1) per byte added or removed
+    """
+    def __init__(self, s=None):
+        self.count = [0]*256
+        self.n = 0
+        self.sum = 0.0
+        if s:
+            for x, n_x in collections.Counter(s).items():
+                self.add(x, n_x)
+
+    def add(self, b, k=1):
+        c = self.count[b]
+        self.sum += _clog2c(c + k) - _clog2c(c)
+        self.count[b] = c + k
+        self.n += k
+
+    def remove(self, b, k=1):
+        c = self.count[b]
+        self.sum += _clog2c(c - k) - _clog2c(c)
+        self.count[b] = c - k
+        self.n -= k
+
+    def entropy(self):
+        if not self.n:
+            return 0
+        return max(0, math.log(self.n, 2) - self.sum/self.n)
+
+
+def ent_of_counts(counts, n):
     """
+    entropy of a byte histogram over n bytes, not rounded
+    """
+    e_x = 0
+    for n_x in counts:
+        if n_x:
+            p_x = n_x/n
+            e_x -= p_x*math.log(p_x, 2)
+    return e_x
 
-    zero_too_many = []
-    zero_too_few = []
-    too_many = 0
 
-    BASE_ELEMENTS = 3
-    s_base = gen_rnd_bs(BASE_ELEMENTS)
+def ent_plan_counts(n, n1):
+    """
+    histogram with n1 copies of the dominant byte and the other n - n1
+    bytes spread as evenly as possible over up to 255 other values
+    """
+    rest = n - n1
+    m = min(rest, 255)
+    counts = [n1]
+    for i in range(m):
+        counts.append(rest//m + (1 if i < rest % m else 0))
+    return counts
 
-    last_n0 = -1
-    last_n1 = n+1
-    n0 = n//2
-    n1 = n - n0
-    s0 = gen_rnd_bs(n0)
-    # s1 is a random int duplicated multiple time
-    if e > 2:
-        s1 = [random.randint(0, 255)] * n1
-    else:
-        s1 = [0] * n1
 
-    err = m_entropy_cal(s0+s1) - e
+def ent_histogram(n, e, err_bound=0.01):
+    """
+    byte counts of a n bytes sequence with entropy value of e
+
+    The entropy of ent_plan_counts(n, n1) falls as n1 goes from an even
+    spread (n/256) to n, so n1 is found by bisection and a short scan
+    around it, as comgen -E does. Returns None when n is too short for
+    any histogram to get within err_bound of e.
+    """
+    lo = (n + 255)//256
+    hi = n
+    while lo < hi:
+        mid = (lo + hi)//2
+        if ent_of_counts(ent_plan_counts(n, mid), n) > e:
+            lo = mid + 1
+        else:
+            hi = mid
+
+    # rounding of the even spread makes it only nearly monotone, so scan
+    # around lo; going from n1 to n1 + 1 moves one byte from the last
+    # rounded up bucket of the spread to the dominant one
+    first = max((n + 255)//256, lo - 16)
+    t = EntropyTracker()
+    for i, c in enumerate(ent_plan_counts(n, first)):
+        t.add(i, c)
+    best, best_err = first, abs(t.entropy() - e)
+    for n1 in range(first + 1, min(n, lo + 16) + 1):
+        rest = n - (n1 - 1)
+        t.remove((rest - 1) % min(rest, 255) + 1)
+        t.add(0)
+        if abs(t.entropy() - e) < best_err:
+            best, best_err = n1, abs(t.entropy() - e)
+    counts = ent_plan_counts(n, best)
+    if abs(ent_of_counts(counts, n) - e) > err_bound:
+        return None
+    return counts
+
+
+def gen_ent_seq(n, e):
+    """
+    generate a n bytes sequence with entropy value of e
+    n: int
+    e: float
+
+    The byte counts come from ent_histogram(), so only their order is
+    random: one pass, and no retries are needed.
+    """
 
     err_bound = 0.01
     ent_range = [0, 7.99]
@@ -311,83 +390,31 @@ def gen_ent_seq(n, e):
     if e < ent_range[0] or e > ent_range[1]:
         raise ValueError("e must be in the range of {}".format(ent_range))
 
-    max_try = 2000
-    #max_try = 200
-    adjustment_factor = 1.0
-    while abs(err) > err_bound and max_try > 0 and n0 <= n and n1 <= n:
-        max_try -= 1
-        #print(n0, n1, err)
-        #print(zero_too_few, zero_too_many)
-        adjustment_factor = max(0.5, min(1, 1 - abs(err)))
-        if err > 0:
-            # reduce random sequence and add 0s
-            while n1 in zero_too_few:
-                n1 -= 1
-            zero_too_few.append(n1)
-            
-            # last try has too many zeros
-            # this try has too few zeros
-            if too_many == 1:
-                try:
-                    n1 = (n1 + zero_too_many[-1] ) // 2
-                except:
-                    n1 = n1 // 2
-                n0 = n - n1
-                too_many = 0
-            # last try has too few zeros
-            # this try also has too few zeros
-            # reduce random by half
-            else:
-                n0 = max(1, int(n0 * adjustment_factor))
-                n1 = n - n0
-
-            s0 = s0[:n0]
-            #s1 = s1 + [s_base[random.randint(0, BASE_ELEMENTS-1)]] * (n - n0 - len(s1))
-            if e > 2:
-                s1 = s1 + [random.randint(0, 255)] * (n - n0 - len(s1))
-            else:
-                s1 = s1 + [0] * (n - n0 - len(s1))
-
-
-        else:
-            # add random sequence and reduce 0s
-            while n1 in zero_too_many:
-                n1 += 1
-            zero_too_many.append(n1)
-
-            # last try has too many zeros
-            # this try has too many zeros
-            if too_many == 1:
-                n1 = n1 // 2
-                n0 = n - n1
-            # last try has too few zeros
-            # this try also has too many zeros
-            # reduce random by half
-            else:
-                try:
-                    n1 = (n1 + zero_too_few[-1] ) // 2
-                except:
-                    n1 = n1 // 2
-                n0 = n - n1
-                too_many = 1
-
-
-            s1 = s1[:n1]
-            s0 = s0 + gen_rnd_bs(n0 - len(s0))
-
-        s = s0 + s1
-        err = m_entropy_cal(s) - e
-
-    if not (max_try > 0 and n0 <= n and n1 <= n):
-        print("Entropy does not converge")
+    counts = ent_histogram(n, e, err_bound) if n > 0 else None
+    if not counts:
+        print("Entropy {} can not be reached with {} bytes".format(e, n))
         return None, None
 
+    # s1 is a random int duplicated multiple time
+    if e > 2:
+        d = random.randint(0, 255)
+    else:
+        d = 0
+    others = [x for x in range(256) if x != d]
+    rot = random.randint(0, 254)
+    others = others[rot:] + others[:rot]
+
+    # s0 holds the other bytes with exactly the planned counts
+    s0 = []
+    for i, c in enumerate(counts[1:]):
+        s0 += [others[i]] * c
+    random.shuffle(s0)
+    s1 = [d] * counts[0]
+    s = s0 + s1
+
     # chunk s with 6 bytes each group
     csz = random.randint(3, 8)
-    try:
-        s_chunks = [s[x: x+csz] for x in range(0, len(s), csz)]
-    except:
-        return None, None
+    s_chunks = [s[x: x+csz] for x in range(0, len(s), csz)]
 
     # shuffle a list
     random.shuffle(s_chunks)
@@ -398,7 +425,11 @@ def gen_ent_seq(n, e):
 
     assert(len(s) == n)
 
-    return m_entropy_cal(s), s
+    # the shuffles keep the counts, so the entropy is that of the plan
+    t = EntropyTracker()
+    for x, c in zip([d] + others, counts):
+        t.add(x, c)
+    return round(t.entropy(), 4), s
 
 def generator(n, e):
     h = ''
@@ -427,4 +458,4 @@ if __name__=="__main__":
         print(e, len(s), h)
         hex2binfile(h, sys.argv[3])
     else:
-        print('Data generation failed, supported MAX entropy parameter is 7.96')
+        print('Data generation failed')
@@ -37,7 +37,7 @@ def generate():
             h = h + t
         entSeqEngine.hex2binfile(h, out_bin)
     else:
-        print('Data generation failed, supported MAX entropy parameter is 7.96')
+        print('Data generation failed')
 
 # python3 ssd_compress.py gzip file_name 
 if __name__ == '__main__':
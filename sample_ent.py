@@ -3,8 +3,19 @@ import argparse
 import entSeqEngine
 import cr2ent
 import random
+import math
+
+
+def mm_entropy(s):
+    """
+    Miller-Madow estimate of the entropy from the sample s: the entropy of
+    the sample plus (m - 1) / 2n nats, m being the byte values seen. This
+    replaces a table of factors that only knew two sample ratios; see
+    comgen --analyze --sample for the native estimators.
+    """
+    m = len(set(s))
+    return round(entSeqEngine.m_entropy_cal(s) + (m - 1)/(2*len(s)*math.log(2)), 4)
 
-sample_ent_adjust = {0.05:1.143, 0.1:1.07}
 
 def generate():
     parser = argparse.ArgumentParser()
@@ -35,10 +46,10 @@ def generate():
             sample_size = int(args.length * args.sample_ratio)
             #print('sample size', sample_size)
             sample_bytes = random.choices(s, k=sample_size)
-            sample_ent = entSeqEngine.m_entropy_cal(sample_bytes) * sample_ent_adjust[args.sample_ratio]
+            sample_ent = mm_entropy(sample_bytes)
             print("original entropy, {}, sample entropy, {}".format(orig_ent, sample_ent) )
         else:
-            print('Data generation failed, supported MAX entropy parameter is 7.96')
+            print('Data generation failed')
 
 if __name__ == '__main__':
     generate()